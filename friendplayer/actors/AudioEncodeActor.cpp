@@ -4,15 +4,18 @@
 
 #include "actors/CommonActorNames.h"
 
+#include <algorithm>
+
 AudioEncodeActor::AudioEncodeActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
-    : TimerActor(actor_map, buffer_map, std::move(name)), stream_num(-1) {
+    : TimerActor(actor_map, buffer_map, std::move(name)), stream_num(-1), current_bitrate(DEFAULT_BITRATE),
+      current_loss_percent(0) {
     audio_streamer = std::make_unique<AudioStreamer>();
 }
 
 AudioEncodeActor::~AudioEncodeActor() {}
 
 void AudioEncodeActor::OnInit(const std::optional<any_msg>& init_msg) {
-    audio_streamer->InitEncoder(64000);
+    audio_streamer->InitEncoder(DEFAULT_BITRATE);
     SetTimerInternal(20, true);
     if (init_msg) {
         fp_actor::AudioEncodeInit encode_init_msg;
@@ -21,14 +24,62 @@ void AudioEncodeActor::OnInit(const std::optional<any_msg>& init_msg) {
     }
 }
 
+void AudioEncodeActor::OnMessage(const any_msg& msg) {
+    if (msg.Is<fp_actor::EncoderBitrate>()) {
+        fp_actor::EncoderBitrate bitrate_msg;
+        msg.UnpackTo(&bitrate_msg);
+        OnEncoderBitrate(bitrate_msg);
+    } else if (msg.Is<fp_actor::AudioPacketLoss>()) {
+        fp_actor::AudioPacketLoss loss_msg;
+        msg.UnpackTo(&loss_msg);
+        OnPacketLoss(loss_msg);
+    } else {
+        TimerActor::OnMessage(msg);
+    }
+}
+
+void AudioEncodeActor::OnEncoderBitrate(const fp_actor::EncoderBitrate& msg) {
+    if (msg.remove()) {
+        client_bitrates.erase(msg.client_actor_name());
+        client_loss_percents.erase(msg.client_actor_name());
+        UpdatePacketLoss();
+    } else {
+        client_bitrates[msg.client_actor_name()] = msg.bitrate();
+    }
+    uint32_t bitrate = DEFAULT_BITRATE;
+    for (auto&& [name, client_bitrate] : client_bitrates) {
+        bitrate = std::min(bitrate, client_bitrate);
+    }
+    if (bitrate != current_bitrate && audio_streamer->SetBitrate(bitrate)) {
+        current_bitrate = bitrate;
+    }
+}
+
+void AudioEncodeActor::OnPacketLoss(const fp_actor::AudioPacketLoss& msg) {
+    client_loss_percents[msg.client_actor_name()] = msg.loss_percent();
+    UpdatePacketLoss();
+}
+
+void AudioEncodeActor::UpdatePacketLoss() {
+    uint32_t loss_percent = 0;
+    for (auto&& [name, client_loss_percent] : client_loss_percents) {
+        loss_percent = std::max(loss_percent, client_loss_percent);
+    }
+    if (loss_percent != current_loss_percent && audio_streamer->SetPacketLoss(loss_percent)) {
+        current_loss_percent = loss_percent;
+    }
+}
+
 void AudioEncodeActor::OnTimerFire() {
     std::string raw_frame;
     std::string* enc_frame = new std::string();
     audio_streamer->CaptureAudio(raw_frame);
+    const uint64_t capture_timestamp = clock::now().time_since_epoch().count();
     if (audio_streamer->EncodeAudio(raw_frame, *enc_frame)) {
         fp_actor::AudioData audio_data;
         audio_data.set_stream_num(stream_num);
         audio_data.set_handle(buffer_map.Wrap(enc_frame));
+        audio_data.set_timestamp(capture_timestamp);
         SendTo(CLIENT_MANAGER_ACTOR_NAME, audio_data);
     }
 }
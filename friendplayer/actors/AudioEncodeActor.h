@@ -2,20 +2,36 @@
 
 #include "actors/TimerActor.h"
 
+#include <map>
+
 class AudioStreamer;
 
 class AudioEncodeActor : public TimerActor {
 public:
+    static constexpr uint32_t DEFAULT_BITRATE = 64000;
+
     AudioEncodeActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name);
 
     virtual ~AudioEncodeActor();
 
     void OnInit(const std::optional<any_msg>& init_msg) override;
+    void OnMessage(const any_msg& msg) override;
     void OnTimerFire() override;
 
 private:
     std::unique_ptr<AudioStreamer> audio_streamer;
     uint32_t stream_num;
+
+    // Target bitrate requested by each client's congestion controller
+    std::map<std::string, uint32_t> client_bitrates;
+    uint32_t current_bitrate;
+    void OnEncoderBitrate(const fp_actor::EncoderBitrate& msg);
+
+    // FEC is sized for the lossiest client, every client gets the same frames
+    std::map<std::string, uint32_t> client_loss_percents;
+    uint32_t current_loss_percent;
+    void OnPacketLoss(const fp_actor::AudioPacketLoss& msg);
+    void UpdatePacketLoss();
 };
 
 DEFINE_ACTOR_GENERATOR(AudioEncodeActor)
\ No newline at end of file
@@ -16,7 +16,10 @@ void BaseActor::MessageLoop() {
     OnInit(init_msg);
     while (is_running) {
         google::protobuf::Any msg;
-        actor_msg_queue.wait_dequeue(msg);
+        if (!actor_msg_queue.try_dequeue(msg)) {
+            OnMailboxDrained();
+            actor_msg_queue.wait_dequeue(msg);
+        }
         OnMessage(msg);
     }
     OnFinish();
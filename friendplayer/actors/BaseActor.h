@@ -32,6 +32,8 @@ public:
     virtual void OnInit(const std::optional<any_msg>& init_msg) = 0;
     // Called for each message received
     virtual void OnMessage(const any_msg& msg) = 0;
+    // Called when the mailbox runs dry, before blocking for the next message
+    virtual void OnMailboxDrained() {}
     // Core message 
     virtual void MessageLoop();
     // Called after last message is processed and MessageLoop exits
@@ -4,18 +4,47 @@
 
 #include "common/Log.h"
 #include "common/Crypto.h"
+#include "common/Config.h"
 #include "protobuf/actor_messages.pb.h"
 #include "protobuf/network_messages.pb.h"
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace {
+// Tickets are sealed under a process wide key, so one issued by any client actor may turn up at another
+std::mutex used_tickets_m;
+std::map<std::string, std::chrono::system_clock::time_point> used_tickets;
+
+bool TicketUsed(const std::string& ticket_id) {
+    std::lock_guard<std::mutex> lock(used_tickets_m);
+    return used_tickets.count(ticket_id) > 0;
+}
+
+// False if the ticket was already used. Ids are forgotten once their ticket has expired anyway
+bool ConsumeTicket(const std::string& ticket_id, std::chrono::system_clock::time_point expires_at) {
+    std::lock_guard<std::mutex> lock(used_tickets_m);
+    const auto now = std::chrono::system_clock::now();
+    for (auto it = used_tickets.begin(); it != used_tickets.end();) {
+        it = it->second < now ? used_tickets.erase(it) : std::next(it);
+    }
+    return used_tickets.emplace(ticket_id, expires_at).second;
+}
+}
 
 ClientActor::ClientActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
     : ProtocolActor(actor_map, buffer_map, std::move(name)),
       audio_enabled(true),
       keyboard_enabled(false),
       mouse_enabled(false),
-      controller_enabled(false)
+      controller_enabled(false),
+      encrypted_frames(0),
+      encrypt_time_total(std::chrono::steady_clock::duration::zero()),
+      encrypt_time_max(std::chrono::steady_clock::duration::zero()),
+      last_encrypt_report(std::chrono::steady_clock::now())
       //input_streamer()
       { }
 
@@ -35,10 +64,14 @@ void ClientActor::OnInit(const std::optional<any_msg>& init_msg) {
             for (uint32_t i = 0; i < client_init_msg.audio_stream_count(); i++) {
                 audio_streams[i].actor_name = fmt::format(AUDIO_ENCODER_ACTOR_NAME_FORMAT, i);
             }
+            group_keys.mutable_video_keys()->CopyFrom(client_init_msg.video_group_keys());
+            group_keys.mutable_audio_keys()->CopyFrom(client_init_msg.audio_group_keys());
             // base class init
             any_msg base_msg;
             base_msg.PackFrom(client_init_msg.base_init());
             ProtocolActor::OnInit(base_msg);
+            congestion_controller.SetMaxBitrate(static_cast<uint32_t>(Config::AverageBitrate * video_streams.size()
+                + MAX_AUDIO_BITRATE * audio_streams.size()));
 
             fp_actor::AddClientSettings add_client_msg;
             add_client_msg.set_actor_name(GetName());
@@ -66,6 +99,10 @@ void ClientActor::OnMessage(const any_msg& msg) {
             fp_actor::ChangeClientActorState change_msg;
             msg.UnpackTo(&change_msg);
             OnActorState(change_msg);
+        } else if (msg.Is<fp_actor::GroupKeysUpdate>()) {
+            fp_actor::GroupKeysUpdate keys_msg;
+            msg.UnpackTo(&keys_msg);
+            OnGroupKeysUpdate(keys_msg);
         } else {
             ProtocolActor::OnMessage(msg);
         }
@@ -83,10 +120,18 @@ void ClientActor::OnMessage(const any_msg& msg) {
         fp_actor::ChangeClientActorState change_msg;
         msg.UnpackTo(&change_msg);
         OnActorState(change_msg);
+    } else if (msg.Is<fp_actor::GroupKeysUpdate>()) {
+        fp_actor::GroupKeysUpdate keys_msg;
+        msg.UnpackTo(&keys_msg);
+        OnGroupKeysUpdate(keys_msg);
     } else if (msg.Is<fp_actor::ClientKick>()) {
         fp_network::Network dc_msg;
         dc_msg.mutable_state_msg()->mutable_host_state()->set_state(fp_network::HostState::DISCONNECTING);
         SendToSocket(dc_msg);
+        // Removed here rather than waiting on the viewer, which may never answer, so the group keys rotate
+        fp_actor::ClientDisconnected disconnect;
+        disconnect.set_client_name(GetName());
+        SendTo(CLIENT_MANAGER_ACTOR_NAME, disconnect);
     } else {
         ProtocolActor::OnMessage(msg);
     }
@@ -101,6 +146,16 @@ void ClientActor::OnFinish() {
     remove_client_msg.set_actor_name(GetName());
     SendTo(SETTINGS_ACTOR_NAME, remove_client_msg);
 
+    fp_actor::EncoderBitrate bitrate_msg;
+    bitrate_msg.set_client_actor_name(GetName());
+    bitrate_msg.set_remove(true);
+    for (const StreamInfo& stream : video_streams) {
+        SendTo(stream.actor_name, bitrate_msg);
+    }
+    for (const StreamInfo& stream : audio_streams) {
+        SendTo(stream.actor_name, bitrate_msg);
+    }
+
     ProtocolActor::OnFinish();
 }
 
@@ -116,31 +171,61 @@ void ClientActor::OnVideoData(const fp_actor::VideoData& data_msg) {
 
     if ((stream_info.stream_state == StreamState::WAITING_FOR_VIDEO && data_msg.type() == fp_actor::VideoData::PPS_SPS)
         || stream_info.stream_state == StreamState::READY) {
-        std::string* handle_data = buffer_map.GetBuffer(data_msg.handle());
-
-        std::string encrypted_buf;
-        crypto_impl->Encrypt(*handle_data, encrypted_buf);
+        // Fixed for the whole frame, FEC groups and chunk sealing assume every chunk but the last is this size
+        const size_t chunk_size = GetMaxChunkSize();
+        // Chunks are slices of this one buffer, each holding a reference until it's acked or expires
+        uint64_t frame_handle = data_msg.handle();
+        if (data_msg.group_sealed()) {
+            // Sealed once for every client, slice the shared buffer as is
+            buffer_map.Increment(frame_handle);
+        } else {
+            std::string encrypted_buf;
+            const auto encrypt_start = std::chrono::steady_clock::now();
+            if (!EncryptMediaFrame(*buffer_map.GetBuffer(data_msg.handle()), true, stream_num, stream_info.frame_num,
+                    chunk_size, encrypted_buf)) {
+                buffer_map.Decrement(data_msg.handle());
+                return;
+            }
+            RecordEncryptTime(std::chrono::steady_clock::now() - encrypt_start);
+            frame_handle = buffer_map.Wrap(std::make_unique<std::string>(std::move(encrypted_buf)));
+        }
+        const std::string& encrypted = *buffer_map.GetBuffer(frame_handle);
 
         fp_network::Network network_msg;
+        network_msg.mutable_data_msg()->set_needs_ack(true);
+        // FrameRingBuffer reassembles by offset, chunks don't have to wait on earlier losses
+        network_msg.mutable_data_msg()->set_unordered(true);
         network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_num(stream_info.frame_num);
-        network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_size(static_cast<uint32_t>(encrypted_buf.size()));
+        network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_size(static_cast<uint32_t>(encrypted.size()));
         network_msg.mutable_data_msg()->mutable_host_frame()->set_stream_num(stream_num);
         
+        // PPS/SPS is needed to start decoding at all, so it never expires
+        clock::time_point deadline = clock::time_point::max();
         if (data_msg.type() == fp_actor::VideoData::PPS_SPS) {
             network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_frame_type(fp_network::VideoFrame::PPS_SPS);
         } else if (data_msg.type() == fp_actor::VideoData::IDR) {
             network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_frame_type(fp_network::VideoFrame::IDR);
+            deadline = CaptureTime(data_msg.timestamp()) + IDR_LATENCY_BUDGET;
         } else {
             network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_frame_type(fp_network::VideoFrame::NORMAL);
+            deadline = CaptureTime(data_msg.timestamp()) + VIDEO_LATENCY_BUDGET;
         }
 
-        for (size_t chunk_offset = 0; chunk_offset < encrypted_buf.size(); chunk_offset += MAX_DATA_CHUNK) {
-            const size_t chunk_end = std::min(chunk_offset + MAX_DATA_CHUNK, encrypted_buf.size());
-            uint64_t handle = buffer_map.Create(encrypted_buf.data() + chunk_offset, chunk_end - chunk_offset);
+        // Chunks take consecutive sequence numbers from here, parity tells the viewer where its group starts
+        const uint64_t first_sequence_number = send_sequence_number;
+        for (size_t chunk_offset = 0; chunk_offset < encrypted.size(); chunk_offset += chunk_size) {
+            const size_t chunk_end = std::min(chunk_offset + chunk_size, encrypted.size());
+            buffer_map.Increment(frame_handle);
             network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_chunk_offset(static_cast<uint32_t>(chunk_offset));
-            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_data_handle(handle);
-            SendToSocket(network_msg);
+            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_data_handle(frame_handle);
+            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_data_size(static_cast<uint32_t>(chunk_end - chunk_offset));
+            SendToSocket(network_msg, deadline);
+        }
+        if (Config::EnableFEC) {
+            SendVideoParity(network_msg, encrypted, chunk_size, FecGroupSize(congestion_controller.GetLossRate()),
+                first_sequence_number, deadline);
         }
+        buffer_map.Decrement(frame_handle);
         stream_info.frame_num++;
     }
     buffer_map.Decrement(data_msg.handle());
@@ -157,43 +242,202 @@ void ClientActor::OnAudioData(const fp_actor::AudioData& data_msg) {
     StreamInfo& stream_info = audio_streams[stream_num];
 
     if (stream_info.stream_state == StreamState::READY && audio_enabled) {
-        std::string* handle_data = buffer_map.GetBuffer(data_msg.handle());
-
-        std::string encrypted_buf;
-        crypto_impl->Encrypt(*handle_data, encrypted_buf);
+        const size_t chunk_size = GetMaxChunkSize();
+        uint64_t frame_handle = data_msg.handle();
+        if (data_msg.group_sealed()) {
+            buffer_map.Increment(frame_handle);
+        } else {
+            std::string encrypted_buf;
+            if (!EncryptMediaFrame(*buffer_map.GetBuffer(data_msg.handle()), false, stream_num, stream_info.frame_num,
+                    chunk_size, encrypted_buf)) {
+                buffer_map.Decrement(data_msg.handle());
+                return;
+            }
+            frame_handle = buffer_map.Wrap(std::make_unique<std::string>(std::move(encrypted_buf)));
+        }
+        const std::string& encrypted = *buffer_map.GetBuffer(frame_handle);
 
         fp_network::Network network_msg;
+        network_msg.mutable_data_msg()->set_needs_ack(true);
+        // Viewer rebuilds a lost frame from the next one's FEC, so later frames mustn't wait behind it
+        network_msg.mutable_data_msg()->set_unordered(true);
         network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_num(stream_info.frame_num);
-        network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_size(static_cast<uint32_t>(encrypted_buf.size()));
+        network_msg.mutable_data_msg()->mutable_host_frame()->set_frame_size(static_cast<uint32_t>(encrypted.size()));
         network_msg.mutable_data_msg()->mutable_host_frame()->set_stream_num(stream_num);
+        const clock::time_point deadline = CaptureTime(data_msg.timestamp()) + AUDIO_LATENCY_BUDGET;
         
-        for (size_t chunk_offset = 0; chunk_offset < encrypted_buf.size(); chunk_offset += MAX_DATA_CHUNK) {
-            const size_t chunk_end = std::min(chunk_offset + MAX_DATA_CHUNK, encrypted_buf.size());
-            uint64_t handle = buffer_map.Create(encrypted_buf.data() + chunk_offset, chunk_end - chunk_offset);
+        for (size_t chunk_offset = 0; chunk_offset < encrypted.size(); chunk_offset += chunk_size) {
+            const size_t chunk_end = std::min(chunk_offset + chunk_size, encrypted.size());
+            buffer_map.Increment(frame_handle);
             network_msg.mutable_data_msg()->mutable_host_frame()->mutable_audio()->set_chunk_offset(static_cast<uint32_t>(chunk_offset));
-            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_audio()->set_data_handle(handle);
-            SendToSocket(network_msg);
+            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_audio()->set_data_handle(frame_handle);
+            network_msg.mutable_data_msg()->mutable_host_frame()->mutable_audio()->set_data_size(static_cast<uint32_t>(chunk_end - chunk_offset));
+            SendToSocket(network_msg, deadline);
         }
+        buffer_map.Decrement(frame_handle);
         stream_info.frame_num++;
     }
     buffer_map.Decrement(data_msg.handle());
 }
 
+bool ClientActor::EncryptMediaFrame(const std::string& frame, bool is_video, uint32_t stream_num, uint32_t frame_num,
+    size_t chunk_size, std::string& out) {
+    const std::string associated_data = MediaAssociatedData(is_video, stream_num, frame_num);
+    if (!Config::ChunkEncryption) {
+        crypto_impl->Encrypt(frame, out, associated_data);
+        return true;
+    }
+
+    // Every chunk keeps chunk_size on the wire, so slicing and FEC work on the sealed buffer as before
+    if (!crypto_impl->SealChunks(frame, chunk_size, Crypto::ChunkId(is_video, stream_num, frame_num, 0), associated_data, out)) {
+        LOG_WARNING("Dropping {} byte frame, too large to seal by chunk", frame.size());
+        return false;
+    }
+    return true;
+}
+
+void ClientActor::RecordEncryptTime(std::chrono::steady_clock::duration elapsed) {
+    encrypted_frames++;
+    encrypt_time_total += elapsed;
+    encrypt_time_max = std::max(encrypt_time_max, elapsed);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_encrypt_report < ENCRYPT_REPORT_INTERVAL) {
+        return;
+    }
+    const double mean_ms = std::chrono::duration<double, std::milli>(encrypt_time_total).count() / encrypted_frames;
+    const double max_ms = std::chrono::duration<double, std::milli>(encrypt_time_max).count();
+    if (encrypt_time_max > FRAME_INTERVAL) {
+        LOG_WARNING("Client {} video encryption took up to {:.2f} ms, longer than a frame (mean {:.2f} ms over {} frames)",
+            GetName(), max_ms, mean_ms, encrypted_frames);
+    } else {
+        LOG_INFO("Client {} video encryption mean {:.2f} ms, max {:.2f} ms over {} frames",
+            GetName(), mean_ms, max_ms, encrypted_frames);
+    }
+    encrypted_frames = 0;
+    encrypt_time_total = encrypt_time_max = std::chrono::steady_clock::duration::zero();
+    last_encrypt_report = now;
+}
+
+void ClientActor::OnTargetBitrate(uint32_t bitrate) {
+    const uint32_t audio_bitrate = std::clamp(bitrate / 10, MIN_AUDIO_BITRATE, MAX_AUDIO_BITRATE);
+    uint32_t video_bitrate = bitrate;
+    if (audio_enabled) {
+        video_bitrate -= std::min(video_bitrate, audio_bitrate * static_cast<uint32_t>(audio_streams.size()));
+    }
+    if (!video_streams.empty()) {
+        video_bitrate /= static_cast<uint32_t>(video_streams.size());
+    }
+    LOG_INFO("Client {} target bitrate {}, video={} audio={}", GetName(), bitrate, video_bitrate, audio_bitrate);
+
+    fp_actor::EncoderBitrate bitrate_msg;
+    bitrate_msg.set_client_actor_name(GetName());
+    bitrate_msg.set_bitrate(video_bitrate);
+    for (const StreamInfo& stream : video_streams) {
+        SendTo(stream.actor_name, bitrate_msg);
+    }
+    bitrate_msg.set_bitrate(audio_bitrate);
+    for (const StreamInfo& stream : audio_streams) {
+        SendTo(stream.actor_name, bitrate_msg);
+    }
+}
+
+void ClientActor::OnLossPercent(uint32_t loss_percent) {
+    LOG_TRACE("Client {} loss {}%, updating audio FEC", GetName(), loss_percent);
+    fp_actor::AudioPacketLoss loss_msg;
+    loss_msg.set_client_actor_name(GetName());
+    loss_msg.set_loss_percent(loss_percent);
+    for (const StreamInfo& stream : audio_streams) {
+        SendTo(stream.actor_name, loss_msg);
+    }
+}
+
+uint32_t ClientActor::FecGroupSize(double loss_rate) {
+    if (loss_rate < MIN_FEC_LOSS_RATE) {
+        return 0;
+    }
+    // Aim for well under one expected loss per group, XOR parity can only fill a single hole
+    return std::clamp(static_cast<uint32_t>(0.5 / loss_rate), MIN_FEC_GROUP_SIZE, MAX_FEC_GROUP_SIZE);
+}
+
+void ClientActor::SendVideoParity(fp_network::Network& network_msg, const std::string& encrypted_buf, size_t chunk_size,
+        uint32_t group_size, uint64_t first_sequence_number, clock::time_point deadline) {
+    if (group_size == 0) {
+        return;
+    }
+    // Parity is never retransmitted, a lost parity chunk just means falling back to NACKs
+    network_msg.mutable_data_msg()->set_needs_ack(false);
+    network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_fec_group_size(group_size);
+    network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_first_sequence_number(first_sequence_number);
+    // Parity gets its own buffer rather than a slice of the frame
+    network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->clear_data_size();
+
+    const size_t group_bytes = group_size * chunk_size;
+    std::string parity;
+    for (size_t group_offset = 0; group_offset < encrypted_buf.size(); group_offset += group_bytes) {
+        const size_t group_end = std::min(group_offset + group_bytes, encrypted_buf.size());
+        // Lone trailing chunk, parity would just be a copy of it
+        if (group_end - group_offset <= chunk_size) {
+            break;
+        }
+        parity.assign(chunk_size, '\0');
+        for (size_t i = group_offset; i < group_end; i++) {
+            parity[(i - group_offset) % chunk_size] ^= encrypted_buf[i];
+        }
+        uint64_t handle = buffer_map.Create(parity.data(), parity.size());
+        network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_chunk_offset(static_cast<uint32_t>(group_offset));
+        network_msg.mutable_data_msg()->mutable_host_frame()->mutable_video()->set_data_handle(handle);
+        SendToSocket(network_msg, deadline);
+    }
+}
+
+ClientActor::clock::time_point ClientActor::CaptureTime(uint64_t timestamp) {
+    if (timestamp == 0) {
+        return clock::now();
+    }
+    return clock::time_point(clock::duration(timestamp));
+}
+
 void ClientActor::OnActorState(const fp_actor::ChangeClientActorState& msg) {
     keyboard_enabled = msg.keyboard_enabled();
     mouse_enabled = msg.mouse_enabled();
     controller_enabled = msg.controller_enabled();
 }
 
+void ClientActor::OnGroupKeysUpdate(const fp_actor::GroupKeysUpdate& msg) {
+    group_keys.mutable_video_keys()->CopyFrom(msg.video_group_keys());
+    group_keys.mutable_audio_keys()->CopyFrom(msg.audio_group_keys());
+    // Before the handshake the stream info carries them
+    if (protocol_state == HandshakeState::HS_READY) {
+        SendGroupKeys();
+    }
+}
+
 bool ClientActor::OnHandshakeMessage(const fp_network::Handshake& msg) {
     bool handshake_success = false;
     LOG_INFO("Client actor {} received handshake, current state={}", GetName(), protocol_state);
+    if (msg.has_resume_proof()) {
+        // A bad proof mustn't cost an established session anything
+        return FinishResume(msg.resume_proof()) || protocol_state == HandshakeState::HS_READY;
+    }
+    if (protocol_state == HandshakeState::HS_READY && msg.has_phase1() && !msg.phase1().ticket().empty()) {
+        // Client timed us out and came back before our own heartbeat gave up on it, or someone replayed
+        // its phase 1. Either way the session carries on until the proof arrives
+        LOG_INFO("Client actor {} reconnecting with a ticket", GetName());
+        OfferResume(msg.phase1());
+        return true;
+    }
+
     if (protocol_state == HandshakeState::HS_UNINITIALIZED) {
         if (msg.has_phase1() && msg.phase1().magic() == 0x46524E44504C5952ull) {
             LOG_INFO("Client actor {} received first handshake", GetName());
             client_name = msg.phase1().client_name();
+            if (!msg.phase1().ticket().empty() && OfferResume(msg.phase1())) {
+                return true;
+            }
 
-            crypto_impl = std::make_unique<Crypto>(1024);
+            // Group was generated at startup, only this client's key pair is made here
+            crypto_impl = std::make_unique<Crypto>(Crypto::CachedGroup(Crypto::DH_GROUP_BITS));
             
             fp_network::Network send_handshake_msg;
             send_handshake_msg.mutable_hs_msg()->mutable_phase2()->set_p(crypto_impl->P());
@@ -215,15 +459,16 @@ bool ClientActor::OnHandshakeMessage(const fp_network::Handshake& msg) {
             fp_network::Network stream_info_msg;
             stream_info_msg.mutable_info_msg()->set_num_video_streams(static_cast<uint32_t>(video_streams.size()));
             stream_info_msg.mutable_info_msg()->set_num_audio_streams(static_cast<uint32_t>(audio_streams.size()));
+            // Broadcast frames are sealed whole under the group keys, chunk sealing is per client
+            stream_info_msg.mutable_info_msg()->set_chunk_encryption(Config::ChunkEncryption && !Config::BroadcastEncryption);
+            if (group_keys.video_keys_size() > 0 || group_keys.audio_keys_size() > 0) {
+                crypto_impl->Encrypt(group_keys.SerializeAsString(),
+                    *stream_info_msg.mutable_info_msg()->mutable_sealed_group_keys(), GroupKeysAssociatedData());
+            }
             SendToSocket(stream_info_msg);            
             protocol_state = HandshakeState::HS_READY;
             handshake_success = true;
-
-            fp_actor::UpdateClientSetting update_msg;
-            update_msg.set_actor_name(GetName());
-            update_msg.set_client_name(client_name);
-            update_msg.set_finished_handshake(true);
-            SendTo(SETTINGS_ACTOR_NAME, update_msg);
+            OnHandshakeFinished();
         } else {
             LOG_ERROR("Invalid handshake magic in state HS_WAITING_SHAKE_ACK");
         }
@@ -233,6 +478,141 @@ bool ClientActor::OnHandshakeMessage(const fp_network::Handshake& msg) {
     return handshake_success;
 }
 
+bool ClientActor::OfferResume(const fp_network::HSPhase1& hello) {
+    if (pending_resume && pending_resume->client_nonce == hello.resume_nonce()) {
+        // Repeat of the phase 1 already answered, the client may have keyed off our first reply
+        SendResumeOffer();
+        return true;
+    }
+
+    std::string ticket_data;
+    fp_network::ResumptionTicket ticket;
+    if (!Crypto::OpenTicket(hello.ticket(), ticket_data) || !ticket.ParseFromString(ticket_data)) {
+        LOG_INFO("Client actor {} presented an invalid ticket, falling back to a full handshake", GetName());
+        return false;
+    }
+    const clock::time_point issued_at{std::chrono::milliseconds(ticket.issued_at_ms())};
+    if (clock::now() - issued_at > TICKET_LIFETIME) {
+        LOG_INFO("Client actor {} presented an expired ticket, falling back to a full handshake", GetName());
+        return false;
+    }
+    if (ticket.ticket_id().size() != TICKET_ID_SIZE || TicketUsed(ticket.ticket_id())) {
+        LOG_WARNING("Client actor {} presented a ticket that was already used", GetName());
+        return false;
+    }
+    if (hello.resume_nonce().size() != Crypto::RESUME_NONCE_SIZE) {
+        LOG_WARNING("Client actor {} sent a ticket without a valid resume nonce", GetName());
+        return false;
+    }
+
+    pending_resume = PendingResume{std::move(ticket), hello.resume_nonce(), Crypto::RandomBytes(Crypto::RESUME_NONCE_SIZE)};
+    SendResumeOffer();
+    return true;
+}
+
+void ClientActor::SendResumeOffer() {
+    fp_network::Network resume_msg;
+    resume_msg.mutable_hs_msg()->mutable_resume()->set_resume_nonce(pending_resume->host_nonce);
+    SendToSocket(resume_msg);
+}
+
+bool ClientActor::FinishResume(const fp_network::HSResumeProof& proof) {
+    if (!pending_resume) {
+        LOG_WARNING("Client actor {} got a resume proof with no resume offered", GetName());
+        return false;
+    }
+    const PendingResume resume = std::move(*pending_resume);
+    pending_resume.reset();
+    const fp_network::ResumptionTicket& ticket = resume.ticket;
+    if (!Crypto::VerifyResumeProof(ticket.resumption_secret(), resume.client_nonce, resume.host_nonce, proof.proof())) {
+        LOG_WARNING("Client actor {} got a resume proof that doesn't match its ticket", GetName());
+        return false;
+    }
+    const clock::time_point issued_at{std::chrono::milliseconds(ticket.issued_at_ms())};
+    if (!ConsumeTicket(ticket.ticket_id(), issued_at + TICKET_LIFETIME)) {
+        LOG_WARNING("Client actor {} presented a ticket that was already used", GetName());
+        return false;
+    }
+
+    if (protocol_state != HandshakeState::HS_UNINITIALIZED) {
+        // Resumed keys come with sequence and frame numbers starting over
+        ResetTransport();
+        for (auto& video_stream : video_streams) {
+            video_stream.stream_state = StreamState::UNINITIALIZED;
+            video_stream.frame_num = 0;
+        }
+        for (auto& audio_stream : audio_streams) {
+            audio_stream.stream_state = StreamState::UNINITIALIZED;
+            audio_stream.frame_num = 0;
+        }
+    }
+    crypto_impl = Crypto::Resume(ticket.resumption_secret(), resume.client_nonce, resume.host_nonce, true);
+    client_name = ticket.client_name();
+    protocol_state = HandshakeState::HS_READY;
+    // Group keys may have rotated while the client was away
+    SendGroupKeys();
+
+    // The client's decoders kept running with their PPS/SPS, they only need an IDR to pick back up
+    fp_actor::SpecialFrameRequest idr_request;
+    idr_request.set_type(fp_actor::SpecialFrameRequest::IDR);
+    for (uint32_t stream_num : ticket.ready_video_streams()) {
+        if (stream_num >= video_streams.size()) {
+            continue;
+        }
+        video_streams[stream_num].stream_state = StreamState::READY;
+        SendTo(video_streams[stream_num].actor_name, idr_request);
+    }
+    if (ticket.ready_video_streams_size() > 0) {
+        for (auto& audio_stream : audio_streams) {
+            audio_stream.stream_state = StreamState::READY;
+        }
+    }
+
+    LOG_INFO("Client actor {} resumed the session of {}", GetName(), client_name);
+    OnHandshakeFinished();
+    return true;
+}
+
+void ClientActor::OnHandshakeFinished() {
+    fp_actor::UpdateClientSetting update_msg;
+    update_msg.set_actor_name(GetName());
+    update_msg.set_client_name(client_name);
+    update_msg.set_finished_handshake(true);
+    SendTo(SETTINGS_ACTOR_NAME, update_msg);
+
+    SendResumptionTicket();
+    StartMtuDiscovery();
+}
+
+void ClientActor::SendResumptionTicket() {
+    fp_network::ResumptionTicket ticket;
+    ticket.set_resumption_secret(crypto_impl->ResumptionSecret());
+    ticket.set_client_name(client_name);
+    ticket.set_issued_at_ms(std::chrono::duration_cast<std::chrono::milliseconds>(clock::now().time_since_epoch()).count());
+    ticket.set_ticket_id(Crypto::RandomBytes(TICKET_ID_SIZE));
+    for (uint32_t stream_num = 0; stream_num < video_streams.size(); stream_num++) {
+        if (video_streams[stream_num].stream_state == StreamState::READY) {
+            ticket.add_ready_video_streams(stream_num);
+        }
+    }
+
+    fp_network::Network ticket_msg;
+    ticket_msg.mutable_hs_msg()->mutable_ticket()->set_ticket(Crypto::SealTicket(ticket.SerializeAsString()));
+    SendToSocket(ticket_msg);
+}
+
+void ClientActor::SendGroupKeys() {
+    if (group_keys.video_keys_size() == 0 && group_keys.audio_keys_size() == 0) {
+        return;
+    }
+    // Ordered and retransmitted until acked, the viewer can't open anything sealed under the new keys without it
+    fp_network::Network keys_msg;
+    keys_msg.mutable_data_msg()->set_needs_ack(true);
+    crypto_impl->Encrypt(group_keys.SerializeAsString(), *keys_msg.mutable_data_msg()->mutable_sealed_group_keys(),
+        GroupKeysAssociatedData());
+    SendToSocket(keys_msg);
+}
+
 void ClientActor::OnStateMessage(const fp_network::State& msg) {
     switch (msg.State_case()) {
         case fp_network::State::kClientStreamState: {
@@ -261,6 +641,8 @@ void ClientActor::OnStateMessage(const fp_network::State& msg) {
                     for (auto& audio_stream : audio_streams) {
                         audio_stream.stream_state = StreamState::READY;
                     }
+                    // A resumed session should come back with this stream running
+                    SendResumptionTicket();
                     break;
                 }
             }
@@ -288,14 +670,17 @@ void ClientActor::OnStateMessage(const fp_network::State& msg) {
 }
 
 void ClientActor::OnDataMessage(const fp_network::Data& msg) {
-    if (msg.Payload_case() == fp_network::Data::kHostFrame) {
+    if (msg.Payload_case() != fp_network::Data::kClientFrame) {
         LOG_ERROR("Got host frame from host side");
         return;
     }
     auto& c_msg = msg.client_frame();
 
     std::string df_decrypted_serial;
-    crypto_impl->Decrypt(c_msg.encrypted_data_frame(), df_decrypted_serial);
+    if (!crypto_impl->Decrypt(c_msg.encrypted_data_frame(), df_decrypted_serial, ClientFrameAssociatedData(c_msg.frame_id()))) {
+        LOG_WARNING("Dropping client frame {} that failed authentication", c_msg.frame_id());
+        return;
+    }
     fp_network::ClientDataFrameInner df_decrypted;
     df_decrypted.ParseFromArray(df_decrypted_serial.data(), df_decrypted_serial.size());
 
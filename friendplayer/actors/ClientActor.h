@@ -2,14 +2,30 @@
 
 #include "actors/ProtocolActor.h"
 #include "protobuf/actor_messages.pb.h"
+#include "protobuf/network_messages.pb.h"
 
+#include <optional>
 #include <vector>
 
 class ClientActor : public ProtocolActor {
 private:
-    // maximum chunk size over UDP accounding for proto overhead
-    // and AES block encryption
-    static constexpr size_t MAX_DATA_CHUNK = 476;
+    // Chunks still unacked this long after capture are no longer worth retransmitting
+    static constexpr std::chrono::milliseconds VIDEO_LATENCY_BUDGET{250};
+    static constexpr std::chrono::milliseconds IDR_LATENCY_BUDGET{1000};
+    static constexpr std::chrono::milliseconds AUDIO_LATENCY_BUDGET{100};
+    // Per stream audio share of the congestion controller's target
+    static constexpr uint32_t MIN_AUDIO_BITRATE = 24000;
+    static constexpr uint32_t MAX_AUDIO_BITRATE = 64000;
+    // FEC is skipped below this loss rate, above it one parity chunk is sent per group
+    static constexpr double MIN_FEC_LOSS_RATE = 0.01;
+    static constexpr uint32_t MIN_FEC_GROUP_SIZE = 4;
+    static constexpr uint32_t MAX_FEC_GROUP_SIZE = 32;
+    // Encoder runs at 60 fps, encryption slower than this holds up the next frame
+    static constexpr std::chrono::microseconds FRAME_INTERVAL{1000000 / 60};
+    static constexpr std::chrono::seconds ENCRYPT_REPORT_INTERVAL{10};
+    // Resumption only has to cover a connection blip
+    static constexpr std::chrono::minutes TICKET_LIFETIME{10};
+    static constexpr size_t TICKET_ID_SIZE = 16;
 public:
     ClientActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name);
 
@@ -25,6 +41,17 @@ private:
     bool mouse_enabled;
     bool controller_enabled;
     std::string client_name;
+    // Ticket accepted and answered, waiting on the client's proof that it holds the ticket's secret.
+    // Nothing about the current session changes until that proof checks out
+    struct PendingResume {
+        fp_network::ResumptionTicket ticket;
+        std::string client_nonce;
+        std::string host_nonce;
+    };
+    std::optional<PendingResume> pending_resume;
+    // Broadcast mode only, sent to the client under its session key with the stream info and again
+    // whenever they rotate
+    fp_network::GroupKeys group_keys;
 
     enum StreamState : uint32_t {
         UNINITIALIZED = 0,
@@ -43,15 +70,46 @@ private:
 
     uint32_t sequence_number;
 
+    // Per frame video encryption latency since the last report
+    uint32_t encrypted_frames;
+    std::chrono::steady_clock::duration encrypt_time_total;
+    std::chrono::steady_clock::duration encrypt_time_max;
+    std::chrono::steady_clock::time_point last_encrypt_report;
+
     // Internal messages
     void OnVideoData(const fp_actor::VideoData& msg);
     void OnAudioData(const fp_actor::AudioData& msg);
     void OnActorState(const fp_actor::ChangeClientActorState& msg);
+    void OnGroupKeysUpdate(const fp_actor::GroupKeysUpdate& msg);
+
+    static clock::time_point CaptureTime(uint64_t timestamp);
+    // Whole frame sealed once, or with chunk encryption each chunk_size slice of out sealed on its own.
+    // False if the frame is too large for chunk nonces
+    bool EncryptMediaFrame(const std::string& frame, bool is_video, uint32_t stream_num, uint32_t frame_num,
+        size_t chunk_size, std::string& out);
+    void RecordEncryptTime(std::chrono::steady_clock::duration elapsed);
+    // Data chunks per parity chunk for the measured loss rate, 0 to disable FEC
+    static uint32_t FecGroupSize(double loss_rate);
+    void SendVideoParity(fp_network::Network& network_msg, const std::string& encrypted_buf, size_t chunk_size,
+        uint32_t group_size, uint64_t first_sequence_number, clock::time_point deadline);
 
     // Network messages
     bool OnHandshakeMessage(const fp_network::Handshake& msg) override;
+    // Answers a valid ticket with our resume nonce, false if the ticket can't be used
+    bool OfferResume(const fp_network::HSPhase1& hello);
+    // Restores keys and stream state from the offered ticket instead of a DH exchange, once the proof checks out
+    bool FinishResume(const fp_network::HSResumeProof& proof);
+    void SendResumeOffer();
+    void OnHandshakeFinished();
+    // Sealed snapshot of the session, reissued whenever a stream starts so a resumed session restores it
+    void SendResumptionTicket();
+    // Current group keys to a viewer already past the stream info, after a rotation or a resume
+    void SendGroupKeys();
     void OnDataMessage(const fp_network::Data& msg) override;
     void OnStateMessage(const fp_network::State& msg) override;
+    void OnTargetBitrate(uint32_t bitrate) override;
+    // Sizes the audio encoders' in-band FEC
+    void OnLossPercent(uint32_t loss_percent) override;
 
     void OnHostRequest(const fp_network::RequestToHost& msg);
     void OnKeyboardFrame(const fp_network::KeyboardFrame& msg);
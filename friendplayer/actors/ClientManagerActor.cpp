@@ -1,6 +1,9 @@
 #include "actors/ClientManagerActor.h"
 
 #include "actors/CommonActorNames.h"
+#include "actors/ProtocolActor.h"
+#include "common/Config.h"
+#include "common/Crypto.h"
 #include "common/Log.h"
 
 #include <asio/ip/udp.hpp>
@@ -21,10 +24,14 @@ void SafeReleaseHandle(DataBufferMap& buffer_map, const fp_network::Network& net
 }
 }
 
+ClientManagerActor::ClientManagerActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
+    : Actor(actor_map, buffer_map, std::move(name)), request_id_counter(0) { }
+
 ClientManagerActor::~ClientManagerActor() {}
 
 void ClientManagerActor::OnInit(const std::optional<any_msg>& init_msg) {
     Actor::OnInit(init_msg);
+    socket_names = { SOCKET_ACTOR_NAME };
     if (init_msg) {
         if (init_msg->Is<fp_actor::HostClientManagerInit>()) {
             is_host = true;
@@ -95,6 +102,11 @@ void ClientManagerActor::OnMessage(const any_msg& msg) {
     } else if (msg.Is<fp_actor::VideoData>()) {
         fp_actor::VideoData video_data_msg;
         msg.UnpackTo(&video_data_msg);
+        if (video_data_msg.stream_num() < video_group_crypto.size() && !address_to_client.empty()) {
+            video_data_msg.set_handle(SealForGroup(*video_group_crypto[video_data_msg.stream_num()],
+                video_data_msg.handle(), true, video_data_msg.stream_num()));
+            video_data_msg.set_group_sealed(true);
+        }
         for (auto&& [address, client_name] : address_to_client) {
             buffer_map.Increment(video_data_msg.handle());
             SendTo(client_name, video_data_msg);
@@ -103,6 +115,11 @@ void ClientManagerActor::OnMessage(const any_msg& msg) {
     } else if (msg.Is<fp_actor::AudioData>()) {
         fp_actor::AudioData audio_data_msg;
         msg.UnpackTo(&audio_data_msg);
+        if (audio_data_msg.stream_num() < audio_group_crypto.size() && !address_to_client.empty()) {
+            audio_data_msg.set_handle(SealForGroup(*audio_group_crypto[audio_data_msg.stream_num()],
+                audio_data_msg.handle(), false, audio_data_msg.stream_num()));
+            audio_data_msg.set_group_sealed(true);
+        }
         for (auto&& [address, client_name] : address_to_client) {
             buffer_map.Increment(audio_data_msg.handle());
             SendTo(client_name, audio_data_msg);
@@ -112,6 +129,13 @@ void ClientManagerActor::OnMessage(const any_msg& msg) {
         fp_actor::ClientDisconnected dc_msg;
         msg.UnpackTo(&dc_msg);
 
+        if (!is_host && dc_msg.timed_out()) {
+            // HostActor resumes with its ticket if it has one, and reports back here if it can't
+            fp_actor::ResumeSession resume_msg;
+            SendTo(dc_msg.client_name(), resume_msg);
+            return;
+        }
+
         // Clean up the client in the HB actor
         fp_actor::ClientActorHeartbeatState hb_dc;
         hb_dc.set_disconnected(true);
@@ -121,23 +145,30 @@ void ClientManagerActor::OnMessage(const any_msg& msg) {
         
         // Clean up the client for us
         if (is_host) {
+            bool removed = false;
             dc_confirm_msg.mutable_msg()->mutable_state_msg()->mutable_host_state()->set_state(fp_network::HostState::DISCONNECTING);
             for (auto it = address_to_client.begin(); it != address_to_client.end(); it++) {
                 if (it->second == dc_msg.client_name()) {
                     dc_confirm_msg.set_address(it->first);
-                    SendTo(SOCKET_ACTOR_NAME, dc_confirm_msg);
+                    SendTo(SocketFor(it->first), dc_confirm_msg);
                     
+                    PublishRoute(it->first, it->second, true);
                     fp_actor::Kill kill_msg;
                     SendTo(it->second, kill_msg);
                     saved_messages.erase(it->first);
                     address_to_client.erase(it);
+                    removed = true;
                     break;
                 }
             }
+            // A viewer that was kicked or left still holds the group keys
+            if (removed && Config::BroadcastEncryption) {
+                RotateGroupKeys();
+            }
         } else {
             dc_confirm_msg.mutable_msg()->mutable_state_msg()->mutable_client_state()->set_state(fp_network::ClientState::DISCONNECTING);
             dc_confirm_msg.set_address(address_to_client.begin()->first);
-            SendTo(SOCKET_ACTOR_NAME, dc_confirm_msg);
+            SendTo(SocketFor(address_to_client.begin()->first), dc_confirm_msg);
             
             fp_actor::Kill kill_msg;
             EnqueueMessage(kill_msg);
@@ -157,7 +188,7 @@ void ClientManagerActor::OnFinish() {
         } else {
             dc_msg.mutable_msg()->mutable_state_msg()->mutable_client_state()->set_state(fp_network::ClientState::DISCONNECTING);
         }
-        SendTo(SOCKET_ACTOR_NAME, dc_msg);
+        SendTo(SocketFor(addr), dc_msg);
     }
     
     fp_actor::Shutdown session_shutdown;
@@ -174,16 +205,89 @@ void ClientManagerActor::CreateClient(uint64_t address) {
     fp_actor::ClientProtocolInit protocol_init_msg;
     protocol_init_msg.set_video_stream_count(video_stream_count);
     protocol_init_msg.set_audio_stream_count(audio_stream_count);
+    for (const std::string& key : video_group_keys) {
+        protocol_init_msg.add_video_group_keys(key);
+    }
+    for (const std::string& key : audio_group_keys) {
+        protocol_init_msg.add_audio_group_keys(key);
+    }
     protocol_init_msg.mutable_base_init()->set_address(address);
+    protocol_init_msg.mutable_base_init()->set_socket_name(SocketFor(address));
     *create_msg.mutable_init_msg() = google::protobuf::Any();
     create_msg.mutable_init_msg()->PackFrom(protocol_init_msg);
     create_req_to_address[create_msg.actor_name()] = address;
     SendTo(ADMIN_ACTOR_NAME, create_msg);
 }
 
+void ClientManagerActor::PublishRoute(uint64_t address, const std::string& client_name, bool remove) {
+    fp_actor::SocketRoute route_msg;
+    route_msg.set_address(address);
+    route_msg.set_actor_name(client_name);
+    route_msg.set_remove(remove);
+    // The kernel's reuseport hash picks which shard receives an address, so every shard needs the route
+    for (const std::string& socket_name : socket_names) {
+        SendTo(socket_name, route_msg);
+    }
+}
+
+const std::string& ClientManagerActor::SocketFor(uint64_t address) const {
+    if (socket_names.size() == 1) {
+        return socket_names.front();
+    }
+    // Fibonacci hash so neighbouring ports and IPs spread across shards
+    const uint64_t hash = address * 0x9E3779B97F4A7C15ull;
+    return socket_names[(hash >> 32) % socket_names.size()];
+}
+
+uint64_t ClientManagerActor::SealForGroup(Crypto& group_crypto, uint64_t handle, bool is_video, uint32_t stream_num) {
+    auto sealed = std::make_unique<std::string>();
+    group_crypto.Encrypt(*buffer_map.GetBuffer(handle), *sealed, ProtocolActor::GroupMediaAssociatedData(is_video, stream_num));
+    buffer_map.Decrement(handle);
+    return buffer_map.Wrap(std::move(sealed));
+}
+
+void ClientManagerActor::RotateGroupKeys() {
+    video_group_keys.clear();
+    audio_group_keys.clear();
+    video_group_crypto.clear();
+    audio_group_crypto.clear();
+    for (uint32_t i = 0; i < video_stream_count; i++) {
+        video_group_keys.push_back(Crypto::RandomBytes(Crypto::GROUP_KEY_SIZE));
+        video_group_crypto.push_back(Crypto::FromGroupKey(video_group_keys.back(), true));
+    }
+    for (uint32_t i = 0; i < audio_stream_count; i++) {
+        audio_group_keys.push_back(Crypto::RandomBytes(Crypto::GROUP_KEY_SIZE));
+        audio_group_crypto.push_back(Crypto::FromGroupKey(audio_group_keys.back(), true));
+    }
+    // Queued ahead of any frame sealed under the new keys
+    for (auto&& [address, client_name] : address_to_client) {
+        SendGroupKeys(client_name);
+    }
+}
+
+void ClientManagerActor::SendGroupKeys(const std::string& client_name) {
+    fp_actor::GroupKeysUpdate keys_msg;
+    for (const std::string& key : video_group_keys) {
+        keys_msg.add_video_group_keys(key);
+    }
+    for (const std::string& key : audio_group_keys) {
+        keys_msg.add_audio_group_keys(key);
+    }
+    SendTo(client_name, keys_msg);
+}
+
 void ClientManagerActor::HostInit(const fp_actor::HostClientManagerInit& msg) {
     video_stream_count = msg.monitor_indices_size();
     audio_stream_count = msg.num_audio_streams();
+    for (uint32_t i = 1; i < msg.socket_shards(); i++) {
+        socket_names.emplace_back(fmt::format(SOCKET_SHARD_ACTOR_NAME_FORMAT, i));
+    }
+    if (Config::BroadcastEncryption) {
+        if (Config::ChunkEncryption) {
+            LOG_WARNING("Chunk encryption is per client, broadcast mode seals whole frames instead");
+        }
+        RotateGroupKeys();
+    }
     fp_actor::Create encoder_create_msg;
     encoder_create_msg.set_response_actor(GetName());
     encoder_create_msg.set_actor_type_name("VideoEncodeActor");
@@ -213,17 +317,32 @@ void ClientManagerActor::OnEncoderCreated(const std::string& encoder_name, bool
 }
 
 void ClientManagerActor::OnClientCreated(const std::string& client_name, bool succeeded) {
-    uint64_t client_address = create_req_to_address[client_name];
+    // HostActor's address was mapped when it was requested, only ClientActors wait on a create request
+    auto req_it = create_req_to_address.find(client_name);
+    if (req_it != create_req_to_address.end()) {
+        const uint64_t client_address = req_it->second;
+        if (succeeded) {
+            if (Config::BroadcastEncryption) {
+                // Keys may have rotated since its init message was built
+                SendGroupKeys(client_name);
+            }
+            while (!saved_messages[client_address].empty()) {
+                auto& saved_message = saved_messages[client_address].front();
+                SendTo(client_name, std::move(saved_message));
+                saved_messages[client_address].pop();
+            }
+            address_to_client[client_address] = client_name;
+        }
+        saved_messages.erase(client_address);
+        create_req_to_address.erase(req_it);
+    }
     if (succeeded) {
-        while (!saved_messages[client_address].empty()) {
-            auto& saved_message = saved_messages[client_address].front();
-            SendTo(client_name, std::move(saved_message));
-            saved_messages[client_address].pop();
+        for (auto&& [address, name] : address_to_client) {
+            if (name == client_name) {
+                PublishRoute(address, name, false);
+            }
         }
-        address_to_client[client_address] = client_name;
     }
-    saved_messages.erase(client_address);
-    create_req_to_address.erase(client_name);
 
     fp_actor::ClientActorHeartbeatState heartbeat_state;
     heartbeat_state.set_client_actor_name(client_name);
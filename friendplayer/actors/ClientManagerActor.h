@@ -3,16 +3,19 @@
 #include "actors/Actor.h"
 
 #include <map>
+#include <memory>
 #include <queue>
 #include <set>
+#include <vector>
 
 #include "protobuf/network_messages.pb.h"
 #include "protobuf/actor_messages.pb.h"
 
+class Crypto;
+
 class ClientManagerActor : public Actor {
 public:
-    ClientManagerActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
-        : Actor(actor_map, buffer_map, std::move(name)), request_id_counter(0) { }
+    ClientManagerActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name);
 
     virtual ~ClientManagerActor();
 
@@ -26,10 +29,27 @@ private:
     void HostInit(const fp_actor::HostClientManagerInit& msg);
     void OnEncoderCreated(const std::string& name, bool succeeded);
     void OnClientCreated(const std::string& name, bool succeeded);
+    // Lets the socket deliver straight to the protocol actor once it exists
+    void PublishRoute(uint64_t address, const std::string& client_name, bool remove);
+    // Socket shard that sends for an address, pinned by hashing the address
+    const std::string& SocketFor(uint64_t address) const;
+    // Seals the frame in handle under the stream's group key, releasing handle and returning the sealed copy
+    uint64_t SealForGroup(Crypto& group_crypto, uint64_t handle, bool is_video, uint32_t stream_num);
+    // Fresh group keys for every stream, sent to each client for its viewer. Frames sealed after this
+    // are unreadable to anyone who only held the old keys
+    void RotateGroupKeys();
+    void SendGroupKeys(const std::string& client_name);
 
     std::map<uint64_t, std::string> address_to_client;
     std::map<uint64_t, std::queue<fp_network::Network>> saved_messages;
     std::map<std::string, uint64_t> create_req_to_address;
+    std::vector<std::string> socket_names;
+
+    // Broadcast mode only, every frame is sealed here once per stream and each client sends the same buffer
+    std::vector<std::string> video_group_keys;
+    std::vector<std::string> audio_group_keys;
+    std::vector<std::unique_ptr<Crypto>> video_group_crypto;
+    std::vector<std::unique_ptr<Crypto>> audio_group_crypto;
 
     uint32_t request_id_counter;
     
@@ -1,6 +1,7 @@
 #pragma once
 
 constexpr const char SOCKET_ACTOR_NAME[] = "socket";
+constexpr const char SOCKET_SHARD_ACTOR_NAME_FORMAT[] = "socket{}";
 constexpr const char CLIENT_MANAGER_ACTOR_NAME[] = "client_manager";
 constexpr const char ADMIN_ACTOR_NAME[] = "admin";
 constexpr const char HOST_ACTOR_NAME[] = "host";
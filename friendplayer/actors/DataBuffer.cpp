@@ -1,5 +1,7 @@
 #include "actors/DataBuffer.h"
 
+#include <algorithm>
+
 bool DataBufferMap::Increment(uint64_t handle) {
     std::lock_guard<std::mutex> lock(buffer_list_m);
     if (handle >= buffers.size()) {
@@ -24,7 +26,11 @@ void DataBufferMap::Decrement(uint64_t handle) {
     int old_refcount = buffers[handle].ref_count->fetch_sub(1);
     if (old_refcount <= 1) {
         if (old_refcount == 1) {
-            buffers[handle].inner_data.reset(nullptr);
+            if (buffers[handle].pooled && buffer_pool.size() < MAX_POOLED_BUFFERS) {
+                buffer_pool.emplace_back(std::move(buffers[handle].inner_data));
+            } else {
+                buffers[handle].inner_data.reset(nullptr);
+            }
             free_list.emplace_back(handle);
         } else {
             buffers[handle].ref_count->fetch_add(1);
@@ -54,6 +60,41 @@ uint64_t DataBufferMap::Wrap(std::string* data) {
 }
 
 uint64_t DataBufferMap::Wrap(std::unique_ptr<std::string> data) {
+    return Insert(std::move(data), false);
+}
+
+uint64_t DataBufferMap::CreatePooled(const void* data, size_t size) {
+    std::unique_ptr<std::string> new_elem = TakePooled(size);
+    new_elem->assign(static_cast<const char*>(data), size);
+    return Insert(std::move(new_elem), true);
+}
+
+uint64_t DataBufferMap::CreatePooled(size_t size) {
+    std::unique_ptr<std::string> new_elem = TakePooled(size);
+    // Receive buffers come back at full size, so this rarely has anything to fill
+    if (new_elem->size() < size) {
+        new_elem->resize(size);
+    }
+    return Insert(std::move(new_elem), true);
+}
+
+std::unique_ptr<std::string> DataBufferMap::TakePooled(size_t capacity) {
+    std::unique_ptr<std::string> new_elem;
+    {
+        std::lock_guard<std::mutex> lock(buffer_list_m);
+        if (!buffer_pool.empty()) {
+            new_elem = std::move(buffer_pool.back());
+            buffer_pool.pop_back();
+        }
+    }
+    if (!new_elem) {
+        new_elem = std::make_unique<std::string>();
+        new_elem->reserve(std::max(capacity, POOLED_BUFFER_CAPACITY));
+    }
+    return new_elem;
+}
+
+uint64_t DataBufferMap::Insert(std::unique_ptr<std::string> data, bool pooled) {
     uint64_t new_handle;
     std::lock_guard<std::mutex> lock(buffer_list_m);
     if (!free_list.empty()) {
@@ -67,5 +108,6 @@ uint64_t DataBufferMap::Wrap(std::unique_ptr<std::string> data) {
         new_handle = buffers.size();
         buffers.emplace_back(std::move(data));
     }
+    buffers[new_handle].pooled = pooled;
     return new_handle;
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
+#include <string>
 #include <vector>
 
 struct DataBuffer {
@@ -11,9 +14,16 @@ struct DataBuffer {
       : inner_data(nullptr), ref_count(std::make_unique<std::atomic_int>(0)) {}
     std::unique_ptr<std::string> inner_data;
     std::unique_ptr<std::atomic_int> ref_count;
+    // Returned to the pool instead of freed once the last reference is dropped
+    bool pooled = false;
 };
 
 class DataBufferMap {
+private:
+    // Enough for a full datagram payload
+    static constexpr size_t POOLED_BUFFER_CAPACITY = 1500;
+    static constexpr size_t MAX_POOLED_BUFFERS = 1024;
+
 public:
     // Returns false if failed to acquire
     bool Increment(uint64_t handle);
@@ -28,9 +38,18 @@ public:
     uint64_t Wrap(std::string* data);
     // Creates handle & wraps ptr with default deleter, transfer ownership!
     uint64_t Wrap(std::unique_ptr<std::string> data);
+    // Creates handle & copies data into a recycled buffer, for small buffers made at packet rate
+    uint64_t CreatePooled(const void* data, size_t size);
+    // Creates handle to a recycled buffer at least size bytes long, for the caller to fill in place
+    uint64_t CreatePooled(size_t size);
 
 private:
+    std::unique_ptr<std::string> TakePooled(size_t capacity);
+    uint64_t Insert(std::unique_ptr<std::string> data, bool pooled);
+
+
     std::mutex buffer_list_m;
     std::vector<DataBuffer> buffers;
     std::vector<uint64_t> free_list;
+    std::vector<std::unique_ptr<std::string>> buffer_pool;
 };
\ No newline at end of file
@@ -41,6 +41,7 @@ void HeartbeatActor::OnTimerFire() {
         if (it->second + timeout_ms < fire_time) {
             fp_actor::ClientDisconnected timeout_msg;
             timeout_msg.set_client_name(it->first);
+            timeout_msg.set_timed_out(true);
             SendTo(CLIENT_MANAGER_ACTOR_NAME, timeout_msg);
             LOG_INFO("Client {} timed out", it->first);
             heartbeat_map.erase(it);
@@ -6,9 +6,12 @@
 #include "actors/CommonActorNames.h"
 #include "common/Crypto.h"
 #include "common/Log.h"
+#include "common/WireFormat.h"
+
+#include <algorithm>
 
 HostActor::HostActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
-    : ProtocolActor(actor_map, buffer_map, std::move(name)), presenter(nullptr) {
+    : ProtocolActor(actor_map, buffer_map, std::move(name)), chunk_encryption(false), resume_attempts(0), presenter(nullptr) {
     input_streamer = std::make_unique<InputStreamer>();
 }
 
@@ -25,14 +28,15 @@ void HostActor::OnInit(const std::optional<any_msg>& init_msg) {
             base_msg.PackFrom(host_init_msg.base_init());
             ProtocolActor::OnInit(base_msg);
 
-            fp_network::Network send_handshake_msg;
-            send_handshake_msg.mutable_hs_msg()->mutable_phase1()->set_magic(0x46524E44504C5952ull);
+            hello.set_magic(0x46524E44504C5952ull);
             if (host_init_msg.has_token()) {
-                send_handshake_msg.mutable_hs_msg()->mutable_phase1()->set_token(host_init_msg.token());
+                hello.set_token(host_init_msg.token());
             }
             if (host_init_msg.has_client_identity()) {
-                send_handshake_msg.mutable_hs_msg()->mutable_phase1()->set_client_name(host_init_msg.client_identity());
+                hello.set_client_name(host_init_msg.client_identity());
             }
+            fp_network::Network send_handshake_msg;
+            *send_handshake_msg.mutable_hs_msg()->mutable_phase1() = hello;
             SendToSocket(send_handshake_msg);
         } else {
             LOG_CRITICAL("HostActor being initialized with unhandled init_msg type {}!", init_msg->type_url());
@@ -71,11 +75,49 @@ void HostActor::OnMessage(const any_msg& msg) {
             ready_msg.mutable_state_msg()->mutable_client_stream_state()->set_stream_num(stream_num);
             SendToSocket(ready_msg);
         }
+    } else if (msg.Is<fp_actor::ResumeSession>()) {
+        ResumeSession();
     } else {
         ProtocolActor::OnMessage(msg);
     }
 }
 
+void HostActor::ResumeSession() {
+    if (resumption_ticket.empty() || resume_attempts >= MAX_RESUME_ATTEMPTS) {
+        LOG_INFO("Host timed out with no session left to resume");
+        fp_actor::ClientDisconnected dc_msg;
+        dc_msg.set_client_name(GetName());
+        SendTo(CLIENT_MANAGER_ACTOR_NAME, dc_msg);
+        return;
+    }
+    resume_attempts++;
+    LOG_INFO("Host timed out, resuming session (attempt {} of {})", resume_attempts, MAX_RESUME_ATTEMPTS);
+
+    // Resumed keys come with sequence and frame numbers starting over, nothing in flight is usable
+    ResetTransport();
+    for (auto& video_stream : video_streams) {
+        video_stream->Reset();
+    }
+    for (auto& audio_stream : audio_streams) {
+        audio_stream->Reset();
+    }
+    std::fill(next_audio_frame.begin(), next_audio_frame.end(), 0);
+
+    resume_nonce = Crypto::RandomBytes(Crypto::RESUME_NONCE_SIZE);
+    fp_network::Network resume_msg;
+    *resume_msg.mutable_hs_msg()->mutable_phase1() = hello;
+    resume_msg.mutable_hs_msg()->mutable_phase1()->set_ticket(resumption_ticket);
+    resume_msg.mutable_hs_msg()->mutable_phase1()->set_resume_nonce(resume_nonce);
+    SendToSocket(resume_msg);
+    protocol_state = HandshakeState::HS_WAITING_SHAKE_ACK;
+
+    // Heartbeat stopped tracking us when it timed out
+    fp_actor::ClientActorHeartbeatState heartbeat_state;
+    heartbeat_state.set_client_actor_name(GetName());
+    heartbeat_state.set_disconnected(false);
+    SendTo(HEARTBEAT_ACTOR_NAME, heartbeat_state);
+}
+
 bool HostActor::OnHandshakeMessage(const fp_network::Handshake& msg) {
     bool handshake_success = false;
     if (protocol_state == HandshakeState::HS_UNINITIALIZED) {
@@ -92,9 +134,33 @@ bool HostActor::OnHandshakeMessage(const fp_network::Handshake& msg) {
             send_handshake_msg.mutable_hs_msg()->mutable_phase3()->set_pubkey(crypto_impl->GetPublicKey());
             SendToSocket(send_handshake_msg);
             handshake_success = true;
+            resume_attempts = 0;
+            resume_nonce.clear();
+        } else if (msg.has_resume() && !resume_nonce.empty()) {
+            // Host keeps its old session until it sees we hold the ticket's secret
+            fp_network::Network proof_msg;
+            proof_msg.mutable_hs_msg()->mutable_resume_proof()->set_proof(
+                Crypto::ResumeProof(resumption_secret, resume_nonce, msg.resume().resume_nonce()));
+            SendToSocket(proof_msg);
+            crypto_impl = Crypto::Resume(resumption_secret, resume_nonce, msg.resume().resume_nonce(), false);
+            protocol_state = HandshakeState::HS_READY;
+            LOG_INFO("Session resumed after {} attempts", resume_attempts);
+            handshake_success = true;
+            resume_attempts = 0;
+            resume_nonce.clear();
+        } else if (msg.has_ticket()) {
+            // Issued by the session being replaced, a fresh one follows the new keys
+            handshake_success = true;
         } else {
             LOG_ERROR("Invalid handshake phase2 in state HS_WAITING_SHAKE_ACK");
         }
+    } else if (msg.has_ticket()) {
+        resumption_ticket = msg.ticket().ticket();
+        resumption_secret = crypto_impl->ResumptionSecret();
+        handshake_success = true;
+    } else if (msg.has_resume()) {
+        // Duplicate of the reply that already resumed us
+        handshake_success = true;
     } else {
         LOG_WARNING("Got handshake message after finishing handshake");
     }
@@ -122,6 +188,10 @@ void HostActor::OnDataMessage(const fp_network::Data& msg) {
         LOG_ERROR("Got client frame from client side");
         return;
     }
+    if (msg.Payload_case() == fp_network::Data::kSealedGroupKeys) {
+        SetGroupKeys(msg.sealed_group_keys(), true);
+        return;
+    }
     auto& h_msg = msg.host_frame();
     switch(h_msg.DataFrame_case()) {
         case fp_network::HostDataFrame::kVideo: {
@@ -136,34 +206,49 @@ void HostActor::OnDataMessage(const fp_network::Data& msg) {
 }
 
 void HostActor::OnVideoFrame(const fp_network::HostDataFrame& msg) {
-    fp_network::HostDataFrame frame;
     uint64_t handle = msg.video().data_handle();
-    frame.CopyFrom(msg);
-    frame.mutable_video()->clear_DataBacking();
-    frame.mutable_video()->set_allocated_data(buffer_map.GetBuffer(handle));
-    // COPIES DATA!!
-    if (video_streams[msg.stream_num()]->AddFrameChunk(frame)) {
+    const std::string* data = buffer_map.GetBuffer(handle);
+    // Chunk is read straight out of the socket's buffer into the frame
+    if (data != nullptr && video_streams[msg.stream_num()]->AddFrameChunk(msg, WireFormat::ReceivedPayload(msg, *data))) {
         SendVideoFrameToDecoder(msg.stream_num());
     }
-    frame.mutable_video()->release_data();
     buffer_map.Decrement(handle);
 }
 
 void HostActor::OnAudioFrame(const fp_network::HostDataFrame& msg) {
-    fp_network::HostDataFrame frame;
     uint64_t handle = msg.audio().data_handle();
-    frame.CopyFrom(msg);
-    frame.mutable_audio()->clear_DataBacking();
-    frame.mutable_audio()->set_allocated_data(buffer_map.GetBuffer(handle));
-    // COPIES DATA!!
-    if (audio_streams[msg.stream_num()]->AddFrameChunk(frame)) {
-        SendAudioFrameToDecoder(msg.stream_num());
-    }
-    frame.mutable_audio()->release_data();
+    const std::string* data = buffer_map.GetBuffer(handle);
+    if (data != nullptr) {
+        audio_streams[msg.stream_num()]->AddFrameChunk(msg, WireFormat::ReceivedPayload(msg, *data));
+        DrainAudioFrames(msg.stream_num());
+    }
     buffer_map.Decrement(handle);
 }
 
+void HostActor::DrainAudioFrames(uint32_t stream_num) {
+    FrameRingBuffer& audio_stream = *audio_streams[stream_num];
+    while (std::optional<uint32_t> complete_frame = audio_stream.NextCompleteFrame()) {
+        while (audio_stream.FrontFrameNumber() < *complete_frame) {
+            audio_stream.DropFront();
+        }
+        SendAudioFrameToDecoder(stream_num);
+    }
+}
+
 void HostActor::OnStreamInfoMessage(const fp_network::StreamInfo& msg) {
+    SetGroupKeys(msg.sealed_group_keys(), false);
+    if (!video_streams.empty() || !audio_streams.empty()) {
+        // Host turned down our ticket and did a full handshake, the decoders are still running
+        // but the new session needs to be asked for PPS/SPS again
+        for (uint32_t i = 0; i < video_streams.size(); ++i) {
+            fp_network::Network ready_msg;
+            ready_msg.mutable_state_msg()->mutable_client_stream_state()->set_state(fp_network::ClientStreamState::READY_FOR_PPS_SPS_IDR);
+            ready_msg.mutable_state_msg()->mutable_client_stream_state()->set_stream_num(i);
+            SendToSocket(ready_msg);
+        }
+        return;
+    }
+    chunk_encryption = msg.chunk_encryption();
     for (uint32_t i = 0; i < msg.num_audio_streams(); ++i) {
         std::string actor_name = fmt::format(AUDIO_DECODER_ACTOR_NAME_FORMAT, i);
         audio_stream_num_to_name[i] = actor_name;
@@ -178,7 +263,11 @@ void HostActor::OnStreamInfoMessage(const fp_network::StreamInfo& msg) {
         create_msg.mutable_init_msg()->PackFrom(audio_init);
         SendTo(ADMIN_ACTOR_NAME, create_msg);
         audio_streams.push_back(std::move(std::make_unique<FrameRingBuffer>(fmt::format("AudioBuffer{}", i), AUDIO_FRAME_BUFFER, AUDIO_FRAME_SIZE)));
+        if (chunk_encryption) {
+            audio_streams.back()->SetChunkOpener(MakeChunkOpener(false, i));
+        }
     }
+    next_audio_frame.resize(audio_streams.size(), 0);
     presenter = std::make_unique<FramePresenterGL>(this, msg.num_video_streams());
     for (uint32_t i = 0; i < msg.num_video_streams(); ++i) {
         std::string actor_name = fmt::format(VIDEO_DECODER_ACTOR_NAME_FORMAT, i);
@@ -194,15 +283,23 @@ void HostActor::OnStreamInfoMessage(const fp_network::StreamInfo& msg) {
         create_msg.mutable_init_msg()->PackFrom(video_init);
         SendTo(ADMIN_ACTOR_NAME, create_msg);
         video_streams.push_back(std::move(std::make_unique<FrameRingBuffer>(fmt::format("VideoBuffer{}", i), VIDEO_FRAME_BUFFER, VIDEO_FRAME_SIZE)));
+        if (chunk_encryption) {
+            video_streams.back()->SetChunkOpener(MakeChunkOpener(true, i));
+        }
     }
     controller_capture_thread = std::make_unique<std::thread>(&HostActor::ControllerCaptureThread, this, 16);
 }
 
 void HostActor::SendVideoFrameToDecoder(uint32_t stream_num) {
     std::string* video_frame = new std::string();
+    const uint32_t frame_num = video_streams[stream_num]->FrontFrameNumber();
     bool needs_idr = video_streams[stream_num]->GetFront(*video_frame);
-    if (video_frame->size() > 0) {
-        crypto_impl->DecryptInPlace(*video_frame);
+    // Incomplete or corrupted frames fail here instead of reaching the decoder.
+    // Sealed chunks were verified as they landed, only those that opened are in the frame
+    const bool authentic = video_frame->size() > 0 && OpenMediaFrame(true, stream_num, frame_num, *video_frame);
+    if (!authentic && stream_num < video_group_streams.size() && !video_group_streams[stream_num].idr_requested) {
+        video_group_streams[stream_num].idr_requested = true;
+        needs_idr = true;
     }
     
     if (needs_idr) {
@@ -211,6 +308,11 @@ void HostActor::SendVideoFrameToDecoder(uint32_t stream_num) {
         EncryptAndSendDataFrame(idr_req_msg);
         LOG_INFO("Requesting IDR from host");
     }
+    if (!authentic) {
+        LOG_TRACE("Dropping video frame {} of stream {} that failed authentication", frame_num, stream_num);
+        delete video_frame;
+        return;
+    }
     fp_actor::VideoData video_data;
     video_data.set_handle(buffer_map.Wrap(video_frame));
     video_data.set_stream_num(stream_num);
@@ -219,21 +321,114 @@ void HostActor::SendVideoFrameToDecoder(uint32_t stream_num) {
 
 void HostActor::SendAudioFrameToDecoder(uint32_t stream_num) {
     std::string* audio_frame = new std::string();
+    const uint32_t frame_num = audio_streams[stream_num]->FrontFrameNumber();
     bool corrupt_frame = audio_streams[stream_num]->GetFront(*audio_frame);
 
-    if (audio_frame->size() > 0 && !corrupt_frame) {
-        crypto_impl->DecryptInPlace(*audio_frame);
-    } else {
+    if (audio_frame->size() == 0 || corrupt_frame || !OpenMediaFrame(false, stream_num, frame_num, *audio_frame)) {
         delete audio_frame;
         return;
     }
 
+    // A long gap is a restart rather than a loss, nothing left in the decoder would make rebuilding it sound right
+    const uint32_t frames_lost = frame_num - next_audio_frame[stream_num];
+    next_audio_frame[stream_num] = frame_num + 1;
+
     fp_actor::AudioData audio_data;
     audio_data.set_handle(buffer_map.Wrap(audio_frame));
     audio_data.set_stream_num(stream_num);
+    if (frames_lost > 0 && frames_lost <= MAX_CONCEALED_FRAMES) {
+        LOG_TRACE("Audio stream {} lost {} frames before {}, concealing", stream_num, frames_lost, frame_num);
+        audio_data.set_frames_lost(frames_lost);
+    }
     SendTo(audio_stream_num_to_name[stream_num], audio_data);
 }
 
+FrameRingBuffer::ChunkOpener HostActor::MakeChunkOpener(bool is_video, uint32_t stream_num) {
+    return [this, is_video, stream_num](uint32_t frame_num, uint32_t chunk_offset, char* chunk, uint32_t size) -> std::optional<uint32_t> {
+        if (!crypto_impl->OpenChunk(chunk, size, Crypto::ChunkId(is_video, stream_num, frame_num, chunk_offset),
+                MediaAssociatedData(is_video, stream_num, frame_num))) {
+            return std::nullopt;
+        }
+        return size - static_cast<uint32_t>(Crypto::TAG_SIZE);
+    };
+}
+
+void HostActor::SetGroupKeys(const std::string& sealed_group_keys, bool rotation) {
+    if (!rotation) {
+        video_group_streams.clear();
+        audio_group_streams.clear();
+        if (sealed_group_keys.empty()) {
+            return;
+        }
+    }
+
+    std::string group_keys_serial;
+    fp_network::GroupKeys group_keys;
+    if (!crypto_impl->Decrypt(sealed_group_keys, group_keys_serial, GroupKeysAssociatedData())
+        || !group_keys.ParseFromString(group_keys_serial)) {
+        LOG_ERROR("Host's group keys failed authentication, broadcast frames will be dropped");
+        return;
+    }
+    auto install = [](std::vector<GroupStream>& group_streams, const google::protobuf::RepeatedPtrField<std::string>& keys) {
+        group_streams.resize(keys.size());
+        for (int i = 0; i < keys.size(); i++) {
+            GroupStream& group_stream = group_streams[i];
+            // Resumed sessions are sent the keys again whether or not they rotated
+            if (group_stream.current.key == keys[i]) {
+                continue;
+            }
+            if (group_stream.current.crypto) {
+                group_stream.previous = std::move(group_stream.current);
+            }
+            group_stream.current = GroupKey{keys[i], Crypto::FromGroupKey(keys[i], false), 0};
+            group_stream.idr_requested = false;
+        }
+    };
+    install(video_group_streams, group_keys.video_keys());
+    install(audio_group_streams, group_keys.audio_keys());
+    if (rotation) {
+        LOG_INFO("Host rotated its group keys");
+    } else {
+        LOG_INFO("Host is broadcasting, {} video and {} audio group keys", video_group_streams.size(), audio_group_streams.size());
+    }
+}
+
+bool HostActor::OpenGroupFrame(GroupKey& key, bool is_video, uint32_t stream_num, std::string& frame) {
+    const uint64_t sequence = Crypto::SealedSequence(frame);
+    if (!key.crypto || sequence < key.sequence
+        || !key.crypto->DecryptInPlace(frame, GroupMediaAssociatedData(is_video, stream_num))) {
+        return false;
+    }
+    key.sequence = sequence + 1;
+    return true;
+}
+
+bool HostActor::OpenMediaFrame(bool is_video, uint32_t stream_num, uint32_t frame_num, std::string& frame) {
+    if (chunk_encryption) {
+        return true;
+    }
+    auto& group_streams = is_video ? video_group_streams : audio_group_streams;
+    if (group_streams.empty()) {
+        return crypto_impl->DecryptInPlace(frame, MediaAssociatedData(is_video, stream_num, frame_num));
+    }
+
+    if (stream_num >= group_streams.size() || frame.size() < Crypto::OVERHEAD) {
+        return false;
+    }
+    GroupStream& group_stream = group_streams[stream_num];
+    if (!group_stream.previous.crypto) {
+        return OpenGroupFrame(group_stream.current, is_video, stream_num, frame);
+    }
+    // Just after a rotation, a failed attempt garbles the frame so the other key gets a copy
+    const std::string sealed = frame;
+    if (OpenGroupFrame(group_stream.current, is_video, stream_num, frame)) {
+        group_stream.previous = GroupKey{};
+        return true;
+    }
+    frame = sealed;
+    return OpenGroupFrame(group_stream.previous, is_video, stream_num, frame);
+}
+
 double HostActor::GetFPS(bool is_video, int stream_num) {
     if (is_video) {
         return video_streams[stream_num]->GetFPS();
@@ -258,12 +453,13 @@ void HostActor::MuteState(bool state) {
 }
 
 void HostActor::EncryptAndSendDataFrame(const fp_network::ClientDataFrameInner& cdf) {
+    const uint32_t frame_id = frame_id_counter++;
     std::string* encrypted_pkt = new std::string();
-    crypto_impl->Encrypt(cdf.SerializeAsString(), *encrypted_pkt);
+    crypto_impl->Encrypt(cdf.SerializeAsString(), *encrypted_pkt, ClientFrameAssociatedData(frame_id));
 
     fp_network::Network net_msg;
-    net_msg.mutable_data_msg()->set_needs_ack(false);
-    net_msg.mutable_data_msg()->mutable_client_frame()->set_frame_id(frame_id_counter++);
+    net_msg.mutable_data_msg()->set_needs_ack(true);
+    net_msg.mutable_data_msg()->mutable_client_frame()->set_frame_id(frame_id);
     net_msg.mutable_data_msg()->mutable_client_frame()->set_allocated_encrypted_data_frame(encrypted_pkt);
     SendToSocket(net_msg);
 }
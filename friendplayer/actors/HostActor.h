@@ -18,6 +18,10 @@ private:
     // Guess values, tune or scale these?
     static constexpr size_t VIDEO_FRAME_SIZE = 20000;
     static constexpr size_t AUDIO_FRAME_SIZE = 1795;
+    // Longest audio gap handed to the decoder to rebuild, past that it just starts over at the next frame
+    static constexpr uint32_t MAX_CONCEALED_FRAMES = AUDIO_FRAME_BUFFER;
+    // Heartbeat timeouts in a row answered with the ticket before giving up on the host
+    static constexpr uint32_t MAX_RESUME_ATTEMPTS = 3;
 
 public:
     HostActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name);
@@ -40,16 +44,60 @@ public:
 private:
     void SendVideoFrameToDecoder(uint32_t stream_num);
     void SendAudioFrameToDecoder(uint32_t stream_num);
+    // Audio arrives unordered, so every complete frame is played as soon as it's in and
+    // whatever is missing before it is left to the decoder's FEC and concealment
+    void DrainAudioFrames(uint32_t stream_num);
 
     void EncryptAndSendDataFrame(const fp_network::ClientDataFrameInner& cdf);
+    // Presents the host's ticket after a heartbeat timeout, keeping decoders and rings alive
+    void ResumeSession();
+    FrameRingBuffer::ChunkOpener MakeChunkOpener(bool is_video, uint32_t stream_num);
+    // Replaces the broadcast contexts with the host's current keys, none if it isn't broadcasting.
+    // On rotation the old keys are kept for frames sealed before it that are still on the way
+    void SetGroupKeys(const std::string& sealed_group_keys, bool rotation);
+    // Decrypts a whole frame in place under the session or group key, true if chunks were already opened
+    bool OpenMediaFrame(bool is_video, uint32_t stream_num, uint32_t frame_num, std::string& frame);
 
     std::vector<std::unique_ptr<FrameRingBuffer>> video_streams;
     std::vector<std::unique_ptr<FrameRingBuffer>> audio_streams;
+    // Number of the audio frame each decoder should see next, anything skipped before it was lost
+    std::vector<uint32_t> next_audio_frame;
 
     std::map<uint32_t, std::string> audio_stream_num_to_name;
     std::map<uint32_t, std::string> video_stream_num_to_name;
     std::map<std::string, uint32_t> name_to_stream_num;
     uint32_t frame_id_counter;
+    // Host seals media chunk by chunk, the rings hand back plaintext already
+    bool chunk_encryption;
+    struct GroupKey {
+        std::string key;
+        std::unique_ptr<Crypto> crypto;
+        // Lowest group sequence still accepted. Other viewers hold the key too, so anything older is a replay
+        uint64_t sequence = 0;
+    };
+    struct GroupStream {
+        GroupKey current;
+        // Key from before the host's last rotation, dropped once a frame opens under the current one.
+        // Frames reach OpenMediaFrame in order, so nothing sealed under it can follow that
+        GroupKey previous;
+        // Frames the host sealed under the new key before it got here can't be opened, one IDR
+        // per key gets the decoder past them
+        bool idr_requested = false;
+    };
+    // Broadcast mode, the host seals each stream's frames once under a key shared by every viewer
+    std::vector<GroupStream> video_group_streams;
+    std::vector<GroupStream> audio_group_streams;
+    // Opens frame under key, leaves frame garbled if that fails
+    static bool OpenGroupFrame(GroupKey& key, bool is_video, uint32_t stream_num, std::string& frame);
+
+    // Phase 1 as first sent, presented again with the ticket to resume
+    fp_network::HSPhase1 hello;
+    // Latest ticket from the host and the secret of the session it resumes
+    std::string resumption_ticket;
+    std::string resumption_secret;
+    // Our half of the resumed keys, set while a resume is in flight
+    std::string resume_nonce;
+    uint32_t resume_attempts;
 
     bool OnHandshakeMessage(const fp_network::Handshake& msg) override;
     void OnDataMessage(const fp_network::Data& msg) override;
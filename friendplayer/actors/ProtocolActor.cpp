@@ -7,13 +7,34 @@
 #include "protobuf/network_messages.pb.h"
 #include "protobuf/actor_messages.pb.h"
 
+#include <algorithm>
+#include <cmath>
+
 ProtocolActor::ProtocolActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
     : TimerActor(actor_map, buffer_map, std::move(name)),
+      RTT_milliseconds(0),
       highest_acked_seqnum(0),
-      send_sequence_number(0) {}
+      protocol_state(HandshakeState::HS_UNINITIALIZED),
+      send_sequence_number(0),
+      next_deadline(clock::time_point::max()),
+      abandoned_seqnum_end(0),
+      receive_window_start(0),
+      forward_seqnum(0),
+      congestion_controller(DEFAULT_MAX_BITRATE),
+      published_loss_percent(0),
+      pacer(static_cast<uint32_t>(DEFAULT_MAX_BITRATE * PACING_MULTIPLIER)),
+      datagram_size(static_cast<uint32_t>(WireFormat::MIN_DATAGRAM_SIZE)),
+      mtu_discovery_enabled(false),
+      mtu_probe_rounds(0),
+      blackhole_retransmits(0) {}
 
 ProtocolActor::~ProtocolActor() {
-
+    // Queued messages still own a ref that the socket would have released
+    for (auto& message : pacer.TakeAll()) {
+        if (message.msg.Payload_case() == fp_network::Network::kDataMsg) {
+            TryDecrementHandle(message.msg.data_msg());
+        }
+    }
 }
 
 void ProtocolActor::OnInit(const std::optional<any_msg>& init_msg) {
@@ -23,6 +44,7 @@ void ProtocolActor::OnInit(const std::optional<any_msg>& init_msg) {
             fp_actor::ProtocolInit msg;
             init_msg->UnpackTo(&msg);
             address = msg.address();
+            socket_name = msg.socket_name().empty() ? SOCKET_ACTOR_NAME : msg.socket_name();
         }
     }
 }
@@ -33,6 +55,10 @@ void ProtocolActor::OnMessage(const any_msg& msg) {
         heartbeat_msg.mutable_hb_msg()->set_is_response(false);
         heartbeat_msg.mutable_hb_msg()->set_timestamp(clock::now().time_since_epoch().count());
         SendToSocket(heartbeat_msg);
+        // Earlier probes may have been lost to something other than size
+        if (mtu_discovery_enabled && mtu_probe_rounds < MAX_MTU_PROBE_ROUNDS && datagram_size < MTU_PROBE_SIZES.front()) {
+            SendMtuProbes();
+        }
     } else if (msg.Is<fp_network::Network>()) {
         fp_network::Network net_msg;
         msg.UnpackTo(&net_msg);
@@ -47,19 +73,77 @@ void ProtocolActor::OnMessage(const any_msg& msg) {
 }
 
 void ProtocolActor::SendToSocket(fp_network::Network& msg, bool is_retransmit) {
-    fp_actor::NetworkSend send_msg;
-    send_msg.set_address(address);
+    if (is_retransmit) {
+        PaceToSocket(msg, clock::time_point::max());
+    } else {
+        SendToSocket(msg, clock::time_point::max());
+    }
+}
 
+void ProtocolActor::SendToSocket(fp_network::Network& msg, clock::time_point deadline) {
     // Data messages can be acked so we must handle that here
-    if (!is_retransmit && msg.Payload_case() == fp_network::Network::kDataMsg) {
+    if (msg.Payload_case() == fp_network::Network::kDataMsg && msg.data_msg().needs_ack()) {
+        DropExpiredMessages();
         msg.mutable_data_msg()->set_sequence_number(send_sequence_number);
         // Saved acked messages which use shared buffers must addref
         TryIncrementHandle(msg.data_msg());
-        unacked_messages.emplace_back(msg.data_msg());
+        const size_t size = DataMessageSize(msg.data_msg());
+        unacked_messages.push_back(UnackedMessage{msg.data_msg(), deadline, clock::now(), size, false});
+        next_deadline = std::min(next_deadline, deadline);
         send_sequence_number++;
+        congestion_controller.OnPacketSent(size);
+        UpdateCongestionControl();
+    }
+    PaceToSocket(msg, deadline);
+}
+
+void ProtocolActor::OnTimerFire() {
+    if (protocol_state == HandshakeState::HS_READY && clock::now() >= nack_tracker.NextNack()) {
+        // Nothing new arrived to trigger these, the retransmits or the NACKs themselves were lost
+        SendNacks();
+    }
+    DrainPacer();
+}
+
+void ProtocolActor::PaceToSocket(const fp_network::Network& msg, clock::time_point deadline) {
+    pacer.Enqueue(Pacer::PacedMessage{msg, NetworkMessageSize(msg), deadline});
+    DrainPacer();
+}
+
+void ProtocolActor::DrainPacer() {
+    const auto now = clock::now();
+    while (auto message = pacer.Dequeue(now)) {
+        if (message->deadline <= now) {
+            // Expired while waiting for budget, the socket will never release its ref
+            if (message->msg.Payload_case() == fp_network::Network::kDataMsg) {
+                TryDecrementHandle(message->msg.data_msg());
+            }
+            continue;
+        }
+        ForwardToSocket(message->msg);
+    }
+    ArmTimer(now);
+}
+
+void ProtocolActor::ArmTimer(clock::time_point now) {
+    clock::time_point due = nack_tracker.NextNack();
+    if (!pacer.Empty()) {
+        due = std::min(due, now + pacer.TimeUntilNext(now));
+    }
+    if (due == clock::time_point::max() || (IsTimerActive() && timer_due <= due)) {
+        return;
     }
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - now);
+    // WinMM timers can't go below 1ms
+    SetTimerInternal(static_cast<uint32_t>(std::max<int64_t>(wait.count(), 1)), false);
+    timer_due = due;
+}
+
+void ProtocolActor::ForwardToSocket(const fp_network::Network& msg) {
+    fp_actor::NetworkSend send_msg;
+    send_msg.set_address(address);
     send_msg.mutable_msg()->CopyFrom(msg);
-    SendTo(SOCKET_ACTOR_NAME, send_msg);
+    SendTo(socket_name, send_msg);
 }
 
 void ProtocolActor::OnNetworkMessage(const fp_network::Network& msg) {
@@ -107,30 +191,58 @@ void ProtocolActor::OnNetworkMessage(const fp_network::Network& msg) {
     }
     case fp_network::Network::kDataMsg: {
         if (protocol_state == HandshakeState::HS_READY) {
+            // Unacked data is unsequenced, so hand it up as soon as it arrives
+            if (!msg.data_msg().needs_ack()) {
+                OnParity(msg.data_msg());
+                OnDataMessage(msg.data_msg());
+                SendNacks();
+                break;
+            }
             fp_network::Network ack_msg;
             uint64_t msg_seqnum = msg.data_msg().sequence_number();
             ack_msg.mutable_ack_msg()->set_sequence_ack(msg_seqnum);
             SendToSocket(ack_msg);
+            nack_tracker.OnSequenced(msg.data_msg(), clock::now(), RetransmitInterval());
 
-            if (msg.data_msg().sequence_number() >= receive_window_start) {
+            if (msg.data_msg().sequence_number() >= receive_window_start && msg.data_msg().unordered()) {
+                // The window only has to know this sequence number arrived, payload goes up now
+                fp_network::Data placeholder;
+                placeholder.set_sequence_number(msg_seqnum);
+                recv_window.push(placeholder);
+                OnDataMessage(msg.data_msg());
+            } else if (msg.data_msg().sequence_number() >= receive_window_start) {
                 recv_window.push(msg.data_msg());
+            } else {
+                TryDecrementHandle(msg.data_msg());
             }
-            const auto process_queue = [this] () {
-                while (!recv_window.empty() && recv_window.top().sequence_number() == receive_window_start) {
-                    OnDataMessage(recv_window.top());
-                    recv_window.pop();
-                    receive_window_start++;
-                }
-            };
-            process_queue();
+            ProcessReceiveWindow();
             while (receive_window_start + RECEIVE_FFWD_WINDOW < msg_seqnum) {
                 if (recv_window.empty()) {
                     receive_window_start = msg_seqnum - RECEIVE_FFWD_WINDOW;
                 } else {
                     receive_window_start = std::min(msg_seqnum - RECEIVE_FFWD_WINDOW, recv_window.top().sequence_number());
                 }
-                process_queue();
+                ProcessReceiveWindow();
             }
+            SendNacks();
+        }
+        break;
+    }
+    case fp_network::Network::kFwdMsg: {
+        if (protocol_state == HandshakeState::HS_READY) {
+            OnForward(msg.fwd_msg());
+        }
+        break;
+    }
+    case fp_network::Network::kNackMsg: {
+        if (protocol_state == HandshakeState::HS_READY) {
+            OnNack(msg.nack_msg());
+        }
+        break;
+    }
+    case fp_network::Network::kMtuMsg: {
+        if (protocol_state == HandshakeState::HS_READY) {
+            OnMtuProbe(msg.mtu_msg());
         }
         break;
     }
@@ -151,24 +263,359 @@ void ProtocolActor::OnAcknowledge(const fp_network::Ack& msg) {
     // Erase the acked message
     const uint64_t acked_num = msg.sequence_ack();
     for (auto it = unacked_messages.begin(); it != unacked_messages.end(); it++) {
-        if (it->sequence_number() == acked_num) {
-            TryDecrementHandle(*it);
+        if (it->msg.sequence_number() == acked_num) {
+            std::optional<clock::duration> rtt_sample;
+            if (!it->retransmitted) {
+                rtt_sample = clock::now() - it->last_sent;
+            }
+            if (it->size > WireFormat::MIN_DATAGRAM_SIZE) {
+                blackhole_retransmits = 0;
+            }
+            congestion_controller.OnPacketAcked(it->size, rtt_sample);
+            TryDecrementHandle(it->msg);
             unacked_messages.erase(it);
             break;
         }
     }
 
     highest_acked_seqnum = std::max(highest_acked_seqnum, acked_num);
-    
-    while (!unacked_messages.empty() &&
-            unacked_messages.front().sequence_number() + FAST_RETRANSMIT_WINDOW < highest_acked_seqnum) {
-        fp_network::Network net_msg;
-        *net_msg.mutable_data_msg() = std::move(unacked_messages.front());
-        unacked_messages.pop_front();
-        LOG_INFO("Retransmitting sequence num {}", net_msg.data_msg().sequence_number());
-        // socket decrements for us
-        SendToSocket(net_msg, true);
+    DropExpiredMessages();
+
+    const auto retransmit_before = clock::now() - RetransmitInterval();
+    for (auto it = unacked_messages.begin(); it != unacked_messages.end() &&
+            it->msg.sequence_number() + FAST_RETRANSMIT_WINDOW < highest_acked_seqnum; it++) {
+        // Skip anything a NACK or earlier ack already retransmitted within the last round trip
+        if (it->last_sent <= retransmit_before) {
+            Retransmit(*it);
+        }
+    }
+    UpdateCongestionControl();
+}
+
+void ProtocolActor::OnNack(const fp_network::Nack& msg) {
+    DropExpiredMessages();
+
+    std::vector<uint64_t> nacked_seqnums(msg.sequence_numbers().begin(), msg.sequence_numbers().end());
+    std::sort(nacked_seqnums.begin(), nacked_seqnums.end());
+
+    bool nacked_abandoned = false;
+    auto it = unacked_messages.begin();
+    for (uint64_t seqnum : nacked_seqnums) {
+        while (it != unacked_messages.end() && it->msg.sequence_number() < seqnum) {
+            it++;
+        }
+        if (it != unacked_messages.end() && it->msg.sequence_number() == seqnum) {
+            Retransmit(*it);
+        } else {
+            nacked_abandoned = true;
+        }
+    }
+    // Receiver is waiting on something we gave up on, the original forward may have been lost
+    if (nacked_abandoned) {
+        SendForward();
+    }
+    UpdateCongestionControl();
+}
+
+void ProtocolActor::Retransmit(UnackedMessage& unacked) {
+    fp_network::Network net_msg;
+    *net_msg.mutable_data_msg() = unacked.msg;
+    LOG_INFO("Retransmitting sequence num {}", net_msg.data_msg().sequence_number());
+    // Message stays saved until acked, socket decrements the ref for this send
+    TryIncrementHandle(unacked.msg);
+    unacked.last_sent = clock::now();
+    unacked.retransmitted = true;
+    // Every retransmit is answering a loss, either NACKed or skipped over by later acks
+    congestion_controller.OnPacketsLost(1);
+    congestion_controller.OnPacketSent(unacked.size);
+    PaceToSocket(net_msg, unacked.deadline);
+
+    if (unacked.size > WireFormat::MIN_DATAGRAM_SIZE && datagram_size > WireFormat::MIN_DATAGRAM_SIZE
+        && ++blackhole_retransmits >= BLACKHOLE_RETRANSMITS) {
+        // Probes got through but large datagrams no longer do, the path changed under us
+        LOG_WARNING("Client {} large datagrams appear black-holed, falling back to {} bytes", GetName(), WireFormat::MIN_DATAGRAM_SIZE);
+        datagram_size = static_cast<uint32_t>(WireFormat::MIN_DATAGRAM_SIZE);
+        mtu_discovery_enabled = false;
+    }
+}
+
+void ProtocolActor::ResetTransport() {
+    for (auto& message : pacer.TakeAll()) {
+        if (message.msg.Payload_case() == fp_network::Network::kDataMsg) {
+            TryDecrementHandle(message.msg.data_msg());
+        }
+    }
+    for (const UnackedMessage& unacked : unacked_messages) {
+        TryDecrementHandle(unacked.msg);
+    }
+    unacked_messages.clear();
+    while (!recv_window.empty()) {
+        TryDecrementHandle(recv_window.top());
+        recv_window.pop();
+    }
+    nack_tracker.Reset();
+
+    send_sequence_number = 0;
+    highest_acked_seqnum = 0;
+    next_deadline = clock::time_point::max();
+    abandoned_seqnum_end = 0;
+    receive_window_start = 0;
+    forward_seqnum = 0;
+    forward_outstanding.clear();
+    // The path may have changed with the connection, so the MTU is found again
+    datagram_size = static_cast<uint32_t>(WireFormat::MIN_DATAGRAM_SIZE);
+    mtu_discovery_enabled = false;
+    mtu_probe_rounds = 0;
+    blackhole_retransmits = 0;
+}
+
+void ProtocolActor::StartMtuDiscovery() {
+    mtu_discovery_enabled = true;
+    mtu_probe_rounds = 0;
+    SendMtuProbes();
+}
+
+void ProtocolActor::SendMtuProbes() {
+    mtu_probe_rounds++;
+    for (uint32_t probe_size : MTU_PROBE_SIZES) {
+        if (probe_size <= datagram_size) {
+            break;
+        }
+        fp_network::Network probe_msg;
+        probe_msg.mutable_mtu_msg()->set_probe_size(probe_size);
+        // Padding length changes the size of its own length prefix, so settle it in a couple passes
+        size_t padding_size = 0;
+        for (int pass = 0; pass < 3 && probe_msg.ByteSizeLong() != probe_size; pass++) {
+            padding_size = padding_size + probe_size - probe_msg.ByteSizeLong();
+            probe_msg.mutable_mtu_msg()->mutable_padding()->assign(padding_size, '\0');
+        }
+        SendToSocket(probe_msg);
+    }
+}
+
+void ProtocolActor::OnMtuProbe(const fp_network::MtuProbe& msg) {
+    if (!msg.is_response()) {
+        fp_network::Network response_msg;
+        response_msg.mutable_mtu_msg()->set_probe_size(msg.probe_size());
+        response_msg.mutable_mtu_msg()->set_is_response(true);
+        SendToSocket(response_msg);
+        return;
+    }
+    if (!mtu_discovery_enabled || msg.probe_size() <= datagram_size || msg.probe_size() > WireFormat::MAX_DATAGRAM_SIZE) {
+        return;
+    }
+    LOG_INFO("Client {} path MTU confirmed for {} byte datagrams", GetName(), msg.probe_size());
+    datagram_size = msg.probe_size();
+    blackhole_retransmits = 0;
+}
+
+ProtocolActor::clock::duration ProtocolActor::RetransmitInterval() const {
+    return std::chrono::milliseconds(std::max(RTT_milliseconds + RTT_milliseconds / 2, MIN_RETRANSMIT_INTERVAL_MS));
+}
+
+std::string ProtocolActor::MediaAssociatedData(bool is_video, uint32_t stream_num, uint32_t frame_num) {
+    std::string associated_data(9, '\0');
+    associated_data[0] = is_video ? 'V' : 'A';
+    for (int i = 0; i < 4; i++) {
+        associated_data[1 + i] = static_cast<char>(stream_num >> (8 * i));
+        associated_data[5 + i] = static_cast<char>(frame_num >> (8 * i));
+    }
+    return associated_data;
+}
+
+std::string ProtocolActor::GroupMediaAssociatedData(bool is_video, uint32_t stream_num) {
+    std::string associated_data(6, '\0');
+    associated_data[0] = 'G';
+    associated_data[1] = is_video ? 'V' : 'A';
+    for (int i = 0; i < 4; i++) {
+        associated_data[2 + i] = static_cast<char>(stream_num >> (8 * i));
+    }
+    return associated_data;
+}
+
+std::string ProtocolActor::ClientFrameAssociatedData(uint32_t frame_id) {
+    std::string associated_data(5, '\0');
+    associated_data[0] = 'C';
+    for (int i = 0; i < 4; i++) {
+        associated_data[1 + i] = static_cast<char>(frame_id >> (8 * i));
+    }
+    return associated_data;
+}
+
+std::string ProtocolActor::GroupKeysAssociatedData() {
+    return std::string(1, 'K');
+}
+
+size_t ProtocolActor::DataMessageSize(const fp_network::Data& msg) {
+    size_t size = msg.ByteSizeLong();
+    if (msg.Payload_case() == fp_network::Data::kHostFrame) {
+        const std::string* buffer = nullptr;
+        if (msg.host_frame().DataFrame_case() == fp_network::HostDataFrame::kVideo) {
+            buffer = buffer_map.GetBuffer(msg.host_frame().video().data_handle());
+        } else if (msg.host_frame().DataFrame_case() == fp_network::HostDataFrame::kAudio) {
+            buffer = buffer_map.GetBuffer(msg.host_frame().audio().data_handle());
+        }
+        if (buffer) {
+            size += WireFormat::PayloadSlice(msg.host_frame(), *buffer).size();
+        }
+    }
+    return size;
+}
+
+size_t ProtocolActor::NetworkMessageSize(const fp_network::Network& msg) {
+    if (msg.Payload_case() == fp_network::Network::kDataMsg) {
+        return DataMessageSize(msg.data_msg());
+    }
+    return msg.ByteSizeLong();
+}
+
+void ProtocolActor::UpdateCongestionControl() {
+    if (congestion_controller.Update(clock::now())) {
+        pacer.SetRate(static_cast<uint32_t>(congestion_controller.GetTargetBitrate() * PACING_MULTIPLIER));
+        OnTargetBitrate(congestion_controller.GetTargetBitrate());
+    }
+    const uint32_t loss_percent = std::min(static_cast<uint32_t>(std::lround(congestion_controller.GetLossRate() * 100)), 100u);
+    if (loss_percent != published_loss_percent) {
+        published_loss_percent = loss_percent;
+        OnLossPercent(loss_percent);
+    }
+}
+
+void ProtocolActor::OnForward(const fp_network::Forward& msg) {
+    // Older than the forward already applied, reordered on the way
+    if (msg.sequence_number() <= receive_window_start || msg.sequence_number() < forward_seqnum) {
+        return;
+    }
+    nack_tracker.OnForward(msg);
+    forward_seqnum = msg.sequence_number();
+    forward_outstanding.clear();
+    for (uint64_t seqnum : msg.outstanding()) {
+        if (seqnum >= receive_window_start && seqnum < forward_seqnum) {
+            forward_outstanding.insert(seqnum);
+        }
+    }
+    // Deliver what did arrive below the forward point, the gaps were abandoned by the sender
+    ProcessReceiveWindow();
+    SendNacks();
+}
+
+void ProtocolActor::ProcessReceiveWindow() {
+    while (true) {
+        if (!recv_window.empty() && recv_window.top().sequence_number() <= receive_window_start) {
+            if (recv_window.top().sequence_number() == receive_window_start) {
+                DeliverFromWindow(recv_window.top());
+                receive_window_start++;
+            } else {
+                // Duplicate of a message that was already processed
+                TryDecrementHandle(recv_window.top());
+            }
+            recv_window.pop();
+            continue;
+        }
+        if (receive_window_start >= forward_seqnum) {
+            break;
+        }
+        // Abandoned by the sender, skip up to whatever comes next: a message that arrived,
+        // one still outstanding, or the forward point
+        auto outstanding = forward_outstanding.lower_bound(receive_window_start);
+        if (outstanding != forward_outstanding.end() && *outstanding == receive_window_start) {
+            break;
+        }
+        uint64_t skip_to = forward_seqnum;
+        if (outstanding != forward_outstanding.end()) {
+            skip_to = std::min(skip_to, *outstanding);
+        }
+        if (!recv_window.empty()) {
+            skip_to = std::min(skip_to, recv_window.top().sequence_number());
+        }
+        receive_window_start = skip_to;
+    }
+}
+
+void ProtocolActor::DeliverFromWindow(const fp_network::Data& msg) {
+    // Unordered messages leave an empty placeholder behind, they were delivered on arrival
+    if (msg.Payload_case() != fp_network::Data::PAYLOAD_NOT_SET) {
+        OnDataMessage(msg);
+    }
+}
+
+void ProtocolActor::OnParity(const fp_network::Data& msg) {
+    if (!msg.has_host_frame() || !msg.host_frame().has_video() || msg.host_frame().video().fec_group_size() == 0) {
+        return;
+    }
+    const fp_network::HostDataFrame& frame = msg.host_frame();
+    size_t chunk_size = frame.video().data().size();
+    if (frame.video().DataBacking_case() == fp_network::VideoFrame::kDataHandle) {
+        const std::string* buffer = buffer_map.GetBuffer(frame.video().data_handle());
+        chunk_size = buffer != nullptr ? WireFormat::ReceivedPayload(frame, *buffer).size() : 0;
+    }
+    if (auto recovered_seqnum = nack_tracker.OnParity(msg, chunk_size, clock::now())) {
+        // Counts as arrived, the frame buffer rebuilds it from the parity and the rest of the group
+        if (*recovered_seqnum >= receive_window_start) {
+            fp_network::Data placeholder;
+            placeholder.set_sequence_number(*recovered_seqnum);
+            recv_window.push(placeholder);
+            ProcessReceiveWindow();
+        }
+    }
+}
+
+void ProtocolActor::SendNacks() {
+    const auto now = clock::now();
+    const std::vector<uint64_t> nacks = nack_tracker.TakeNacks(now, receive_window_start, RetransmitInterval());
+    if (nacks.empty()) {
+        ArmTimer(now);
+        return;
+    }
+    fp_network::Network nack_msg;
+    for (uint64_t seqnum : nacks) {
+        nack_msg.mutable_nack_msg()->add_sequence_numbers(seqnum);
+    }
+    SendToSocket(nack_msg);
+}
+
+void ProtocolActor::DropExpiredMessages() {
+    const auto now = clock::now();
+    if (now < next_deadline) {
+        return;
+    }
+
+    size_t dropped_count = 0;
+    next_deadline = clock::time_point::max();
+    for (auto it = unacked_messages.begin(); it != unacked_messages.end();) {
+        if (it->deadline <= now) {
+            abandoned_seqnum_end = std::max(abandoned_seqnum_end, it->msg.sequence_number() + 1);
+            TryDecrementHandle(it->msg);
+            it = unacked_messages.erase(it);
+            dropped_count++;
+        } else {
+            next_deadline = std::min(next_deadline, it->deadline);
+            it++;
+        }
+    }
+
+    if (dropped_count > 0) {
+        LOG_TRACE("Client {} abandoned {} expired messages", GetName(), dropped_count);
+        // Let the receiver skip over the abandoned messages instead of waiting on them
+        SendForward();
+    }
+}
+
+void ProtocolActor::SendForward() {
+    // Forward past the last abandoned message, naming the unacked ones below that. A message that never
+    // expires, like a PPS_SPS chunk, stays outstanding without holding the receiver at it
+    fp_network::Network fwd_msg;
+    fp_network::Forward* forward = fwd_msg.mutable_fwd_msg();
+    forward->set_sequence_number(send_sequence_number);
+    for (const UnackedMessage& unacked : unacked_messages) {
+        const uint64_t seqnum = unacked.msg.sequence_number();
+        if (seqnum >= abandoned_seqnum_end || static_cast<size_t>(forward->outstanding_size()) == MAX_FORWARD_OUTSTANDING) {
+            forward->set_sequence_number(seqnum);
+            break;
+        }
+        forward->add_outstanding(seqnum);
     }
+    SendToSocket(fwd_msg);
 }
 
 void ProtocolActor::TryIncrementHandle(const fp_network::Data& msg) {
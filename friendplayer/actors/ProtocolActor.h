@@ -2,12 +2,20 @@
 
 #include "actors/TimerActor.h"
 #include "actors/DataBuffer.h"
+#include "common/CongestionController.h"
+#include "common/NackTracker.h"
+#include "common/Pacer.h"
+#include "common/WireFormat.h"
 
 #include "protobuf/network_messages.pb.h"
 
+#include <array>
 #include <chrono>
 #include <list>
+#include <map>
+#include <optional>
 #include <queue>
+#include <set>
 #include <vector>
 
 class Crypto;
@@ -16,6 +24,17 @@ class ProtocolActor : public TimerActor {
 public:
     static constexpr int FAST_RETRANSMIT_WINDOW = 4;
     static constexpr int RECEIVE_FFWD_WINDOW = 80;
+    // Unacked messages a forward names as still outstanding, it stops short of any past these
+    static constexpr size_t MAX_FORWARD_OUTSTANDING = 64;
+    static constexpr uint32_t MIN_RETRANSMIT_INTERVAL_MS = 10;
+    // Pacing rate relative to the congestion controller's target, leaves room to catch up after a burst
+    static constexpr double PACING_MULTIPLIER = 2.5;
+    // Datagram sizes for ethernet, PPPoE/tunnels, common VPNs and the IPv6 minimum MTU
+    static constexpr std::array<uint32_t, 4> MTU_PROBE_SIZES = {1472, 1452, 1372, 1252};
+    // Probes are resent on heartbeats until this many rounds went unanswered
+    static constexpr uint32_t MAX_MTU_PROBE_ROUNDS = 3;
+    // Retransmits of large datagrams in a row, without any of them being acked, before assuming a black hole
+    static constexpr uint32_t BLACKHOLE_RETRANSMITS = 8;
 
     ProtocolActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name);
 
@@ -23,22 +42,46 @@ public:
 
     void OnInit(const std::optional<any_msg>& init_msg) override;
     void OnMessage(const any_msg& msg) override;
-    void OnTimerFire() override {}
+    void OnTimerFire() override;
 
     uint32_t GetPing() { return RTT_milliseconds; }
+    // Largest media chunk payload that fits the confirmed path MTU
+    size_t GetMaxChunkSize() const { return datagram_size - WireFormat::MEDIA_HEADER_SIZE; }
+
+    // Starting send rate, before the congestion controller has any feedback
+    static constexpr uint32_t DEFAULT_MAX_BITRATE = 10000000;
+
+    // Broadcast frames are sealed once for every client, so only the stream is bound.
+    // Viewers catch replays by requiring the group sequence to keep increasing
+    static std::string GroupMediaAssociatedData(bool is_video, uint32_t stream_num);
 
 protected:
     uint64_t address;
+    std::string socket_name;
 
     void OnNetworkMessage(const fp_network::Network& msg);
     void OnAcknowledge(const fp_network::Ack& msg);
+    void OnForward(const fp_network::Forward& msg);
+    void OnNack(const fp_network::Nack& msg);
+    void OnMtuProbe(const fp_network::MtuProbe& msg);
+
+    // Starts probing for a datagram size larger than MIN_DATAGRAM_SIZE
+    void StartMtuDiscovery();
+    // Drops everything in flight and starts sequence numbers over, for a session resumed under new keys
+    void ResetTransport();
 
     virtual bool OnHandshakeMessage(const fp_network::Handshake& msg) = 0;
     virtual void OnDataMessage(const fp_network::Data& msg) = 0;
     virtual void OnStateMessage(const fp_network::State& msg) = 0;
     virtual void OnStreamInfoMessage(const fp_network::StreamInfo& msg) { }
+    // Called when the congestion controller's target send rate changes
+    virtual void OnTargetBitrate(uint32_t bitrate) { }
+    // Called when the measured loss rate moves to a different whole percent
+    virtual void OnLossPercent(uint32_t loss_percent) { }
 
     void SendToSocket(fp_network::Network& msg, bool is_retransmit = false);
+    // Acked data messages stop being retransmitted once deadline has passed
+    void SendToSocket(fp_network::Network& msg, clock::time_point deadline);
 
     enum HandshakeState {
         HS_UNINITIALIZED, HS_WAITING_SHAKE_ACK, HS_READY, HS_FAILED
@@ -50,10 +93,34 @@ protected:
 
     std::unique_ptr<Crypto> crypto_impl;
 
+    // Authenticated alongside encrypted frames so a frame can't be passed off as another frame or stream
+    static std::string MediaAssociatedData(bool is_video, uint32_t stream_num, uint32_t frame_num);
+    static std::string ClientFrameAssociatedData(uint32_t frame_id);
+    static std::string GroupKeysAssociatedData();
+
     uint64_t send_sequence_number;
+
+    struct UnackedMessage {
+        fp_network::Data msg;
+        clock::time_point deadline;
+        clock::time_point last_sent;
+        size_t size;
+        // RTT samples from retransmitted messages are ambiguous
+        bool retransmitted;
+    };
     // Ack window for stream
-    std::list<fp_network::Data> unacked_messages;
+    std::list<UnackedMessage> unacked_messages;
+    // Earliest deadline in unacked_messages
+    clock::time_point next_deadline;
+    // One past the highest sequence number dropped on its deadline
+    uint64_t abandoned_seqnum_end;
     uint64_t receive_window_start;
+    // From the newest forward: the window skips everything below forward_seqnum that hasn't
+    // arrived, except what's in forward_outstanding
+    uint64_t forward_seqnum;
+    std::set<uint64_t> forward_outstanding;
+    // Repeated from the timer while NACKs go unanswered
+    NackTracker nack_tracker;
 
     struct SeqnumLess {
         bool operator()(const fp_network::Data& lhs, const fp_network::Data& rhs) const {
@@ -63,8 +130,41 @@ protected:
     // Recv window for stream
     std::priority_queue<fp_network::Data, std::vector<fp_network::Data>, SeqnumLess> recv_window;
 
+    CongestionController congestion_controller;
+    uint32_t published_loss_percent;
+    Pacer pacer;
+
+    // Largest datagram size the peer has confirmed receiving
+    uint32_t datagram_size;
+    bool mtu_discovery_enabled;
+    uint32_t mtu_probe_rounds;
+    uint32_t blackhole_retransmits;
+
     void TryIncrementHandle(const fp_network::Data& msg);
     void TryDecrementHandle(const fp_network::Data& msg);
+
+private:
+    void ForwardToSocket(const fp_network::Network& msg);
+    void PaceToSocket(const fp_network::Network& msg, clock::time_point deadline);
+    void DrainPacer();
+    // One shot timer for whichever comes first, the pacer's next send or the next re-NACK
+    void ArmTimer(clock::time_point now);
+    void DropExpiredMessages();
+    void SendForward();
+    void Retransmit(UnackedMessage& unacked);
+    void ProcessReceiveWindow();
+    void DeliverFromWindow(const fp_network::Data& msg);
+    // Parity settles the gaps in its group before it goes up to the frame buffer
+    void OnParity(const fp_network::Data& msg);
+    void SendNacks();
+    clock::duration RetransmitInterval() const;
+    size_t DataMessageSize(const fp_network::Data& msg);
+    size_t NetworkMessageSize(const fp_network::Network& msg);
+    void UpdateCongestionControl();
+    void SendMtuProbes();
+
+    // When the armed timer fires, only meaningful while IsTimerActive
+    clock::time_point timer_due;
 };
 
 DEFINE_ACTOR_GENERATOR(ProtocolActor)
\ No newline at end of file
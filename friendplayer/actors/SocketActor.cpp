@@ -2,10 +2,61 @@
 
 #include "actors/CommonActorNames.h"
 #include "protobuf/actor_messages.pb.h"
+#include "common/Config.h"
 #include "common/Log.h"
+#include "common/WireFormat.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+namespace {
+#ifdef _WIN32
+using dont_fragment = asio::detail::socket_option::boolean<IPPROTO_IP, IP_DONTFRAGMENT>;
+#elif defined(__linux__)
+using mtu_discover = asio::detail::socket_option::integer<IPPROTO_IP, IP_MTU_DISCOVER>;
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// What the kernel actually gave us, Linux reports double the request to account for bookkeeping
+template <typename BufferOption>
+size_t EffectiveBufferSize(asio::ip::udp::socket& socket) {
+    BufferOption option;
+    asio::error_code ec;
+    socket.get_option(option, ec);
+    return ec ? 0 : static_cast<size_t>(option.value());
+}
+
+// The size to compare against our own requests, Linux's doubling taken back out
+template <typename BufferOption>
+size_t RequestedBufferSize(asio::ip::udp::socket& socket) {
+#ifdef __linux__
+    return EffectiveBufferSize<BufferOption>(socket) / 2;
+#else
+    return EffectiveBufferSize<BufferOption>(socket);
+#endif
+}
+}
 
 void SocketActor::OnInit(const std::optional<any_msg>& init_msg) {
     TimerActor::OnInit(init_msg);
+    SetDontFragment();
+    DatagramIo::Backend backend = DatagramIo::DefaultBackend();
+    if (!Config::NetworkBackend.empty() && !DatagramIo::ParseBackend(Config::NetworkBackend, backend)) {
+        LOG_WARNING("Unknown network backend {}, using {}", Config::NetworkBackend, DatagramIo::BackendName(backend));
+    }
+    datagram_io = DatagramIo::Create(backend, socket);
+    // Gathered payloads keep their handle's reference until the backend has handed them to the kernel
+    datagram_io->SetReleaseHandler([this](uint64_t handle) { buffer_map.Decrement(handle); });
+    // Received media payloads ride the buffer they landed in, so they're never copied
+    datagram_io->SetBufferProvider([this](size_t size, uint64_t& handle) {
+        handle = buffer_map.CreatePooled(size);
+        return buffer_map.GetBuffer(handle)->data();
+    });
+    LOG_INFO("Using {} datagram backend", DatagramIo::BackendName(backend));
+    requested_recv_buffer = RequestedBufferSize<asio::socket_base::receive_buffer_size>(socket);
+    requested_send_buffer = RequestedBufferSize<asio::socket_base::send_buffer_size>(socket);
+    LOG_INFO("Socket buffers: SO_RCVBUF {} SO_SNDBUF {}", requested_recv_buffer, requested_send_buffer);
+    last_report = clock::now();
     network_is_running = true;
     network_thread = std::make_unique<std::thread>(&SocketActor::NetworkWorker, this);
 }
@@ -16,33 +67,122 @@ void SocketActor::OnMessage(const any_msg& msg) {
         msg.UnpackTo(&send_msg);
 
         fp_network::Network& network_msg = *send_msg.mutable_msg();
-        asio_endpoint send_endpoint(asio_address(send_msg.address() & 0xFFFFFFFF), (send_msg.address() >> 32) & 0xFFFF);
-
-        // Fill in buffer with actual data if necessary
-        if (network_msg.Payload_case() == fp_network::Network::kDataMsg
-            && network_msg.data_msg().Payload_case() == fp_network::Data::kHostFrame) {
-            auto& host_frame = *network_msg.mutable_data_msg()->mutable_host_frame();
-            uint64_t handle = 0;
-            if (host_frame.has_video()) {
-                handle = host_frame.video().data_handle();
-                host_frame.mutable_video()->clear_DataBacking();
-                std::string* buf = buffer_map.GetBuffer(handle);
-                host_frame.mutable_video()->set_data(buf->data(), buf->size());
-            } else if (host_frame.has_audio()) {
-                handle = host_frame.audio().data_handle();
-                host_frame.mutable_audio()->clear_DataBacking();
-                std::string* buf = buffer_map.GetBuffer(handle);
-                host_frame.mutable_audio()->set_data(buf->data(), buf->size());
+        sends_since_drain++;
+
+        // Media chunks skip protobuf, the header is written to scratch and the payload is sent from its buffer
+        if (WireFormat::IsMediaChunk(network_msg)) {
+            const auto& host_frame = network_msg.data_msg().host_frame();
+            const uint64_t handle = host_frame.has_video() ? host_frame.video().data_handle() : host_frame.audio().data_handle();
+            const std::string* buffer = buffer_map.GetBuffer(handle);
+            if (buffer == nullptr) {
+                return;
             }
-            buffer_map.Decrement(handle);
+            WireFormat::SerializeMediaHeader(network_msg, header_scratch.data());
+            datagram_io->SendGather(send_msg.address(), std::string_view(header_scratch.data(), header_scratch.size()),
+                WireFormat::PayloadSlice(host_frame, *buffer), handle);
+        } else {
+            network_msg.SerializeToString(&send_buffer);
+            datagram_io->Send(send_msg.address(), send_buffer);
+        }
+    } else if (msg.Is<fp_actor::SocketRoute>()) {
+        fp_actor::SocketRoute route_msg;
+        msg.UnpackTo(&route_msg);
+        std::unique_lock<std::shared_mutex> lock(address_to_actor_m);
+        if (route_msg.remove()) {
+            address_to_actor.erase(route_msg.address());
+        } else {
+            address_to_actor[route_msg.address()] = route_msg.actor_name();
         }
-        asio::error_code ec;
-        socket.send_to(asio::buffer(network_msg.SerializeAsString()), send_endpoint, 0, ec);
     } else {
         TimerActor::OnMessage(msg);
     }
 }
 
+void SocketActor::OnMailboxDrained() {
+    if (datagram_io) {
+        datagram_io->Flush();
+        peak_send_backlog = std::max(peak_send_backlog, sends_since_drain);
+        sends_since_drain = 0;
+        const clock::time_point now = clock::now();
+        if (now - last_report >= STATS_INTERVAL) {
+            ReportStats(now);
+        }
+    }
+}
+
+void SocketActor::ReportStats(clock::time_point now) {
+    const DatagramIo::Stats stats = datagram_io->GetStats();
+    const uint64_t failures = parse_failures.load(std::memory_order_relaxed);
+    const double seconds = std::chrono::duration<double>(now - last_report).count();
+
+    const uint64_t overflows = stats.receive_overflows - last_stats.receive_overflows;
+    const uint64_t would_block = stats.send_would_block - last_stats.send_would_block;
+    const uint64_t no_buffers = stats.send_no_buffers - last_stats.send_no_buffers;
+    const uint64_t other_errors = stats.send_other_errors - last_stats.send_other_errors;
+    const uint64_t new_failures = failures - last_parse_failures;
+    TuneBuffers((stats.bytes_received - last_stats.bytes_received) / seconds,
+        (stats.bytes_sent - last_stats.bytes_sent) / seconds, overflows > 0);
+
+    const std::string report = fmt::format("{} last {:.1f}s: in {} pkts {} B, out {} pkts {} B, parse failures {}, "
+        "send EAGAIN {} ENOBUFS {} other {}, kernel receive drops {}, peak send backlog {}, SO_RCVBUF {} SO_SNDBUF {}",
+        GetName(), seconds,
+        stats.packets_received - last_stats.packets_received, stats.bytes_received - last_stats.bytes_received,
+        stats.packets_sent - last_stats.packets_sent, stats.bytes_sent - last_stats.bytes_sent, new_failures,
+        would_block, no_buffers, other_errors, overflows, peak_send_backlog,
+        EffectiveBufferSize<asio::socket_base::receive_buffer_size>(socket),
+        EffectiveBufferSize<asio::socket_base::send_buffer_size>(socket));
+    if (overflows > 0 || would_block > 0 || no_buffers > 0 || other_errors > 0 || new_failures > 0) {
+        LOG_WARNING("{}", report);
+    } else {
+        LOG_TRACE("{}", report);
+    }
+
+    last_stats = stats;
+    last_parse_failures = failures;
+    peak_send_backlog = 0;
+    last_report = now;
+}
+
+void SocketActor::TuneBuffers(double recv_rate, double send_rate, bool receive_overflowed) {
+    const auto target_for = [](double rate) {
+        const double bytes = rate * std::chrono::duration<double>(BUFFER_DURATION).count();
+        return std::clamp(static_cast<size_t>(bytes), MIN_SOCKET_BUFFER, MAX_SOCKET_BUFFER);
+    };
+    size_t recv_target = target_for(recv_rate);
+    if (receive_overflowed) {
+        // The rate averages out bursts, drops mean a burst didn't fit
+        recv_target = std::max(recv_target, std::min(requested_recv_buffer * 2, MAX_SOCKET_BUFFER));
+    }
+    // Shrinking only past half keeps the size from flapping with the bitrate
+    asio::error_code ec;
+    if (recv_target > requested_recv_buffer || recv_target < requested_recv_buffer / 2) {
+        socket.set_option(asio::socket_base::receive_buffer_size(static_cast<int>(recv_target)), ec);
+        if (!ec) {
+            requested_recv_buffer = recv_target;
+        }
+    }
+    const size_t send_target = target_for(send_rate);
+    if (send_target > requested_send_buffer || send_target < requested_send_buffer / 2) {
+        socket.set_option(asio::socket_base::send_buffer_size(static_cast<int>(send_target)), ec);
+        if (!ec) {
+            requested_send_buffer = send_target;
+        }
+    }
+}
+
+void SocketActor::SetDontFragment() {
+    asio::error_code ec;
+#ifdef _WIN32
+    socket.set_option(dont_fragment(true), ec);
+#elif defined(__linux__)
+    // PROBE sets DF without clamping sends to the kernel's cached path MTU
+    socket.set_option(mtu_discover(IP_PMTUDISC_PROBE), ec);
+#endif
+    if (ec) {
+        LOG_WARNING("Failed to set don't fragment on socket, MTU probes may pass through fragmented: {}", ec.message());
+    }
+}
+
 void SocketActor::OnFinish() {
     network_is_running = false;
     socket.close();
@@ -61,56 +201,97 @@ void HostSocketActor::OnFinish() {
 }
 
 void SocketActor::NetworkWorker() {
-    std::string recv_buffer;
-    recv_buffer.resize(1500);
-
+    auto on_datagram = [this](uint64_t address, const char* data, size_t size, std::optional<uint64_t> buffer_handle) {
+        OnDatagram(address, data, size, buffer_handle);
+    };
     while (network_is_running) {
-        asio::error_code ec;
-        asio_endpoint recv_endpoint;
-        size_t recv_size = socket.receive_from(asio::buffer(recv_buffer), recv_endpoint, 0, ec);
-        if (recv_size == 0 || ec.value() != 0) {
-            continue;
+        datagram_io->Receive(on_datagram);
+    }
+}
+
+void SocketActor::OnDatagram(uint64_t address, const char* data, size_t size, std::optional<uint64_t> buffer_handle) {
+    if (use_holepunching && address == DatagramIo::ToAddress(holepunch_endpoint)) {
+        fp_puncher::ServerMessage msg;
+        msg.ParseFromArray(data, static_cast<int>(size));
+        OnPuncherMessage(msg);
+        return;
+    }
+
+    fp_network::Network recv_msg;
+    if (WireFormat::IsMediaChunk(data, size)) {
+        std::string_view payload;
+        if (!WireFormat::ParseMediaChunk(data, size, recv_msg, payload)) {
+            parse_failures.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-        if (use_holepunching && recv_endpoint == holepunch_endpoint) {
-            fp_puncher::ServerMessage msg;
-            msg.ParseFromArray(recv_buffer.data(), static_cast<int>(recv_size));
-            OnPuncherMessage(msg);           
+        // Only the header was decoded, the payload rides a pooled buffer handle the rest of the way
+        auto& host_frame = *recv_msg.mutable_data_msg()->mutable_host_frame();
+        uint64_t handle;
+        uint32_t data_offset = 0;
+        uint32_t data_size = 0;
+        if (buffer_handle && !payload.empty() && buffer_map.Increment(*buffer_handle)) {
+            // Already in the backend's pooled buffer
+            handle = *buffer_handle;
+            data_offset = static_cast<uint32_t>(payload.data() - buffer_map.GetBuffer(handle)->data());
+            data_size = static_cast<uint32_t>(payload.size());
         } else {
-            fp_actor::NetworkRecv msg;
-            uint64_t address = recv_endpoint.address().to_v4().to_uint();
-            address |= static_cast<uint64_t>(recv_endpoint.port()) << 32;
-            msg.set_address(address);
-
-            fp_network::Network recv_msg;
-            if (!recv_msg.ParseFromArray(recv_buffer.data(), static_cast<int>(recv_size))) {
-                continue;
-            }
-            // Special casing done here, don't kill me
-            if (recv_msg.has_hs_msg() &&
-                recv_msg.hs_msg().has_phase1()) {
-                if (recv_msg.hs_msg().phase1().token() != session_token) {
-                    continue;
-                }
-            }
+            handle = buffer_map.CreatePooled(payload.data(), payload.size());
+        }
+        if (host_frame.has_video()) {
+            host_frame.mutable_video()->set_data_handle(handle);
+            host_frame.mutable_video()->set_data_offset(data_offset);
+            host_frame.mutable_video()->set_data_size(data_size);
+        } else {
+            host_frame.mutable_audio()->set_data_handle(handle);
+            host_frame.mutable_audio()->set_data_offset(data_offset);
+            host_frame.mutable_audio()->set_data_size(data_size);
+        }
+        Dispatch(address, std::move(recv_msg));
+        return;
+    }
+    if (!recv_msg.ParseFromArray(data, static_cast<int>(size))) {
+        parse_failures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Special casing done here, don't kill me
+    if (recv_msg.has_hs_msg() &&
+        recv_msg.hs_msg().has_phase1()) {
+        if (recv_msg.hs_msg().phase1().token() != session_token) {
+            return;
+        }
+    }
 
-            // Put data message in buffer
-            if (recv_msg.Payload_case() == fp_network::Network::kDataMsg
-                && recv_msg.data_msg().Payload_case() == fp_network::Data::kHostFrame) {
-                auto& host_frame = *recv_msg.mutable_data_msg()->mutable_host_frame();
-                if (host_frame.has_video()) {
-                    std::string* data = host_frame.mutable_video()->release_data();
-                    host_frame.mutable_video()->clear_DataBacking();
-                    host_frame.mutable_video()->set_data_handle(buffer_map.Wrap(data));
-                } else if (host_frame.has_audio()) {
-                    std::string* data = host_frame.mutable_audio()->release_data();
-                    host_frame.mutable_audio()->clear_DataBacking();
-                    host_frame.mutable_audio()->set_data_handle(buffer_map.Wrap(data));
-                }
-            }
-            *msg.mutable_msg() = recv_msg;
-            SendTo(CLIENT_MANAGER_ACTOR_NAME, msg);
+    // Put data message in buffer
+    if (recv_msg.Payload_case() == fp_network::Network::kDataMsg
+        && recv_msg.data_msg().Payload_case() == fp_network::Data::kHostFrame) {
+        auto& host_frame = *recv_msg.mutable_data_msg()->mutable_host_frame();
+        if (host_frame.has_video()) {
+            std::string* frame_data = host_frame.mutable_video()->release_data();
+            host_frame.mutable_video()->clear_DataBacking();
+            host_frame.mutable_video()->set_data_handle(buffer_map.Wrap(frame_data));
+        } else if (host_frame.has_audio()) {
+            std::string* frame_data = host_frame.mutable_audio()->release_data();
+            host_frame.mutable_audio()->clear_DataBacking();
+            host_frame.mutable_audio()->set_data_handle(buffer_map.Wrap(frame_data));
         }
     }
+    Dispatch(address, std::move(recv_msg));
+}
+
+void SocketActor::Dispatch(uint64_t address, fp_network::Network&& recv_msg) {
+    // Handshakes still go through the manager, it creates clients and checks phase 1
+    if (!recv_msg.has_hs_msg()) {
+        std::shared_lock<std::shared_mutex> lock(address_to_actor_m);
+        auto it = address_to_actor.find(address);
+        if (it != address_to_actor.end()) {
+            SendTo(it->second, recv_msg);
+            return;
+        }
+    }
+    fp_actor::NetworkRecv msg;
+    msg.set_address(address);
+    *msg.mutable_msg() = std::move(recv_msg);
+    SendTo(CLIENT_MANAGER_ACTOR_NAME, msg);
 }
 
 void HostSocketActor::OnInit(const std::optional<any_msg>& init_msg) {
@@ -118,7 +299,14 @@ void HostSocketActor::OnInit(const std::optional<any_msg>& init_msg) {
         if (init_msg->Is<fp_actor::SocketInitDirect>()) {
             fp_actor::SocketInitDirect msg;
             init_msg->UnpackTo(&msg);
-            socket = asio_socket(io_service, asio_endpoint(asio::ip::udp::v4(), msg.port()));
+            socket.open(asio::ip::udp::v4());
+#ifdef __linux__
+            if (msg.reuse_port()) {
+                // Must be set on every shard before any of them binds
+                socket.set_option(reuse_port(true));
+            }
+#endif
+            socket.bind(asio_endpoint(asio::ip::udp::v4(), msg.port()));
             use_holepunching = false;
         } else if (init_msg->Is<fp_actor::SocketInitHolepunch>()) {
             fp_actor::SocketInitHolepunch msg;
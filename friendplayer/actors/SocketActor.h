@@ -1,29 +1,45 @@
 #pragma once
 
 #include "actors/TimerActor.h"
+#include "common/DatagramIo.h"
+#include "common/WireFormat.h"
 
+#include <array>
+#include <atomic>
 #include <asio/io_service.hpp>
 #include <asio/ip/udp.hpp>
+#include <map>
 #include <puncher_messages.pb.h>
+#include <shared_mutex>
 
 #include "protobuf/actor_messages.pb.h"
 
 class SocketActor : public TimerActor {
 private:
     static constexpr size_t BLOCK_SIZE = 16;
-    // maximum chunk size over UDP accounding for proto overhead
-    // and AES block encryption
-    static constexpr size_t MAX_DATA_CHUNK = 476;
+    // How often counters are logged and the socket buffers retuned
+    static constexpr std::chrono::seconds STATS_INTERVAL{5};
+    // Socket buffers are sized to hold this much traffic at the observed bitrate
+    static constexpr std::chrono::milliseconds BUFFER_DURATION{250};
+    static constexpr size_t MIN_SOCKET_BUFFER = 1024 * 1024;
+    static constexpr size_t MAX_SOCKET_BUFFER = 16 * 1024 * 1024;
 public:
     SocketActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name)
       : TimerActor(actor_map, buffer_map, std::move(name)),
         network_thread(nullptr),
         network_is_running(false),
-        socket(io_service) {}
+        socket(io_service),
+        parse_failures(0),
+        sends_since_drain(0),
+        peak_send_backlog(0),
+        last_parse_failures(0),
+        requested_recv_buffer(0),
+        requested_send_buffer(0) {}
 
     virtual ~SocketActor() {}
 
     void OnMessage(const any_msg& msg) override;
+    void OnMailboxDrained() override;
     void OnInit(const std::optional<any_msg>& init_msg) override;
     void OnFinish() override;
     void OnTimerFire() override {}
@@ -42,11 +58,44 @@ protected:
 
     asio_service io_service;
     asio_socket socket;
+    // Media path, holepuncher traffic goes straight through socket
+    std::unique_ptr<DatagramIo> datagram_io;
 
     bool use_holepunching;
     asio_endpoint holepunch_endpoint;
     std::string holepunch_identity;
     std::string session_token;
+
+    // Reused between sends to avoid an allocation per datagram
+    std::string send_buffer;
+    std::array<char, WireFormat::MEDIA_HEADER_SIZE> header_scratch;
+
+    // Established sessions published by ClientManagerActor, read by the network thread
+    std::map<uint64_t, std::string> address_to_actor;
+    std::shared_mutex address_to_actor_m;
+
+    // Datagrams that were neither media chunks nor protobuf, counted by the network thread
+    std::atomic<uint64_t> parse_failures;
+    // Sends handled since the mailbox last ran dry, the peak is how far sends queued up behind each other
+    size_t sends_since_drain;
+    size_t peak_send_backlog;
+    DatagramIo::Stats last_stats;
+    uint64_t last_parse_failures;
+    clock::time_point last_report;
+    size_t requested_recv_buffer;
+    size_t requested_send_buffer;
+
+private:
+    // Oversized datagrams must be dropped rather than fragmented for MTU probes to mean anything
+    void SetDontFragment();
+    // buffer_handle is set when data lies in a pooled buffer the backend received into
+    void OnDatagram(uint64_t address, const char* data, size_t size, std::optional<uint64_t> buffer_handle);
+    // Straight to the session's protocol actor if routed, otherwise through the manager
+    void Dispatch(uint64_t address, fp_network::Network&& recv_msg);
+    // Logs the counters for the last interval, loudly if anything was dropped
+    void ReportStats(clock::time_point now);
+    // Grows or shrinks SO_RCVBUF/SO_SNDBUF to hold BUFFER_DURATION of traffic at these byte rates
+    void TuneBuffers(double recv_rate, double send_rate, bool receive_overflowed);
 };
 
 DEFINE_ACTOR_GENERATOR(SocketActor)
@@ -4,6 +4,7 @@
 #include "streamer/VideoStreamer.h"
 #include "encoder/DDAImpl.h"
 #include "common/Log.h"
+#include "common/Config.h"
 
 VideoEncodeActor::VideoEncodeActor(const ActorMap& actor_map, DataBufferMap& buffer_map, std::string&& name) 
     : TimerActor(actor_map, buffer_map, std::move(name)),
@@ -54,18 +55,38 @@ void VideoEncodeActor::OnMessage(const any_msg& msg) {
             idr_requested = true;
             pps_sps_requested = true;
         }
+    } else if (msg.Is<fp_actor::EncoderBitrate>()) {
+        fp_actor::EncoderBitrate bitrate_msg;
+        msg.UnpackTo(&bitrate_msg);
+        OnEncoderBitrate(bitrate_msg);
     } else {
         TimerActor::OnMessage(msg);
     }
 }
 
+void VideoEncodeActor::OnEncoderBitrate(const fp_actor::EncoderBitrate& msg) {
+    if (msg.remove()) {
+        client_bitrates.erase(msg.client_actor_name());
+    } else {
+        client_bitrates[msg.client_actor_name()] = msg.bitrate();
+    }
+    // Every client shares this encoder, so it has to fit the most constrained one
+    uint32_t bitrate = static_cast<uint32_t>(Config::AverageBitrate);
+    for (auto&& [name, client_bitrate] : client_bitrates) {
+        bitrate = std::min(bitrate, client_bitrate);
+    }
+    host_streamer->SetBitrate(static_cast<int>(bitrate));
+}
+
 void VideoEncodeActor::OnTimerFire() {
+    const uint64_t capture_timestamp = clock::now().time_since_epoch().count();
     std::string* data = new std::string();
     host_streamer->Encode(idr_requested, pps_sps_requested, *data);
     uint64_t handle = buffer_map.Wrap(data);
     fp_actor::VideoData video_data;
     video_data.set_stream_num(stream_num);
     video_data.set_handle(handle);
+    video_data.set_timestamp(capture_timestamp);
     if (pps_sps_requested) {
         video_data.set_type(fp_actor::VideoData::PPS_SPS);
     } else if (idr_requested) {
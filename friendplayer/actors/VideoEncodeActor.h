@@ -2,6 +2,8 @@
 
 #include "actors/TimerActor.h"
 
+#include <map>
+
 class VideoStreamer;
 
 class VideoEncodeActor : public TimerActor {
@@ -19,6 +21,10 @@ private:
     bool idr_requested;
     bool pps_sps_requested;
     uint32_t stream_num;
+
+    // Target bitrate requested by each client's congestion controller
+    std::map<std::string, uint32_t> client_bitrates;
+    void OnEncoderBitrate(const fp_actor::EncoderBitrate& msg);
 };
 
 DEFINE_ACTOR_GENERATOR(VideoEncodeActor)
\ No newline at end of file
@@ -0,0 +1,693 @@
+#include "common/Benchmark.h"
+
+#include "common/Config.h"
+#include "common/Crypto.h"
+#include "common/CryptoPool.h"
+#include "common/DatagramIo.h"
+#include "common/Log.h"
+#include "common/NackTracker.h"
+#include "common/WireFormat.h"
+#include "streamer/AudioStreamer.h"
+
+#include <asio/io_service.hpp>
+#include <asio/ip/udp.hpp>
+#include <fmt/format.h>
+
+#include "protobuf/network_messages.pb.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// CPU time used by every thread in the process
+std::chrono::microseconds ProcessCpuTime() {
+#ifdef _WIN32
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time);
+    auto to_us = [](const FILETIME& time) {
+        return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 10;
+    };
+    return std::chrono::microseconds(to_us(kernel_time) + to_us(user_time));
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+struct Measurement {
+    clock::time_point wall_start = clock::now();
+    std::chrono::microseconds cpu_start = ProcessCpuTime();
+
+    double WallSeconds() const { return std::chrono::duration<double>(clock::now() - wall_start).count(); }
+    double CpuNanoseconds() const { return std::chrono::duration<double, std::nano>(ProcessCpuTime() - cpu_start).count(); }
+};
+
+double ToMs(clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Blasts packets over loopback through each datagram backend, sends are flushed every
+// BATCH_SIZE like SocketActor flushes at the end of a mailbox batch.
+// Each datagram is a media header gathered with a payload slice, the way SocketActor sends chunks
+int UdpLoopback() {
+    constexpr size_t BATCH_SIZE = 32;
+    const size_t packets = static_cast<size_t>(Config::BenchmarkIterations);
+    const std::string payload(static_cast<size_t>(Config::BenchmarkPayloadSize), 'x');
+    const std::string header(WireFormat::MEDIA_HEADER_SIZE, 'h');
+
+    for (DatagramIo::Backend backend : DatagramIo::AvailableBackends()) {
+        asio::io_service io_service;
+        asio::ip::udp::socket recv_socket(io_service, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), 0));
+        asio::ip::udp::socket send_socket(io_service);
+        send_socket.open(asio::ip::udp::v4());
+        recv_socket.set_option(asio::socket_base::receive_buffer_size(8 * 1024 * 1024));
+        send_socket.set_option(asio::socket_base::send_buffer_size(8 * 1024 * 1024));
+
+        auto receiver = DatagramIo::Create(backend, recv_socket);
+        auto sender = DatagramIo::Create(backend, send_socket);
+        const uint64_t recv_address = DatagramIo::ToAddress(recv_socket.local_endpoint());
+        size_t released = 0;
+        sender->SetReleaseHandler([&released](uint64_t) { released++; });
+
+        std::atomic<size_t> received = 0;
+        std::atomic<bool> done = false;
+        Measurement measurement;
+
+        // A single byte datagram marks the end of the run
+        std::thread recv_thread([&]() {
+            auto on_datagram = [&](uint64_t, const char*, size_t size, std::optional<uint64_t>) {
+                if (size == 1) {
+                    done = true;
+                } else if (size == payload.size()) {
+                    received++;
+                }
+            };
+            while (!done) {
+                receiver->Receive(on_datagram);
+            }
+        });
+
+        for (size_t i = 0; i < packets; i++) {
+            sender->SendGather(recv_address, header, std::string_view(payload).substr(header.size()), i);
+            if (i % BATCH_SIZE == BATCH_SIZE - 1) {
+                sender->Flush();
+            }
+        }
+        sender->Flush();
+        // Give the receiver time to drain before the end marker goes out
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            sender->Send(recv_address, std::string_view("!", 1));
+            sender->Flush();
+        }
+        recv_thread.join();
+        sender.reset();
+        if (released != packets) {
+            LOG_ERROR("udp {}: {} of {} gathered payloads were never released", DatagramIo::BackendName(backend), packets - released, packets);
+        }
+
+        const double seconds = measurement.WallSeconds();
+        const double cpu_ns = measurement.CpuNanoseconds();
+        const size_t total = received.load();
+        // Tells receive buffer overruns apart from sends that never left
+        const DatagramIo::Stats recv_stats = receiver->GetStats();
+        LOG_INFO("udp {}: {} bytes x {} sent, {} received ({:.2f}% loss, {} kernel receive drops), {:.0f} packets/sec, {:.0f} ns CPU/packet send+receive",
+            DatagramIo::BackendName(backend), payload.size(), packets, total,
+            100.0 * (packets - total) / packets, recv_stats.receive_overflows, total / seconds, cpu_ns / packets);
+    }
+    return 0;
+}
+
+// Every viewer's ClientActor seals the same --size video frame by chunk at 60 fps on its own thread,
+// all of them sharing the CryptoPool. Latency is per frame, from the start of sealing to the last chunk
+int CryptoClients() {
+    constexpr size_t FRAMES_PER_CLIENT = 300;
+    constexpr std::chrono::microseconds FRAME_INTERVAL{1000000 / 60};
+    // A 1200 byte datagram less the media header
+    constexpr size_t CHUNK_SIZE = 1200 - WireFormat::MEDIA_HEADER_SIZE;
+    const size_t num_clients = static_cast<size_t>(std::max(Config::BenchmarkClients, 1));
+
+    Crypto group(1024);
+    std::vector<std::unique_ptr<Crypto>> clients;
+    for (size_t i = 0; i < num_clients; i++) {
+        clients.push_back(std::make_unique<Crypto>(group.P(), group.Q(), group.G()));
+        clients.back()->SharedKeyAgreement(group.GetPublicKey());
+    }
+
+    const std::string frame(static_cast<size_t>(Config::BenchmarkPayloadSize), 'x');
+    std::vector<clock::duration> latencies(num_clients * FRAMES_PER_CLIENT);
+    std::atomic<bool> sealed_all{true};
+    Measurement measurement;
+    std::vector<std::thread> client_threads;
+    for (size_t client = 0; client < num_clients; client++) {
+        client_threads.emplace_back([&, client]() {
+            std::string sealed;
+            clock::time_point next_frame = clock::now();
+            for (uint32_t frame_num = 0; frame_num < FRAMES_PER_CLIENT; frame_num++) {
+                std::this_thread::sleep_until(next_frame);
+                next_frame += FRAME_INTERVAL;
+                const clock::time_point start = clock::now();
+                if (!clients[client]->SealChunks(frame, CHUNK_SIZE, Crypto::ChunkId(true, 0, frame_num, 0), {}, sealed)) {
+                    sealed_all = false;
+                    return;
+                }
+                latencies[client * FRAMES_PER_CLIENT + frame_num] = clock::now() - start;
+            }
+        });
+    }
+    for (std::thread& client_thread : client_threads) {
+        client_thread.join();
+    }
+    const double cpu_ns = measurement.CpuNanoseconds();
+    if (!sealed_all) {
+        LOG_ERROR("crypto clients: failed to seal a {} byte frame", frame.size());
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double total_ms = 0;
+    for (clock::duration latency : latencies) {
+        total_ms += ToMs(latency);
+    }
+    const clock::duration p99 = latencies[latencies.size() * 99 / 100];
+    LOG_INFO("crypto clients: {} clients x {} byte frames on {} threads, {:.2f} cpu ns/byte",
+        num_clients, frame.size(), CryptoPool::Get().Parallelism(), cpu_ns / (static_cast<double>(latencies.size()) * frame.size()));
+    LOG_INFO("crypto clients: per frame latency mean {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+        total_ms / latencies.size(), ToMs(p99), ToMs(latencies.back()));
+    if (p99 > FRAME_INTERVAL) {
+        LOG_WARNING("crypto clients: p99 latency is over the {:.2f} ms frame interval", ToMs(FRAME_INTERVAL));
+    }
+    return 0;
+}
+
+// Both ends of a handshake in one thread, through serialized Network messages like ProtocolActor sees them:
+// phase 2 on the host, phase 3 on the viewer, key agreement and StreamInfo, then the first --size IDR frame
+// sealed by chunk and opened. Network round trips aren't included. Runs up to 1000 of --iterations
+int HandshakeLatency() {
+    // Each of these makes a fresh group, the way every client used to
+    constexpr size_t COLD_HANDSHAKES = 3;
+    constexpr size_t CHUNK_SIZE = 1200 - WireFormat::MEDIA_HEADER_SIZE;
+    const size_t handshakes = std::min<size_t>(static_cast<size_t>(Config::BenchmarkIterations), 1000);
+    const std::string idr_frame(static_cast<size_t>(Config::BenchmarkPayloadSize), 'x');
+
+    enum Phase { PHASE2 = 0, PHASE3, AGREEMENT, FIRST_FRAME, PHASE_COUNT };
+    using Timings = std::array<clock::duration, PHASE_COUNT>;
+    auto handshake = [&](bool cached_group, Timings& timings) {
+        fp_network::Network phase1_msg;
+        phase1_msg.mutable_hs_msg()->mutable_phase1()->set_magic(0x46524E44504C5952ull);
+        phase1_msg.mutable_hs_msg()->mutable_phase1()->set_client_name("bench");
+        const std::string phase1_wire = phase1_msg.SerializeAsString();
+
+        clock::time_point start = clock::now();
+        fp_network::Network host_msg;
+        host_msg.ParseFromString(phase1_wire);
+        auto host_side = cached_group ? std::make_unique<Crypto>(Crypto::CachedGroup(Crypto::DH_GROUP_BITS))
+                                      : std::make_unique<Crypto>(Crypto::DH_GROUP_BITS);
+        fp_network::Network phase2_msg;
+        phase2_msg.mutable_hs_msg()->mutable_phase2()->set_p(host_side->P());
+        phase2_msg.mutable_hs_msg()->mutable_phase2()->set_q(host_side->Q());
+        phase2_msg.mutable_hs_msg()->mutable_phase2()->set_g(host_side->G());
+        phase2_msg.mutable_hs_msg()->mutable_phase2()->set_pubkey(host_side->GetPublicKey());
+        const std::string phase2_wire = phase2_msg.SerializeAsString();
+        timings[PHASE2] = clock::now() - start;
+
+        start = clock::now();
+        fp_network::Network viewer_msg;
+        viewer_msg.ParseFromString(phase2_wire);
+        const fp_network::HSPhase2& phase2 = viewer_msg.hs_msg().phase2();
+        Crypto viewer_side(phase2.p(), phase2.q(), phase2.g());
+        viewer_side.SharedKeyAgreement(phase2.pubkey());
+        fp_network::Network phase3_msg;
+        phase3_msg.mutable_hs_msg()->mutable_phase3()->set_pubkey(viewer_side.GetPublicKey());
+        const std::string phase3_wire = phase3_msg.SerializeAsString();
+        timings[PHASE3] = clock::now() - start;
+
+        start = clock::now();
+        host_msg.ParseFromString(phase3_wire);
+        host_side->SharedKeyAgreement(host_msg.hs_msg().phase3().pubkey());
+        fp_network::Network stream_info_msg;
+        stream_info_msg.mutable_info_msg()->set_num_video_streams(1);
+        stream_info_msg.mutable_info_msg()->set_num_audio_streams(1);
+        stream_info_msg.mutable_info_msg()->set_chunk_encryption(true);
+        viewer_msg.ParseFromString(stream_info_msg.SerializeAsString());
+        timings[AGREEMENT] = clock::now() - start;
+
+        start = clock::now();
+        std::string sealed;
+        bool authentic = host_side->SealChunks(idr_frame, CHUNK_SIZE, Crypto::ChunkId(true, 0, 0, 0), {}, sealed);
+        for (size_t offset = 0; offset < sealed.size(); offset += CHUNK_SIZE) {
+            const size_t length = std::min(CHUNK_SIZE, sealed.size() - offset);
+            authentic &= viewer_side.OpenChunk(sealed.data() + offset, length,
+                Crypto::ChunkId(true, 0, 0, static_cast<uint32_t>(offset)), {});
+        }
+        timings[FIRST_FRAME] = clock::now() - start;
+        return authentic;
+    };
+
+    auto report = [&](const char* label, const std::vector<Timings>& runs) {
+        Timings mean{}, worst{};
+        clock::duration total_max = clock::duration::zero();
+        for (const Timings& run : runs) {
+            clock::duration total = clock::duration::zero();
+            for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+                mean[phase] += run[phase];
+                worst[phase] = std::max(worst[phase], run[phase]);
+                total += run[phase];
+            }
+            total_max = std::max(total_max, total);
+        }
+        clock::duration total_mean = clock::duration::zero();
+        for (clock::duration& phase : mean) {
+            phase /= runs.size();
+            total_mean += phase;
+        }
+        LOG_INFO("handshake {}: {} runs, phase2 {:.3f} ms (max {:.3f}), phase3 {:.3f} ms, agreement {:.3f} ms, first frame {:.3f} ms",
+            label, runs.size(), ToMs(mean[PHASE2]), ToMs(worst[PHASE2]), ToMs(mean[PHASE3]), ToMs(mean[AGREEMENT]), ToMs(mean[FIRST_FRAME]));
+        LOG_INFO("handshake {}: connect to first frame {:.3f} ms mean, {:.3f} ms max", label, ToMs(total_mean), ToMs(total_max));
+    };
+
+    {
+        Measurement measurement;
+        Crypto::CachedGroup(Crypto::DH_GROUP_BITS);
+        LOG_INFO("handshake: cached {} bit group generated once in {:.1f} ms", Crypto::DH_GROUP_BITS, measurement.WallSeconds() * 1e3);
+    }
+    std::vector<Timings> runs(handshakes);
+    for (Timings& run : runs) {
+        if (!handshake(true, run)) {
+            LOG_ERROR("handshake: first frame failed authentication");
+            return 1;
+        }
+    }
+    report("cached group", runs);
+
+    runs.resize(COLD_HANDSHAKES);
+    for (Timings& run : runs) {
+        handshake(false, run);
+    }
+    report("fresh group", runs);
+    return 0;
+}
+
+// Ops per row of the suite, scaled so each row moves about the same number of bytes
+size_t SuiteOps(size_t size) {
+    constexpr size_t BYTE_BUDGET = 256 * 1024 * 1024;
+    constexpr size_t MIN_OPS = 100;
+    return std::clamp(BYTE_BUDGET / std::max<size_t>(size, 1), MIN_OPS,
+        std::max(static_cast<size_t>(Config::BenchmarkIterations), MIN_OPS));
+}
+
+void ReportSuiteRow(std::string_view name, size_t size, size_t ops, double seconds) {
+    LOG_INFO("{:<36} {:>8} B {:>12.0f} ops/sec {:>9.3f} ns/byte",
+        name, size, ops / seconds, seconds * 1e9 / (static_cast<double>(ops) * std::max<size_t>(size, 1)));
+}
+
+// Keyboard event as HostActor::EncryptAndSendDataFrame serializes and encrypts it
+fp_network::ClientDataFrameInner KeyboardMessage() {
+    fp_network::ClientDataFrameInner keyboard_msg;
+    keyboard_msg.mutable_keyboard()->set_key(0x41);
+    keyboard_msg.mutable_keyboard()->set_pressed(true);
+    return keyboard_msg;
+}
+
+// AEAD through the cached GCM contexts of a session keyed the way the handshake does, at the sizes
+// a stream actually carries and at --size
+int AeadThroughput(Crypto& host_side, Crypto& viewer_side) {
+    // Opus at 64 kbps in 20 ms frames, and HostActor's guess at P-frame size
+    const std::vector<std::pair<std::string, size_t>> frame_sizes = {
+        { "input event", KeyboardMessage().ByteSizeLong() },
+        { "audio frame", 160 },
+        { "P-frame", 20000 },
+        { "IDR", 250000 },
+        { "--size frame", static_cast<size_t>(Config::BenchmarkPayloadSize) },
+    };
+    for (const auto& [frame_name, frame_size] : frame_sizes) {
+        const std::string frame(frame_size, 'x');
+        const size_t ops = SuiteOps(frame_size);
+        std::string encrypted;
+        std::string decrypted;
+        {
+            Measurement measurement;
+            for (size_t i = 0; i < ops; i++) {
+                host_side.Encrypt(frame, encrypted);
+            }
+            ReportSuiteRow(fmt::format("Encrypt {}", frame_name), frame_size, ops, measurement.WallSeconds());
+        }
+        size_t rejected = 0;
+        {
+            Measurement measurement;
+            for (size_t i = 0; i < ops; i++) {
+                rejected += viewer_side.Decrypt(encrypted, decrypted) ? 0 : 1;
+            }
+            ReportSuiteRow(fmt::format("Decrypt {}", frame_name), frame_size, ops, measurement.WallSeconds());
+        }
+        // Includes copying the ciphertext back in before each op, it's decrypted over
+        std::string inout;
+        {
+            Measurement measurement;
+            for (size_t i = 0; i < ops; i++) {
+                inout = encrypted;
+                rejected += viewer_side.DecryptInPlace(inout) ? 0 : 1;
+            }
+            ReportSuiteRow(fmt::format("DecryptInPlace {}", frame_name), frame_size, ops, measurement.WallSeconds());
+        }
+        if (rejected > 0 || decrypted != frame || inout != frame) {
+            LOG_ERROR("crypto: {} {} frames failed to round trip", rejected, frame_name);
+            return 1;
+        }
+        encrypted[Crypto::SEQUENCE_SIZE] ^= 1;
+        inout = encrypted;
+        if (viewer_side.Decrypt(encrypted, decrypted) || viewer_side.DecryptInPlace(inout)) {
+            LOG_ERROR("crypto: tampered {} passed authentication", frame_name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int CryptoThroughput() {
+    Crypto host_side(Crypto::DH_GROUP_BITS);
+    Crypto viewer_side(host_side.P(), host_side.Q(), host_side.G());
+    host_side.SharedKeyAgreement(viewer_side.GetPublicKey());
+    viewer_side.SharedKeyAgreement(host_side.GetPublicKey());
+    return AeadThroughput(host_side, viewer_side);
+}
+
+// What a viewer costs in CPU: AEAD as in CryptoThroughput, handshake crypto,
+// and protobuf serialize/parse for every fp_network message type
+int CryptoSuite() {
+    Crypto host_side(Crypto::DH_GROUP_BITS);
+    Crypto viewer_side(host_side.P(), host_side.Q(), host_side.G());
+    host_side.SharedKeyAgreement(viewer_side.GetPublicKey());
+    viewer_side.SharedKeyAgreement(host_side.GetPublicKey());
+    if (int result = AeadThroughput(host_side, viewer_side)) {
+        return result;
+    }
+
+    {
+        constexpr size_t GROUPS = 3;
+        Measurement measurement;
+        for (size_t i = 0; i < GROUPS; i++) {
+            Crypto fresh_group(Crypto::DH_GROUP_BITS);
+        }
+        const double seconds = measurement.WallSeconds();
+        LOG_INFO("{:<36} {:>12.2f} ops/sec {:>9.3f} ms/op", "Crypto(1024)", GROUPS / seconds, seconds * 1e3 / GROUPS);
+    }
+    {
+        constexpr size_t KEY_PAIRS = 200;
+        const Crypto::Group& group = Crypto::CachedGroup(Crypto::DH_GROUP_BITS);
+        Measurement measurement;
+        for (size_t i = 0; i < KEY_PAIRS; i++) {
+            Crypto session(group);
+        }
+        const double seconds = measurement.WallSeconds();
+        LOG_INFO("{:<36} {:>12.2f} ops/sec {:>9.3f} ms/op", "Crypto(cached group)", KEY_PAIRS / seconds, seconds * 1e3 / KEY_PAIRS);
+    }
+    {
+        constexpr size_t AGREEMENTS = 200;
+        const std::string viewer_key = viewer_side.GetPublicKey();
+        Measurement measurement;
+        for (size_t i = 0; i < AGREEMENTS; i++) {
+            host_side.SharedKeyAgreement(viewer_key);
+        }
+        const double seconds = measurement.WallSeconds();
+        LOG_INFO("{:<36} {:>12.2f} ops/sec {:>9.3f} ms/op", "SharedKeyAgreement", AGREEMENTS / seconds, seconds * 1e3 / AGREEMENTS);
+    }
+
+    // One of each message as the protocol fills it in, media chunks as they'd be with inline data
+    constexpr size_t CHUNK_SIZE = 1200 - WireFormat::MEDIA_HEADER_SIZE;
+    std::vector<std::pair<std::string, fp_network::Network>> messages;
+    auto add_message = [&messages](std::string name) -> fp_network::Network& {
+        messages.emplace_back(std::move(name), fp_network::Network());
+        return messages.back().second;
+    };
+    {
+        fp_network::HSPhase1* phase1 = add_message("Handshake phase1").mutable_hs_msg()->mutable_phase1();
+        phase1->set_magic(0x46524E44504C5952ull);
+        phase1->set_token(std::string(16, 't'));
+        phase1->set_client_name("viewer");
+    }
+    {
+        fp_network::HSPhase2* phase2 = add_message("Handshake phase2").mutable_hs_msg()->mutable_phase2();
+        phase2->set_p(host_side.P());
+        phase2->set_q(host_side.Q());
+        phase2->set_g(host_side.G());
+        phase2->set_pubkey(host_side.GetPublicKey());
+    }
+    add_message("Handshake phase3").mutable_hs_msg()->mutable_phase3()->set_pubkey(viewer_side.GetPublicKey());
+    add_message("Handshake ticket").mutable_hs_msg()->mutable_ticket()->set_ticket(std::string(96, 't'));
+    add_message("Handshake resume").mutable_hs_msg()->mutable_resume()->set_resume_nonce(std::string(Crypto::RESUME_NONCE_SIZE, 'n'));
+    {
+        fp_network::Data* data = add_message("Data video chunk").mutable_data_msg();
+        data->set_sequence_number(123456);
+        data->set_needs_ack(true);
+        data->set_unordered(true);
+        data->mutable_host_frame()->set_frame_num(4000);
+        data->mutable_host_frame()->set_frame_size(20000);
+        data->mutable_host_frame()->mutable_video()->set_chunk_offset(CHUNK_SIZE * 8);
+        data->mutable_host_frame()->mutable_video()->set_data(std::string(CHUNK_SIZE, 'v'));
+        data->mutable_host_frame()->mutable_video()->set_data_size(CHUNK_SIZE);
+    }
+    {
+        fp_network::Data* data = add_message("Data audio chunk").mutable_data_msg();
+        data->set_sequence_number(123457);
+        data->set_needs_ack(true);
+        data->mutable_host_frame()->set_frame_num(8000);
+        data->mutable_host_frame()->set_frame_size(160 + Crypto::OVERHEAD);
+        data->mutable_host_frame()->mutable_audio()->set_data(std::string(160 + Crypto::OVERHEAD, 'a'));
+        data->mutable_host_frame()->mutable_audio()->set_data_size(160 + Crypto::OVERHEAD);
+    }
+    {
+        fp_network::Data* data = add_message("Data client frame").mutable_data_msg();
+        data->set_sequence_number(2000);
+        data->set_needs_ack(true);
+        data->mutable_client_frame()->set_frame_id(2000);
+        std::string encrypted_input;
+        viewer_side.Encrypt(KeyboardMessage().SerializeAsString(), encrypted_input);
+        data->mutable_client_frame()->set_encrypted_data_frame(encrypted_input);
+    }
+    add_message("Ack").mutable_ack_msg()->set_sequence_ack(123456);
+    {
+        fp_network::Heartbeat* heartbeat = add_message("Heartbeat").mutable_hb_msg();
+        heartbeat->set_timestamp(clock::now().time_since_epoch().count());
+        heartbeat->set_is_response(true);
+    }
+    {
+        fp_network::ClientStreamState* stream_state = add_message("State").mutable_state_msg()->mutable_client_stream_state();
+        stream_state->set_state(fp_network::ClientStreamState::READY_FOR_VIDEO);
+        stream_state->set_stream_num(1);
+    }
+    {
+        fp_network::StreamInfo* info = add_message("StreamInfo").mutable_info_msg();
+        info->set_num_video_streams(2);
+        info->set_num_audio_streams(1);
+        info->set_chunk_encryption(true);
+    }
+    add_message("Forward").mutable_fwd_msg()->set_sequence_number(123400);
+    {
+        fp_network::Nack* nack = add_message("Nack").mutable_nack_msg();
+        for (uint64_t seqnum = 123400; seqnum < 123416; seqnum++) {
+            nack->add_sequence_numbers(seqnum);
+        }
+    }
+    {
+        fp_network::MtuProbe* probe = add_message("MtuProbe").mutable_mtu_msg();
+        probe->set_probe_size(1472);
+        probe->set_padding(std::string(1450, '\0'));
+    }
+
+    for (const auto& [message_name, message] : messages) {
+        std::string wire;
+        message.SerializeToString(&wire);
+        const size_t ops = SuiteOps(wire.size());
+        {
+            Measurement measurement;
+            for (size_t i = 0; i < ops; i++) {
+                message.SerializeToString(&wire);
+            }
+            ReportSuiteRow(fmt::format("Serialize {}", message_name), wire.size(), ops, measurement.WallSeconds());
+        }
+        {
+            fp_network::Network parsed;
+            Measurement measurement;
+            for (size_t i = 0; i < ops; i++) {
+                parsed.ParseFromString(wire);
+            }
+            ReportSuiteRow(fmt::format("Parse {}", message_name), wire.size(), ops, measurement.WallSeconds());
+        }
+    }
+    return 0;
+}
+
+// Receive side loss handling with parity: one chunk lost per FEC group is rebuilt and never NACKed,
+// two lost from one group are. Runs on simulated time, checks rather than measures
+int FecNacks() {
+    using nack_clock = NackTracker::clock;
+    constexpr size_t CHUNK_SIZE = 1000;
+    constexpr uint32_t GROUP_SIZE = 5;
+    constexpr uint64_t FRAME_CHUNKS = 20;
+    constexpr auto RETRANSMIT_INTERVAL = std::chrono::milliseconds(20);
+    constexpr auto MESSAGE_SPACING = std::chrono::microseconds(100);
+
+    NackTracker tracker;
+    nack_clock::time_point now;
+    std::vector<uint64_t> nacked;
+    size_t recovered = 0;
+    auto take_nacks = [&]() {
+        std::vector<uint64_t> nacks = tracker.TakeNacks(now, 0, RETRANSMIT_INTERVAL);
+        nacked.insert(nacked.end(), nacks.begin(), nacks.end());
+    };
+    auto make_chunk = [](uint32_t frame_num, uint64_t chunk) {
+        fp_network::Data msg;
+        msg.mutable_host_frame()->set_frame_num(frame_num);
+        msg.mutable_host_frame()->set_frame_size(FRAME_CHUNKS * CHUNK_SIZE);
+        msg.mutable_host_frame()->mutable_video()->set_chunk_offset(chunk * CHUNK_SIZE);
+        return msg;
+    };
+    // Sends frame_num's data chunks from first_seqnum on, skipping lost, then its parity
+    auto send_frame = [&](uint32_t frame_num, uint64_t first_seqnum, const std::vector<uint64_t>& lost) {
+        for (uint64_t chunk = 0; chunk < FRAME_CHUNKS; chunk++) {
+            now += MESSAGE_SPACING;
+            if (std::find(lost.begin(), lost.end(), chunk) == lost.end()) {
+                fp_network::Data msg = make_chunk(frame_num, chunk);
+                msg.set_sequence_number(first_seqnum + chunk);
+                tracker.OnSequenced(msg, now, RETRANSMIT_INTERVAL);
+            }
+            take_nacks();
+        }
+        for (uint64_t group = 0; group * GROUP_SIZE < FRAME_CHUNKS; group++) {
+            now += MESSAGE_SPACING;
+            fp_network::Data parity = make_chunk(frame_num, group * GROUP_SIZE);
+            parity.mutable_host_frame()->mutable_video()->set_fec_group_size(GROUP_SIZE);
+            parity.mutable_host_frame()->mutable_video()->set_first_sequence_number(first_seqnum);
+            if (tracker.OnParity(parity, CHUNK_SIZE, now)) {
+                recovered++;
+            }
+            take_nacks();
+        }
+    };
+
+    // Parity seen recently is what makes gaps wait for it
+    send_frame(0, 0, {});
+    // One lost per group, the first and last chunk of the frame among them
+    send_frame(1, FRAME_CHUNKS, { 0, 6, 12, 19 });
+    // Group 0 can't be rebuilt
+    send_frame(2, 2 * FRAME_CHUNKS, { 1, 2 });
+    fp_network::Data next_frame = make_chunk(3, 0);
+    next_frame.set_sequence_number(3 * FRAME_CHUNKS);
+    tracker.OnSequenced(next_frame, now, RETRANSMIT_INTERVAL);
+    for (int i = 0; i < 100; i++) {
+        now += RETRANSMIT_INTERVAL;
+        take_nacks();
+    }
+
+    std::sort(nacked.begin(), nacked.end());
+    nacked.erase(std::unique(nacked.begin(), nacked.end()), nacked.end());
+    const std::vector<uint64_t> expected_nacks = { 2 * FRAME_CHUNKS + 1, 2 * FRAME_CHUNKS + 2 };
+    LOG_INFO("fec: {} chunks rebuilt from parity, {} sequence numbers NACKed", recovered, nacked.size());
+    if (recovered != 4 || nacked != expected_nacks) {
+        LOG_ERROR("fec: expected 4 chunks rebuilt and only {} and {} NACKed", expected_nacks[0], expected_nacks[1]);
+        return 1;
+    }
+    return 0;
+}
+
+// 20 ms frames through the whole audio path without a sound card: the synthetic backend's tone or WAV,
+// resampled and Opus encoded like AudioEncodeActor, then decoded and resampled into the null sink
+// AudioDevice/AudioStreamer keep the WASAPI parts behind _WIN32, but only the Windows binary has a
+// bench subcommand, so there's no headless Linux target to run this from yet
+int AudioPipeline() {
+    constexpr size_t MAX_FRAMES = 5000;
+    const size_t frames = std::min(static_cast<size_t>(Config::BenchmarkIterations), MAX_FRAMES);
+
+    AudioStreamer capture_side(AudioDevice::Backend::SYNTHETIC);
+    AudioStreamer playback_side(AudioDevice::Backend::NULL_SINK);
+    if (!capture_side.InitEncoder(AudioStreamer::ENCODED_SAMPLE_RATE) || !playback_side.InitDecoder()) {
+        LOG_ERROR("audio: failed to set up the synthetic pipeline");
+        return 1;
+    }
+
+    std::string raw_frame;
+    std::string encoded_frame;
+    std::string decoded_frame;
+    clock::duration capture_time = clock::duration::zero();
+    clock::duration encode_time = clock::duration::zero();
+    clock::duration decode_time = clock::duration::zero();
+    clock::duration play_time = clock::duration::zero();
+    size_t encoded_bytes = 0;
+    for (size_t i = 0; i < frames; i++) {
+        const clock::time_point start = clock::now();
+        capture_side.CaptureAudio(raw_frame);
+        const clock::time_point captured = clock::now();
+        if (!capture_side.EncodeAudio(raw_frame, encoded_frame)) {
+            return 1;
+        }
+        const clock::time_point encoded = clock::now();
+        if (!playback_side.DecodeAudio(encoded_frame, decoded_frame)) {
+            return 1;
+        }
+        const clock::time_point decoded = clock::now();
+        playback_side.PlayAudio(decoded_frame);
+        const clock::time_point played = clock::now();
+
+        capture_time += captured - start;
+        encode_time += encoded - captured;
+        decode_time += decoded - encoded;
+        play_time += played - decoded;
+        encoded_bytes += encoded_frame.size();
+    }
+
+    auto per_frame_us = [frames](clock::duration total) {
+        return std::chrono::duration<double, std::micro>(total).count() / frames;
+    };
+    const double total_us = per_frame_us(capture_time + encode_time + decode_time + play_time);
+    LOG_INFO("audio: {} frames of {} ms, {:.0f} bytes/frame encoded", frames,
+        1000 * AudioStreamer::OPUS_FRAME_SIZE / AudioStreamer::ENCODED_SAMPLE_RATE, static_cast<double>(encoded_bytes) / frames);
+    LOG_INFO("audio capture {:.1f} us/frame, encode {:.1f} us/frame, decode {:.1f} us/frame, play {:.1f} us/frame",
+        per_frame_us(capture_time), per_frame_us(encode_time), per_frame_us(decode_time), per_frame_us(play_time));
+    LOG_INFO("audio total {:.1f} us/frame, {:.0f}x realtime", total_us,
+        1e6 * AudioStreamer::OPUS_FRAME_SIZE / AudioStreamer::ENCODED_SAMPLE_RATE / total_us);
+    return 0;
+}
+
+}
+
+namespace Benchmark {
+
+int Run(const std::string& name) {
+    static const std::map<std::string, int(*)()> benchmarks = {
+        { "udp", &UdpLoopback },
+        { "crypto", &CryptoThroughput },
+        { "crypto-clients", &CryptoClients },
+        { "handshake", &HandshakeLatency },
+        { "suite", &CryptoSuite },
+        { "audio", &AudioPipeline },
+        { "fec", &FecNacks },
+    };
+    auto it = benchmarks.find(name);
+    if (it == benchmarks.end()) {
+        LOG_ERROR("Unknown benchmark {}", name);
+        return 1;
+    }
+    return it->second();
+}
+
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Microbenchmarks run from the bench subcommand, results are logged
+namespace Benchmark {
+    // Returns the process exit code
+    int Run(const std::string& name);
+}
@@ -14,12 +14,34 @@ namespace Config {
 	std::vector<int> MonitorIndecies;
 	bool EnableTracing;
 	bool SaveControllers;
+	bool EnableFEC;
+	bool ChunkEncryption;
+	bool BroadcastEncryption;
+	int SocketShards;
+	std::string NetworkBackend;
+	std::string AudioBackend;
+	std::string AudioWavFile;
+	int AudioSampleRate;
+	int AudioChannels;
+	std::string BenchmarkName;
+	int BenchmarkIterations;
+	int BenchmarkPayloadSize;
+	int BenchmarkClients;
 
 	int LoadConfig(int argc, char** argv) {
 		Port = 40040;
 		AverageBitrate = 2000000;
 		EnableTracing = false;
 		SaveControllers = false;
+		EnableFEC = false;
+		ChunkEncryption = false;
+		BroadcastEncryption = false;
+		SocketShards = 1;
+		AudioSampleRate = 48000;
+		AudioChannels = 2;
+		BenchmarkIterations = 200000;
+		BenchmarkPayloadSize = 1200;
+		BenchmarkClients = 16;
 		HolepuncherIP = "198.199.81.165";
 		
 		CLI::App parser{ "FriendPlayer" };
@@ -28,6 +50,13 @@ namespace Config {
 		bitrate_validator.description("(b, kb, mb)");
 
 		parser.add_flag("--trace,-T", EnableTracing, "Enable trace logging");
+		parser.add_option("--net-backend", NetworkBackend, "Socket send/receive backend (asio, mmsg, io_uring), defaults to the fastest available");
+		parser.add_option("--audio-backend", AudioBackend, "Audio capture/playback backend (wasapi, synthetic, null), defaults to wasapi where available");
+		parser.add_option("--audio-wav", AudioWavFile, "WAV file the synthetic audio backend loops instead of a tone");
+		parser.add_option("--audio-rate", AudioSampleRate, "Sample rate of the synthetic audio backend's tone")
+			->default_str("48000");
+		parser.add_option("--audio-channels", AudioChannels, "Channel count of the synthetic audio backend's tone")
+			->default_str("2");
 
 		CLI::App* host = parser.add_subcommand("host", "Host the FriendPlayer session using a holepunching server");
 		CLI::Option* punch_opt = host->add_option("--ip,-i", HolepuncherIP, "IP to connect to for hole-punching")
@@ -44,6 +73,12 @@ namespace Config {
 			->default_str("0");
 		host->add_flag("--save-controllers,-s", SaveControllers, "Reuse controllers after disconnections")
 			->default_str("false");
+		host->add_flag("--fec,-f", EnableFEC, "Send parity chunks so lost video chunks can be recovered without retransmits")
+			->default_str("false");
+		host->add_flag("--chunk-encryption", ChunkEncryption, "Seal each media chunk separately so viewers decrypt chunks as they arrive")
+			->default_str("false");
+		host->add_flag("--broadcast", BroadcastEncryption, "Encrypt each frame once under a per stream group key shared with every viewer, rotated when one leaves")
+			->default_str("false");
 		
 
 		CLI::App* host_direct = parser.add_subcommand("dhost", "Host the FriendPlayer session in direct connection mode");
@@ -56,6 +91,15 @@ namespace Config {
 			->default_str("0");
 		host_direct->add_flag("--save-controllers,-s", SaveControllers, "Reuse controllers after disconnections")
 			->default_str("false");
+		host_direct->add_flag("--fec,-f", EnableFEC, "Send parity chunks so lost video chunks can be recovered without retransmits")
+			->default_str("false");
+		host_direct->add_flag("--chunk-encryption", ChunkEncryption, "Seal each media chunk separately so viewers decrypt chunks as they arrive")
+			->default_str("false");
+		host_direct->add_flag("--broadcast", BroadcastEncryption, "Encrypt each frame once under a per stream group key shared with every viewer, rotated when one leaves")
+			->default_str("false");
+		host_direct->add_option("--shards", SocketShards, "Number of sockets sharing the port with SO_REUSEPORT, each with its own network thread")
+			->default_str("1")
+			->check(CLI::Range(1, 64));
 		
 		CLI::App* client = parser.add_subcommand("client", "Connect to a FriendPlayer session using server");
 		punch_opt = client->add_option("--ip,-i", HolepuncherIP, "IP to connect to for hole-punching")
@@ -75,6 +119,16 @@ namespace Config {
 		client_direct->add_option("--ip,-i", ServerIP, "IP to directly connect to")
 			->excludes(punch_opt);
 
+		CLI::App* bench = parser.add_subcommand("bench", "Run a microbenchmark and print the results");
+		bench->add_option("name", BenchmarkName, "Benchmark to run (udp, crypto, crypto-clients, handshake, suite, audio, fec)")
+			->required(true);
+		bench->add_option("--iterations,-n", BenchmarkIterations, "Packets or operations per run")
+			->default_str("200000");
+		bench->add_option("--size,-s", BenchmarkPayloadSize, "Payload size in bytes")
+			->default_str("1200");
+		bench->add_option("--clients,-c", BenchmarkClients, "Viewers encrypting at once")
+			->default_str("16");
+
 		parser.require_subcommand(1);
 
 		CLI11_PARSE(parser, argc, argv);
@@ -13,6 +13,23 @@ namespace Config {
 	extern std::vector<int> MonitorIndecies;
 	extern bool EnableTracing;
 	extern bool SaveControllers;
+	extern bool EnableFEC;
+	extern bool ChunkEncryption;
+	// --broadcast: every viewer holds the same group keys, so any of them can read (and, with a spoofed
+	// source address, forge) what the others receive. Keys rotate when a viewer leaves or is kicked,
+	// which only protects frames sent after that
+	extern bool BroadcastEncryption;
+	extern int SocketShards;
+
+	extern std::string NetworkBackend;
+	extern std::string AudioBackend;
+	extern std::string AudioWavFile;
+	extern int AudioSampleRate;
+	extern int AudioChannels;
+	extern std::string BenchmarkName;
+	extern int BenchmarkIterations;
+	extern int BenchmarkPayloadSize;
+	extern int BenchmarkClients;
 	
 	extern std::string HolepuncherIP;
 	extern std::string Identifier;
@@ -0,0 +1,112 @@
+#include "common/CongestionController.h"
+
+#include "common/Log.h"
+
+#include <algorithm>
+#include <cmath>
+
+CongestionController::CongestionController(uint32_t max_bitrate)
+    : max_bitrate(max_bitrate),
+      target_bitrate(max_bitrate),
+      published_bitrate(max_bitrate),
+      last_update(clock::now()),
+      bytes_sent(0),
+      bytes_acked(0),
+      packets_acked(0),
+      packets_lost(0),
+      intervals_without_ack(0),
+      loss_rate(0),
+      smoothed_rtt(clock::duration::zero()),
+      min_rtt(clock::duration::max()),
+      window_min_rtt(clock::duration::max()),
+      min_rtt_window_start(clock::now()),
+      last_queueing_delay(clock::duration::zero()) {}
+
+void CongestionController::SetMaxBitrate(uint32_t new_max_bitrate) {
+    max_bitrate = std::max(new_max_bitrate, MIN_BITRATE);
+    target_bitrate = std::min(target_bitrate, static_cast<double>(max_bitrate));
+    published_bitrate = std::min(published_bitrate, max_bitrate);
+}
+
+void CongestionController::OnPacketSent(size_t bytes) {
+    bytes_sent += bytes;
+}
+
+void CongestionController::OnPacketAcked(size_t bytes, std::optional<clock::duration> rtt_sample) {
+    bytes_acked += bytes;
+    packets_acked++;
+    if (!rtt_sample) {
+        return;
+    }
+    if (smoothed_rtt == clock::duration::zero()) {
+        smoothed_rtt = *rtt_sample;
+    } else {
+        smoothed_rtt = (smoothed_rtt * 7 + *rtt_sample) / 8;
+    }
+    window_min_rtt = std::min(window_min_rtt, *rtt_sample);
+    min_rtt = std::min(min_rtt, *rtt_sample);
+}
+
+void CongestionController::OnPacketsLost(size_t count) {
+    packets_lost += count;
+}
+
+bool CongestionController::Update(clock::time_point now) {
+    if (now < last_update + UPDATE_INTERVAL) {
+        return false;
+    }
+    const double interval_seconds = std::chrono::duration<double>(now - last_update).count();
+
+    // Let the base RTT follow route changes instead of holding onto an old minimum forever
+    if (now > min_rtt_window_start + MIN_RTT_WINDOW && window_min_rtt != clock::duration::max()) {
+        min_rtt = window_min_rtt;
+        window_min_rtt = clock::duration::max();
+        min_rtt_window_start = now;
+    }
+
+    if (packets_acked + packets_lost > 0) {
+        const double interval_loss = static_cast<double>(packets_lost) / (packets_acked + packets_lost);
+        loss_rate = loss_rate * (1 - LOSS_SMOOTHING) + interval_loss * LOSS_SMOOTHING;
+    }
+    if (bytes_sent > 0 && bytes_acked == 0) {
+        intervals_without_ack++;
+    } else {
+        intervals_without_ack = 0;
+    }
+
+    const double delivery_rate = bytes_acked * 8 / interval_seconds;
+    clock::duration queueing_delay = clock::duration::zero();
+    if (min_rtt != clock::duration::max()) {
+        queueing_delay = smoothed_rtt - min_rtt;
+    }
+
+    if (intervals_without_ack >= STALLED_INTERVALS) {
+        // Nothing is getting through at all
+        target_bitrate /= 2;
+    } else if (loss_rate > HIGH_LOSS_RATE) {
+        target_bitrate *= 1 - loss_rate / 2;
+    } else if (queueing_delay > DELAY_THRESHOLD && queueing_delay >= last_queueing_delay) {
+        // Queues are building, back off below what is actually being delivered
+        target_bitrate = std::min(target_bitrate, DELAY_BACKOFF * delivery_rate);
+    } else if (loss_rate < LOW_LOSS_RATE && queueing_delay < DELAY_THRESHOLD / 2) {
+        target_bitrate *= INCREASE_FACTOR;
+    }
+    target_bitrate = std::clamp(target_bitrate, static_cast<double>(MIN_BITRATE), static_cast<double>(max_bitrate));
+
+    last_queueing_delay = queueing_delay;
+    last_update = now;
+    bytes_sent = 0;
+    bytes_acked = 0;
+    packets_acked = 0;
+    packets_lost = 0;
+
+    const double change = std::abs(target_bitrate - published_bitrate) / published_bitrate;
+    const bool at_limit = target_bitrate == max_bitrate || target_bitrate == MIN_BITRATE;
+    if (change > PUBLISH_THRESHOLD || (at_limit && change > 0)) {
+        LOG_TRACE("Target bitrate {} -> {}, loss={}, queueing delay={}ms", published_bitrate, static_cast<uint32_t>(target_bitrate),
+            loss_rate, std::chrono::duration_cast<std::chrono::milliseconds>(queueing_delay).count());
+        published_bitrate = static_cast<uint32_t>(target_bitrate);
+        return true;
+    }
+    return false;
+}
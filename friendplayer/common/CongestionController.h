@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <stdint.h>
+
+// Delay and loss based send rate estimate, fed from ProtocolActor's acks and NACKs
+class CongestionController {
+public:
+    using clock = std::chrono::system_clock;
+
+    static constexpr std::chrono::milliseconds UPDATE_INTERVAL{200};
+    static constexpr std::chrono::seconds MIN_RTT_WINDOW{10};
+    // Queueing delay on top of the path's base RTT before we consider the link overused
+    static constexpr std::chrono::milliseconds DELAY_THRESHOLD{40};
+    static constexpr uint32_t MIN_BITRATE = 200000;
+    static constexpr double HIGH_LOSS_RATE = 0.10;
+    static constexpr double LOW_LOSS_RATE = 0.02;
+    static constexpr double LOSS_SMOOTHING = 0.25;
+    static constexpr double DELAY_BACKOFF = 0.85;
+    static constexpr double INCREASE_FACTOR = 1.05;
+    // Target has to move this much before it is worth reconfiguring encoders
+    static constexpr double PUBLISH_THRESHOLD = 0.05;
+    static constexpr int STALLED_INTERVALS = 2;
+
+    CongestionController(uint32_t max_bitrate);
+
+    void SetMaxBitrate(uint32_t max_bitrate);
+
+    void OnPacketSent(size_t bytes);
+    // rtt_sample should be empty for retransmitted packets
+    void OnPacketAcked(size_t bytes, std::optional<clock::duration> rtt_sample);
+    void OnPacketsLost(size_t count);
+
+    // Returns true when the target bitrate has changed enough to publish
+    bool Update(clock::time_point now);
+
+    uint32_t GetTargetBitrate() const { return published_bitrate; }
+    double GetLossRate() const { return loss_rate; }
+    clock::duration GetSmoothedRTT() const { return smoothed_rtt; }
+
+private:
+    uint32_t max_bitrate;
+    double target_bitrate;
+    uint32_t published_bitrate;
+
+    clock::time_point last_update;
+
+    // Counters for the current update interval
+    size_t bytes_sent;
+    size_t bytes_acked;
+    size_t packets_acked;
+    size_t packets_lost;
+    int intervals_without_ack;
+
+    double loss_rate;
+    clock::duration smoothed_rtt;
+    clock::duration min_rtt;
+    clock::duration window_min_rtt;
+    clock::time_point min_rtt_window_start;
+    clock::duration last_queueing_delay;
+};
@@ -1,35 +1,89 @@
 #include "Crypto.h"
-#include <cryptopp\aes.h>
-#include <cryptopp\gcm.h>
+#include "CryptoPool.h"
 #include <cryptopp\nbtheory.h>
 #include <cryptopp\dh.h>
+#include <cryptopp\misc.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace {
+void PutSequence(uint64_t sequence, CryptoPP::byte* out) {
+    for (int i = static_cast<int>(Crypto::SEQUENCE_SIZE) - 1; i >= 0; i--) {
+        out[i] = static_cast<CryptoPP::byte>(sequence);
+        sequence >>= 8;
+    }
+}
+
+uint64_t GetSequence(const CryptoPP::byte* in) {
+    uint64_t sequence = 0;
+    for (size_t i = 0; i < Crypto::SEQUENCE_SIZE; i++) {
+        sequence = (sequence << 8) | in[i];
+    }
+    return sequence;
+}
+
+// Tickets only need to outlive a connection blip, so they die with the host process
+const CryptoPP::SecByteBlock& TicketKey() {
+    static const CryptoPP::SecByteBlock key = []() {
+        CryptoPP::AutoSeededRandomPool rng;
+        CryptoPP::SecByteBlock new_key(CryptoPP::AES::DEFAULT_KEYLENGTH);
+        rng.GenerateBlock(new_key, new_key.size());
+        return new_key;
+    }();
+    return key;
+}
+}
 
 /**
  *  @int gen_bit_value: creates a l-bit value to generate a prime p.
  *  Generates public info: p, q, and g 
- *  creates a public private key pair with diffie-hellman
  * */
-Crypto::Crypto(int gen_bit_value) {
+Crypto::Group Crypto::GenerateGroup(int gen_bit_value) {
+    CryptoPP::AutoSeededRandomPool rng;
     CryptoPP::PrimeAndGenerator gen;
     gen.Generate(1, rng, gen_bit_value, 160);
-    
-    p = gen.Prime();
-    q = gen.SubPrime();
-    g = gen.Generator();
-    
-    CryptoPP::DH dh;
-    dh.AccessGroupParameters().Initialize(p, q, g);
+    return Group{gen.Prime(), gen.SubPrime(), gen.Generator()};
+}
 
-    private_key = CryptoPP::SecByteBlock(dh.PrivateKeyLength());
-    public_key = CryptoPP::SecByteBlock(dh.PublicKeyLength());
+const Crypto::Group& Crypto::CachedGroup(int gen_bit_value) {
+    static std::mutex groups_m;
+    static std::map<int, Group> groups;
 
-    dh.GenerateKeyPair(rng, private_key, public_key);
+    std::lock_guard<std::mutex> lock(groups_m);
+    auto it = groups.find(gen_bit_value);
+    if (it == groups.end()) {
+        it = groups.emplace(gen_bit_value, GenerateGroup(gen_bit_value)).first;
+    }
+    return it->second;
+}
+
+/**
+ *  Creates a public private key pair with diffie-hellman in a fresh group
+ * */
+Crypto::Crypto(int gen_bit_value)
+    : Crypto(GenerateGroup(gen_bit_value)) {}
+
+Crypto::Crypto(const Group& group)
+    : p(group.p),
+      q(group.q),
+      g(group.g),
+      created_group(true),
+      encrypt_sequence(0) {
+    GenerateKeyPair();
 }
 
 Crypto::Crypto(const std::string& p_byte, const std::string& q_byte, const std::string& g_byte)
     : p(reinterpret_cast<const CryptoPP::byte*>(p_byte.data()), p_byte.size()),
       q(reinterpret_cast<const CryptoPP::byte*>(q_byte.data()), q_byte.size()),
-      g(reinterpret_cast<const CryptoPP::byte*>(g_byte.data()), g_byte.size()) {
+      g(reinterpret_cast<const CryptoPP::byte*>(g_byte.data()), g_byte.size()),
+      created_group(false),
+      encrypt_sequence(0) {
+    GenerateKeyPair();
+}
+
+void Crypto::GenerateKeyPair() {
     CryptoPP::DH dh;
     dh.AccessGroupParameters().Initialize(p, q, g);
 
@@ -48,62 +102,271 @@ void Crypto::SharedKeyAgreement(const std::string& other_pub_key) {
 
     shared_key = CryptoPP::SecByteBlock(dh.AgreedValueLength());
     dh.Agree(shared_key, private_key, reinterpret_cast<const CryptoPP::byte*>(other_pub_key.data()));
+    DeriveSessionKeys(shared_key, shared_key.size());
+}
+
+std::unique_ptr<Crypto> Crypto::Resume(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce, bool created_group) {
+    std::unique_ptr<Crypto> resumed(new Crypto(created_group));
+    const std::string master = resumption_secret + client_nonce + host_nonce;
+    resumed->DeriveSessionKeys(reinterpret_cast<const CryptoPP::byte*>(master.data()), master.size());
+    return resumed;
+}
+
+std::unique_ptr<Crypto> Crypto::FromGroupKey(const std::string& group_key, bool sender) {
+    std::unique_ptr<Crypto> group(new Crypto(sender));
+    group->DeriveSessionKeys(reinterpret_cast<const CryptoPP::byte*>(group_key.data()), group_key.size());
+    return group;
+}
+
+Crypto::Crypto(bool created_group)
+    : created_group(created_group),
+      encrypt_sequence(0) {}
+
+std::string Crypto::ResumptionSecret() const {
+    return std::string(reinterpret_cast<const char*>(resumption_secret.data()), resumption_secret.size());
+}
 
-    // Faster way of getting keys
+std::string Crypto::ResumeProof(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce) {
+    CryptoPP::HMAC<CryptoPP::SHA256> hmac(reinterpret_cast<const CryptoPP::byte*>(resumption_secret.data()),
+        resumption_secret.size());
+    hmac.Update(reinterpret_cast<const CryptoPP::byte*>(client_nonce.data()), client_nonce.size());
+    hmac.Update(reinterpret_cast<const CryptoPP::byte*>(host_nonce.data()), host_nonce.size());
+    std::string proof(CryptoPP::HMAC<CryptoPP::SHA256>::DIGESTSIZE, '\0');
+    hmac.Final(reinterpret_cast<CryptoPP::byte*>(proof.data()));
+    return proof;
+}
+
+bool Crypto::VerifyResumeProof(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce, const std::string& proof) {
+    const std::string expected = ResumeProof(resumption_secret, client_nonce, host_nonce);
+    return proof.size() == expected.size()
+        && CryptoPP::VerifyBufsEqual(reinterpret_cast<const CryptoPP::byte*>(proof.data()),
+            reinterpret_cast<const CryptoPP::byte*>(expected.data()), expected.size());
+}
+
+void Crypto::DeriveSessionKeys(const CryptoPP::byte* master, size_t master_size) {
+    // Faster way of getting keys, the rest of the digest salts the nonces
     CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
     CryptoPP::SHA256 hash;
-    hash.CalculateDigest(digest, shared_key, shared_key.size());
-    int L_128 = CryptoPP::SHA256::DIGESTSIZE / 2;
-    CryptoPP::SecByteBlock key(digest, L_128);
-    password = key;
+    hash.CalculateDigest(digest, master, master_size);
+    password = CryptoPP::SecByteBlock(digest, KEY_SIZE);
+    const CryptoPP::byte* group_salt = digest + KEY_SIZE;
+    const CryptoPP::byte* peer_salt = group_salt + SALT_SIZE;
+    encrypt_salt = CryptoPP::SecByteBlock(created_group ? group_salt : peer_salt, SALT_SIZE);
+    decrypt_salt = CryptoPP::SecByteBlock(created_group ? peer_salt : group_salt, SALT_SIZE);
+    encrypt_sequence = 0;
+    segment_encryptions.clear();
+
+    // AES key schedule and GHASH tables are built here, once per session
+    CryptoPP::byte nonce[NONCE_SIZE];
+    MakeNonce(encrypt_salt, 0, nonce);
+    gcm_encryption.SetKeyWithIV(password, password.size(), nonce, NONCE_SIZE);
+    MakeNonce(decrypt_salt, 0, nonce);
+    gcm_decryption.SetKeyWithIV(password, password.size(), nonce, NONCE_SIZE);
+
+    // Hashed apart from the session key so a resumed session shares nothing with this one
+    static constexpr char RESUMPTION_LABEL[] = "fp resumption";
+    resumption_secret = CryptoPP::SecByteBlock(CryptoPP::SHA256::DIGESTSIZE);
+    hash.Update(master, master_size);
+    hash.Update(reinterpret_cast<const CryptoPP::byte*>(RESUMPTION_LABEL), sizeof(RESUMPTION_LABEL) - 1);
+    hash.Final(resumption_secret);
+}
+
+std::string Crypto::RandomBytes(size_t size) {
+    CryptoPP::AutoSeededRandomPool rng;
+    std::string bytes(size, '\0');
+    rng.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(bytes.data()), bytes.size());
+    return bytes;
+}
+
+uint64_t Crypto::SealedSequence(std::string_view sealed) {
+    return GetSequence(reinterpret_cast<const CryptoPP::byte*>(sealed.data()));
 }
 
 /**
-* Give out 32 more bytes to use for iv
+* Ticket layout: random 12 byte nonce, ciphertext, 16 byte tag. Tickets are rare enough to key a context each
 * */
-void Crypto::Encrypt(const std::string& in, std::string& out) {
-    int L_128 = CryptoPP::SHA256::DIGESTSIZE / 2;
-    
-    out.resize(in.size() + L_128);
-    CryptoPP::SecByteBlock iv(L_128);
-    rng.GenerateBlock(iv, L_128);
-    
-    CryptoPP::SecByteBlock key(password, L_128);
-    CryptoPP::GCM<CryptoPP::AES>::Encryption gcm_encryption;
-
-    gcm_encryption.SetKeyWithIV(key, key.size(), iv);
-    std::copy(iv.begin(), iv.end(), out.data());
-
-    gcm_encryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(out.data()) + L_128,
-        reinterpret_cast<const CryptoPP::byte*>(in.data()), in.size());
-}
-
-void Crypto::Decrypt(const std::string& in, std::string& out) {
-    int L_128 = CryptoPP::SHA256::DIGESTSIZE / 2;
-
-    // Take out vector from data
-    CryptoPP::SecByteBlock iv(reinterpret_cast<const CryptoPP::byte*>(in.data()), L_128);
-    CryptoPP::SecByteBlock key(password, L_128);
-    CryptoPP::GCM<CryptoPP::AES>::Decryption gcm_decryption;
-    
-    out.resize(in.size() - L_128);
-    gcm_decryption.SetKeyWithIV(key, key.size(), iv);
-    gcm_decryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(out.data()), 
-        reinterpret_cast<const CryptoPP::byte*>(in.data()) + L_128, in.size() - L_128);
-}
-
-void Crypto::DecryptInPlace(std::string& inout) {
-    int L_128 = CryptoPP::SHA256::DIGESTSIZE / 2;
-
-    // Take out vector from data
-    CryptoPP::SecByteBlock iv(reinterpret_cast<const CryptoPP::byte*>(inout.data()), L_128);
-    CryptoPP::SecByteBlock key(password, L_128);
-    CryptoPP::GCM<CryptoPP::AES>::Decryption gcm_decryption;
-
-    gcm_decryption.SetKeyWithIV(key, key.size(), iv);
-    gcm_decryption.ProcessData(reinterpret_cast<CryptoPP::byte*>(inout.data()), 
-        reinterpret_cast<const CryptoPP::byte*>(inout.data()) + L_128, inout.size() - L_128);
-    inout.resize(inout.size() - L_128);
+std::string Crypto::SealTicket(const std::string& ticket) {
+    const std::string nonce = RandomBytes(NONCE_SIZE);
+    std::string sealed = nonce;
+    sealed.resize(NONCE_SIZE + ticket.size() + TAG_SIZE);
+    CryptoPP::byte* sealed_bytes = reinterpret_cast<CryptoPP::byte*>(sealed.data());
+
+    const CryptoPP::SecByteBlock& key = TicketKey();
+    CryptoPP::GCM<CryptoPP::AES>::Encryption encryption;
+    encryption.SetKeyWithIV(key, key.size(), sealed_bytes, NONCE_SIZE);
+    encryption.EncryptAndAuthenticate(sealed_bytes + NONCE_SIZE, sealed_bytes + NONCE_SIZE + ticket.size(), TAG_SIZE,
+        sealed_bytes, NONCE_SIZE, nullptr, 0,
+        reinterpret_cast<const CryptoPP::byte*>(ticket.data()), ticket.size());
+    return sealed;
+}
+
+bool Crypto::OpenTicket(const std::string& sealed, std::string& ticket) {
+    if (sealed.size() < NONCE_SIZE + TAG_SIZE) {
+        return false;
+    }
+    const CryptoPP::byte* sealed_bytes = reinterpret_cast<const CryptoPP::byte*>(sealed.data());
+    ticket.resize(sealed.size() - NONCE_SIZE - TAG_SIZE);
+
+    const CryptoPP::SecByteBlock& key = TicketKey();
+    CryptoPP::GCM<CryptoPP::AES>::Decryption decryption;
+    decryption.SetKeyWithIV(key, key.size(), sealed_bytes, NONCE_SIZE);
+    return decryption.DecryptAndVerify(reinterpret_cast<CryptoPP::byte*>(ticket.data()),
+        sealed_bytes + NONCE_SIZE + ticket.size(), TAG_SIZE,
+        sealed_bytes, NONCE_SIZE, nullptr, 0,
+        sealed_bytes + NONCE_SIZE, ticket.size());
+}
+
+void Crypto::MakeNonce(const CryptoPP::SecByteBlock& salt, uint64_t sequence, CryptoPP::byte* nonce) {
+    std::copy(salt.begin(), salt.end(), nonce);
+    PutSequence(sequence, nonce + SALT_SIZE);
+}
+
+/**
+* Sealed layout: 8 byte sequence the receiver rebuilds the nonce from, ciphertext, 16 byte tag
+* */
+void Crypto::SealTo(const char* plaintext, size_t plaintext_size, char* out, std::string_view associated_data) {
+    CryptoPP::byte* out_bytes = reinterpret_cast<CryptoPP::byte*>(out);
+    const uint64_t sequence = encrypt_sequence++;
+    PutSequence(sequence, out_bytes);
+
+    CryptoPP::byte nonce[NONCE_SIZE];
+    MakeNonce(encrypt_salt, sequence, nonce);
+    gcm_encryption.EncryptAndAuthenticate(out_bytes + SEQUENCE_SIZE, out_bytes + SEQUENCE_SIZE + plaintext_size, TAG_SIZE,
+        nonce, NONCE_SIZE,
+        reinterpret_cast<const CryptoPP::byte*>(associated_data.data()), associated_data.size(),
+        reinterpret_cast<const CryptoPP::byte*>(plaintext), plaintext_size);
+}
+
+bool Crypto::OpenTo(const char* sealed, size_t sealed_size, char* out, std::string_view associated_data) {
+    if (sealed_size < OVERHEAD) {
+        return false;
+    }
+    const CryptoPP::byte* sealed_bytes = reinterpret_cast<const CryptoPP::byte*>(sealed);
+    const size_t ciphertext_size = sealed_size - OVERHEAD;
+
+    CryptoPP::byte nonce[NONCE_SIZE];
+    MakeNonce(decrypt_salt, GetSequence(sealed_bytes), nonce);
+    return gcm_decryption.DecryptAndVerify(reinterpret_cast<CryptoPP::byte*>(out),
+        sealed_bytes + SEQUENCE_SIZE + ciphertext_size, TAG_SIZE,
+        nonce, NONCE_SIZE,
+        reinterpret_cast<const CryptoPP::byte*>(associated_data.data()), associated_data.size(),
+        sealed_bytes + SEQUENCE_SIZE, ciphertext_size);
+}
+
+void Crypto::Seal(char* buffer, size_t plaintext_size, std::string_view associated_data) {
+    SealTo(buffer + SEQUENCE_SIZE, plaintext_size, buffer, associated_data);
+}
+
+bool Crypto::Open(char* buffer, size_t sealed_size, std::string_view associated_data) {
+    return OpenTo(buffer, sealed_size, buffer + SEQUENCE_SIZE, associated_data);
+}
+
+void Crypto::Encrypt(const std::string& in, std::string& out, std::string_view associated_data) {
+    out.resize(in.size() + OVERHEAD);
+    SealTo(in.data(), in.size(), out.data(), associated_data);
+}
+
+bool Crypto::Decrypt(const std::string& in, std::string& out, std::string_view associated_data) {
+    if (in.size() < OVERHEAD) {
+        out.clear();
+        return false;
+    }
+    out.resize(in.size() - OVERHEAD);
+    return OpenTo(in.data(), in.size(), out.data(), associated_data);
+}
+
+bool Crypto::DecryptInPlace(std::string& inout, std::string_view associated_data) {
+    if (inout.size() < OVERHEAD) {
+        inout.clear();
+        return false;
+    }
+    // GCM only decrypts over its own input or into a separate buffer, so the plaintext is moved
+    // over the sequence afterwards
+    const bool authentic = Open(inout.data(), inout.size(), associated_data);
+    inout.resize(inout.size() - TAG_SIZE);
+    inout.erase(0, SEQUENCE_SIZE);
+    return authentic;
+}
+
+void Crypto::SealChunkWith(CryptoPP::GCM<CryptoPP::AES>::Encryption& encryption, const CryptoPP::SecByteBlock& salt,
+        char* buffer, size_t plaintext_size, uint64_t chunk_id, std::string_view associated_data) {
+    CryptoPP::byte* bytes = reinterpret_cast<CryptoPP::byte*>(buffer);
+    CryptoPP::byte nonce[NONCE_SIZE];
+    MakeNonce(salt, chunk_id, nonce);
+    encryption.EncryptAndAuthenticate(bytes, bytes + plaintext_size, TAG_SIZE,
+        nonce, NONCE_SIZE,
+        reinterpret_cast<const CryptoPP::byte*>(associated_data.data()), associated_data.size(),
+        bytes, plaintext_size);
+}
+
+void Crypto::SealChunk(char* buffer, size_t plaintext_size, uint64_t chunk_id, std::string_view associated_data) {
+    SealChunkWith(gcm_encryption, encrypt_salt, buffer, plaintext_size, chunk_id, associated_data);
+}
+
+bool Crypto::SealChunks(std::string_view plaintext, size_t chunk_size, uint64_t first_chunk_id,
+        std::string_view associated_data, std::string& out) {
+    const size_t plaintext_chunk = chunk_size - TAG_SIZE;
+    const size_t num_chunks = std::max<size_t>(1, (plaintext.size() + plaintext_chunk - 1) / plaintext_chunk);
+    const size_t sealed_size = plaintext.size() + num_chunks * TAG_SIZE;
+    // Any further and the offset would run into the frame number in the chunk id
+    if (sealed_size > MAX_CHUNKED_FRAME_SIZE) {
+        out.clear();
+        return false;
+    }
+    out.resize(sealed_size);
+
+    CryptoPool& pool = CryptoPool::Get();
+    const size_t num_segments = std::clamp<size_t>(num_chunks / MIN_SEGMENT_CHUNKS, 1, pool.Parallelism());
+    // Keyed here on the calling thread, the pool only ever touches one context per segment
+    while (segment_encryptions.size() < num_segments - 1) {
+        auto encryption = std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Encryption>();
+        CryptoPP::byte nonce[NONCE_SIZE];
+        MakeNonce(encrypt_salt, 0, nonce);
+        encryption->SetKeyWithIV(password, password.size(), nonce, NONCE_SIZE);
+        segment_encryptions.push_back(std::move(encryption));
+    }
+
+    pool.Run(num_segments, [&](size_t segment) {
+        // First segment reuses the session's own context
+        CryptoPP::GCM<CryptoPP::AES>::Encryption& encryption = segment == 0 ? gcm_encryption : *segment_encryptions[segment - 1];
+        const size_t first_chunk = num_chunks * segment / num_segments;
+        const size_t last_chunk = num_chunks * (segment + 1) / num_segments;
+        for (size_t chunk = first_chunk; chunk < last_chunk; chunk++) {
+            const size_t plaintext_offset = chunk * plaintext_chunk;
+            const size_t plaintext_size = std::min(plaintext_chunk, plaintext.size() - plaintext_offset);
+            const size_t chunk_offset = chunk * chunk_size;
+            std::copy_n(plaintext.data() + plaintext_offset, plaintext_size, out.data() + chunk_offset);
+            SealChunkWith(encryption, encrypt_salt, out.data() + chunk_offset, plaintext_size,
+                first_chunk_id + chunk_offset, associated_data);
+        }
+    });
+    return true;
+}
+
+bool Crypto::OpenChunk(char* buffer, size_t sealed_size, uint64_t chunk_id, std::string_view associated_data) {
+    if (sealed_size < TAG_SIZE) {
+        return false;
+    }
+    CryptoPP::byte* bytes = reinterpret_cast<CryptoPP::byte*>(buffer);
+    const size_t ciphertext_size = sealed_size - TAG_SIZE;
+
+    CryptoPP::byte nonce[NONCE_SIZE];
+    MakeNonce(decrypt_salt, chunk_id, nonce);
+    return gcm_decryption.DecryptAndVerify(bytes, bytes + ciphertext_size, TAG_SIZE,
+        nonce, NONCE_SIZE,
+        reinterpret_cast<const CryptoPP::byte*>(associated_data.data()), associated_data.size(),
+        bytes, ciphertext_size);
+}
+
+uint64_t Crypto::ChunkId(bool is_video, uint32_t stream_num, uint32_t frame_num, uint32_t chunk_offset) {
+    return (1ull << 63)
+        | (static_cast<uint64_t>(is_video) << 62)
+        | (static_cast<uint64_t>(stream_num & 0x3F) << 56)
+        | (static_cast<uint64_t>(frame_num) << 24)
+        | (chunk_offset & 0xFFFFFF);
 }
 
 std::string Crypto::GetPublicKey() const {
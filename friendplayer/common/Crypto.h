@@ -1,17 +1,101 @@
 #pragma once
 
+#include <cryptopp\aes.h>
+#include <cryptopp\gcm.h>
+#include <cryptopp\hmac.h>
 #include <cryptopp\integer.h>
 #include <cryptopp\osrng.h>
+#include <cryptopp\sha.h>
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
 
 class Crypto {
 public:
+    // Bytes in front of each ciphertext, the sequence its nonce was built from
+    static constexpr size_t SEQUENCE_SIZE = 8;
+    // GCM authentication tag, appended after the ciphertext
+    static constexpr size_t TAG_SIZE = 16;
+    // What sealing adds to a plaintext
+    static constexpr size_t OVERHEAD = SEQUENCE_SIZE + TAG_SIZE;
+
+    // Prime size of the host's DH group
+    static constexpr int DH_GROUP_BITS = 1024;
+    // Each side's contribution to a resumed session's keys
+    static constexpr size_t RESUME_NONCE_SIZE = 16;
+    // Broadcast media keys, hashed down to a session key like a DH agreed value
+    static constexpr size_t GROUP_KEY_SIZE = 32;
+    // Largest frame SealChunks takes, sealed size included, chunk ids hold a 24 bit offset
+    static constexpr size_t MAX_CHUNKED_FRAME_SIZE = size_t(1) << 24;
+
+    struct Group {
+        CryptoPP::Integer p;
+        CryptoPP::Integer q;
+        CryptoPP::Integer g;
+    };
+    // Generating a safe prime takes a long and variable time, so each size is made once per process
+    // and shared by every session started with it. Only the key pair is per connection
+    static const Group& CachedGroup(int gen_bit_value);
+
     Crypto(int gen_bit_value);
+    // Starts a session in an existing group, as the side that picked it
+    explicit Crypto(const Group& group);
     Crypto(const std::string& p_byte, const std::string& q_byte, const std::string& g_byte);
 
     void SharedKeyAgreement(const std::string& other_pub_key);
-    void Encrypt(const std::string& in, std::string& out);
-    void Decrypt(const std::string& in, std::string& out);
-    void DecryptInPlace(std::string& inout);
+
+    // Session keyed from an earlier session's resumption secret without a DH exchange. Both nonces are fresh,
+    // so nonces restarting from zero (sequences, chunk ids) never repeat under an old key
+    static std::unique_ptr<Crypto> Resume(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce, bool created_group);
+    // Broadcast media context, one per stream shared by the host and every viewer. Only the host seals,
+    // viewers open with sender false
+    static std::unique_ptr<Crypto> FromGroupKey(const std::string& group_key, bool sender);
+    // Secret a later session can be resumed from, only valid after the keys are agreed
+    std::string ResumptionSecret() const;
+    // Client's proof that it holds a ticket's secret, tying it to both nonces so it can't be replayed
+    static std::string ResumeProof(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce);
+    // Constant time
+    static bool VerifyResumeProof(const std::string& resumption_secret, const std::string& client_nonce,
+        const std::string& host_nonce, const std::string& proof);
+
+    // Host side resumption tickets, sealed under a key that lives as long as the process
+    static std::string SealTicket(const std::string& ticket);
+    static bool OpenTicket(const std::string& sealed, std::string& ticket);
+
+    static std::string RandomBytes(size_t size);
+    // Sequence a message was sealed with, for callers that reject replays. sealed holds at least SEQUENCE_SIZE bytes
+    static uint64_t SealedSequence(std::string_view sealed);
+
+    // In place AEAD. buffer holds SEQUENCE_SIZE bytes of room, the plaintext, then TAG_SIZE bytes of room
+    // and is overwritten with the sealed message. associated_data is authenticated but not sent
+    void Seal(char* buffer, size_t plaintext_size, std::string_view associated_data);
+    // Verifies and decrypts a sealed message, the plaintext is left at buffer + SEQUENCE_SIZE.
+    // False if the message or associated data don't match what was sealed
+    bool Open(char* buffer, size_t sealed_size, std::string_view associated_data);
+
+    void Encrypt(const std::string& in, std::string& out, std::string_view associated_data = {});
+    bool Decrypt(const std::string& in, std::string& out, std::string_view associated_data = {});
+    // Leaves only the plaintext in inout
+    bool DecryptInPlace(std::string& inout, std::string_view associated_data = {});
+
+    // Media chunks are sealed one by one so the receiver can open each as it lands. The nonce comes from
+    // the chunk's place in the stream, so only the tag is added: buffer holds the plaintext then TAG_SIZE bytes of room
+    void SealChunk(char* buffer, size_t plaintext_size, uint64_t chunk_id, std::string_view associated_data);
+    // Plaintext is left at the front of buffer
+    bool OpenChunk(char* buffer, size_t sealed_size, uint64_t chunk_id, std::string_view associated_data);
+    // Seals plaintext as consecutive chunk_size chunks of out, chunk ids count up from first_chunk_id by offset.
+    // Large frames are split into segments sealed in parallel on the CryptoPool. False, with nothing sealed,
+    // if the sealed frame would pass MAX_CHUNKED_FRAME_SIZE
+    bool SealChunks(std::string_view plaintext, size_t chunk_size, uint64_t first_chunk_id,
+        std::string_view associated_data, std::string& out);
+    // Packs a chunk's place into its nonce, room for 64 streams of each kind and 16 MB frames.
+    // The top bit is set so these never meet the message sequences
+    static uint64_t ChunkId(bool is_video, uint32_t stream_num, uint32_t frame_num, uint32_t chunk_offset);
 
     std::string GetPublicKey() const;
     std::string P() const;
@@ -19,6 +103,32 @@ public:
     std::string G() const;
 
 private:
+    static constexpr size_t KEY_SIZE = 16;
+    static constexpr size_t SALT_SIZE = 4;
+    // 96 bits is GCM's native IV length, anything else gets hashed down to it per message
+    static constexpr size_t NONCE_SIZE = 12;
+
+    // Nonce is the salt for the sending side followed by the big endian sequence
+    static void MakeNonce(const CryptoPP::SecByteBlock& salt, uint64_t sequence, CryptoPP::byte* nonce);
+    static Group GenerateGroup(int gen_bit_value);
+
+    // Resumed sessions skip the group and key pair entirely
+    explicit Crypto(bool created_group);
+    void GenerateKeyPair();
+    // Session key, nonce salts and resumption secret all come from hashing master
+    void DeriveSessionKeys(const CryptoPP::byte* master, size_t master_size);
+
+    // Below this many chunks a frame isn't worth handing to the pool
+    static constexpr size_t MIN_SEGMENT_CHUNKS = 32;
+
+    static void SealChunkWith(CryptoPP::GCM<CryptoPP::AES>::Encryption& encryption, const CryptoPP::SecByteBlock& salt,
+        char* buffer, size_t plaintext_size, uint64_t chunk_id, std::string_view associated_data);
+
+    // out gets the sequence, ciphertext and tag, plaintext may be out + SEQUENCE_SIZE
+    void SealTo(const char* plaintext, size_t plaintext_size, char* out, std::string_view associated_data);
+    // out gets sealed_size - OVERHEAD bytes of plaintext, it may be exactly sealed + SEQUENCE_SIZE but mustn't overlap otherwise
+    bool OpenTo(const char* sealed, size_t sealed_size, char* out, std::string_view associated_data);
+
     CryptoPP::AutoSeededRandomPool rng;
 
     CryptoPP::Integer p;
@@ -30,4 +140,17 @@ private:
 
     CryptoPP::SecByteBlock shared_key;
     CryptoPP::SecByteBlock password;
+    CryptoPP::SecByteBlock resumption_secret;
+
+    // Keyed once in SharedKeyAgreement, each message only resynchronizes the nonce
+    CryptoPP::GCM<CryptoPP::AES>::Encryption gcm_encryption;
+    CryptoPP::GCM<CryptoPP::AES>::Decryption gcm_decryption;
+    // Both directions share the key, so each side encrypts under its own salt to keep nonces unique
+    bool created_group;
+    CryptoPP::SecByteBlock encrypt_salt;
+    CryptoPP::SecByteBlock decrypt_salt;
+    uint64_t encrypt_sequence;
+    // GCM state isn't shareable between threads, so each segment sealed in parallel gets its own,
+    // keyed on first use and dropped when the key changes
+    std::vector<std::unique_ptr<CryptoPP::GCM<CryptoPP::AES>::Encryption>> segment_encryptions;
 };
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include "common/CryptoPool.h"
+
+#include <algorithm>
+
+CryptoPool& CryptoPool::Get() {
+    // The thread calling Run works too, so one worker fewer than cores
+    static CryptoPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return pool;
+}
+
+CryptoPool::CryptoPool(size_t num_workers) {
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back(&CryptoPool::Worker, this);
+    }
+}
+
+CryptoPool::~CryptoPool() {
+    for (size_t i = 0; i < workers.size(); i++) {
+        batch_queue.enqueue(nullptr);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void CryptoPool::Run(size_t count, const std::function<void(size_t)>& job) {
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || workers.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    batch->job = &job;
+    batch->count = count;
+    const size_t helpers = std::min(count - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++) {
+        batch_queue.enqueue(batch);
+    }
+
+    Work(*batch);
+    std::unique_lock<std::mutex> lock(batch->finished_m);
+    batch->finished_cv.wait(lock, [&batch]() { return batch->finished.load() == batch->count; });
+}
+
+void CryptoPool::Work(Batch& batch) {
+    for (size_t i = batch.next_index++; i < batch.count; i = batch.next_index++) {
+        (*batch.job)(i);
+        if (++batch.finished == batch.count) {
+            std::lock_guard<std::mutex> lock(batch.finished_m);
+            batch.finished_cv.notify_all();
+        }
+    }
+}
+
+void CryptoPool::Worker() {
+    while (true) {
+        std::shared_ptr<Batch> batch;
+        batch_queue.wait_dequeue(batch);
+        if (!batch) {
+            return;
+        }
+        Work(*batch);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <concurrentqueue/blockingconcurrentqueue.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads shared by every client actor, so one large frame is sealed a segment per core
+// and segments from many clients interleave instead of queuing behind each other's actor threads
+class CryptoPool {
+public:
+    static CryptoPool& Get();
+
+    ~CryptoPool();
+
+    // Segments Run can work on at once, the workers plus the calling thread
+    size_t Parallelism() const { return workers.size() + 1; }
+    // Calls job(0) .. job(count - 1) across the workers and the calling thread, returns once all have finished
+    void Run(size_t count, const std::function<void(size_t)>& job);
+
+private:
+    CryptoPool(size_t num_workers);
+
+    struct Batch {
+        const std::function<void(size_t)>* job;
+        size_t count;
+        std::atomic<size_t> next_index{0};
+        std::atomic<size_t> finished{0};
+        std::mutex finished_m;
+        std::condition_variable finished_cv;
+    };
+
+    // Claims indices until none are left, the batch is shared so late workers find it empty and move on
+    static void Work(Batch& batch);
+    void Worker();
+
+    moodycamel::BlockingConcurrentQueue<std::shared_ptr<Batch>> batch_queue;
+    std::vector<std::thread> workers;
+};
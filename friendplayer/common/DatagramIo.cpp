@@ -0,0 +1,186 @@
+#include "common/DatagramIo.h"
+
+#include "common/Log.h"
+#include "common/WireFormat.h"
+
+#include <array>
+#include <string.h>
+
+std::unique_ptr<DatagramIo> DatagramIo::Create(Backend backend, asio::ip::udp::socket& socket) {
+    switch (backend) {
+#ifdef FP_HAVE_IO_URING
+    case Backend::IO_URING: {
+        auto io_uring = std::make_unique<IoUringDatagramIo>(socket);
+        if (io_uring->Initialize()) {
+            return io_uring;
+        }
+        LOG_WARNING("Kernel doesn't support io_uring buffer rings, using {}", BackendName(Backend::MMSG));
+        return std::make_unique<MmsgDatagramIo>(socket);
+    }
+#endif
+#ifdef __linux__
+    case Backend::MMSG:
+        return std::make_unique<MmsgDatagramIo>(socket);
+#endif
+    case Backend::ASIO:
+        return std::make_unique<AsioDatagramIo>(socket);
+    default:
+        LOG_WARNING("Datagram backend {} isn't available on this platform, using asio", BackendName(backend));
+        return std::make_unique<AsioDatagramIo>(socket);
+    }
+}
+
+DatagramIo::Backend DatagramIo::DefaultBackend() {
+#ifdef __linux__
+    return Backend::MMSG;
+#else
+    return Backend::ASIO;
+#endif
+}
+
+std::vector<DatagramIo::Backend> DatagramIo::AvailableBackends() {
+#if defined(FP_HAVE_IO_URING)
+    return { Backend::ASIO, Backend::MMSG, Backend::IO_URING };
+#elif defined(__linux__)
+    return { Backend::ASIO, Backend::MMSG };
+#else
+    return { Backend::ASIO };
+#endif
+}
+
+const char* DatagramIo::BackendName(Backend backend) {
+    switch (backend) {
+    case Backend::ASIO: return "asio";
+    case Backend::MMSG: return "mmsg";
+    case Backend::IO_URING: return "io_uring";
+    }
+    return "unknown";
+}
+
+bool DatagramIo::ParseBackend(const std::string& name, Backend& backend) {
+    for (Backend candidate : { Backend::ASIO, Backend::MMSG, Backend::IO_URING }) {
+        if (name == BackendName(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t DatagramIo::ToAddress(const asio::ip::udp::endpoint& endpoint) {
+    uint64_t address = endpoint.address().to_v4().to_uint();
+    address |= static_cast<uint64_t>(endpoint.port()) << 32;
+    return address;
+}
+
+asio::ip::udp::endpoint DatagramIo::ToEndpoint(uint64_t address) {
+    return asio::ip::udp::endpoint(asio::ip::address_v4(address & 0xFFFFFFFF), (address >> 32) & 0xFFFF);
+}
+
+DatagramIo::Stats DatagramIo::GetStats() const {
+    Stats stats;
+    stats.packets_sent = packets_sent.load(std::memory_order_relaxed);
+    stats.bytes_sent = bytes_sent.load(std::memory_order_relaxed);
+    stats.packets_received = packets_received.load(std::memory_order_relaxed);
+    stats.bytes_received = bytes_received.load(std::memory_order_relaxed);
+    stats.send_would_block = send_would_block.load(std::memory_order_relaxed);
+    stats.send_no_buffers = send_no_buffers.load(std::memory_order_relaxed);
+    stats.send_other_errors = send_other_errors.load(std::memory_order_relaxed);
+    stats.receive_overflows = receive_overflows.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void DatagramIo::CountSendError(const asio::error_code& ec) {
+    if (ec == asio::error::would_block || ec == asio::error::try_again) {
+        send_would_block.fetch_add(1, std::memory_order_relaxed);
+    } else if (ec == asio::error::no_buffer_space) {
+        send_no_buffers.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        send_other_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#ifdef __linux__
+bool DatagramIo::EnableOverflowCount(int fd) {
+    int enable = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == 0;
+}
+
+void DatagramIo::CheckOverflowCount(const cmsghdr* cmsg) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+        // Running total for the socket, only attached once something has been dropped
+        uint32_t drops;
+        memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+        receive_overflows.store(drops, std::memory_order_relaxed);
+    }
+}
+#endif
+
+AsioDatagramIo::AsioDatagramIo(asio::ip::udp::socket& socket)
+    : socket(socket),
+      provided_buffer(nullptr) {}
+
+AsioDatagramIo::~AsioDatagramIo() {
+    if (provided_buffer_handle) {
+        ReleasePayload(*provided_buffer_handle);
+    }
+}
+
+void AsioDatagramIo::Send(uint64_t address, std::string_view data) {
+    asio::error_code ec;
+    socket.send_to(asio::buffer(data.data(), data.size()), ToEndpoint(address), 0, ec);
+    if (ec) {
+        CountSendError(ec);
+    } else {
+        CountSent(1, data.size());
+    }
+}
+
+void AsioDatagramIo::SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) {
+    // Buffer sequences go out through sendmsg/WSASendTo, nothing is joined in user space
+    const std::array<asio::const_buffer, 2> buffers = {
+        asio::buffer(header.data(), header.size()),
+        asio::buffer(payload.data(), payload.size()),
+    };
+    asio::error_code ec;
+    socket.send_to(buffers, ToEndpoint(address), 0, ec);
+    if (ec) {
+        CountSendError(ec);
+    } else {
+        CountSent(1, header.size() + payload.size());
+    }
+    ReleasePayload(payload_handle);
+}
+
+size_t AsioDatagramIo::Receive(const ReceiveHandler& handler) {
+    char* data;
+    if (HasBufferProvider()) {
+        if (!provided_buffer_handle) {
+            uint64_t buffer_handle;
+            provided_buffer = ProvideBuffer(WireFormat::MAX_DATAGRAM_SIZE, buffer_handle);
+            provided_buffer_handle = buffer_handle;
+        }
+        data = provided_buffer;
+    } else {
+        if (recv_buffer.empty()) {
+            recv_buffer.resize(WireFormat::MAX_DATAGRAM_SIZE);
+        }
+        data = recv_buffer.data();
+    }
+
+    asio::error_code ec;
+    asio::ip::udp::endpoint recv_endpoint;
+    size_t recv_size = socket.receive_from(asio::buffer(data, WireFormat::MAX_DATAGRAM_SIZE), recv_endpoint, 0, ec);
+    if (recv_size == 0 || ec.value() != 0) {
+        return 0;
+    }
+    CountReceived(1, recv_size);
+    handler(ToAddress(recv_endpoint), data, recv_size, provided_buffer_handle);
+    // Handler took its own reference, the next receive gets a fresh buffer
+    if (provided_buffer_handle) {
+        ReleasePayload(*provided_buffer_handle);
+        provided_buffer_handle.reset();
+        provided_buffer = nullptr;
+    }
+    return 1;
+}
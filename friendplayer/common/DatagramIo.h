@@ -0,0 +1,270 @@
+#pragma once
+
+#include <asio/ip/udp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+// friendplayer.vcxproj is the only build and targets Windows, it never compiles the Linux backends.
+// They have only been built and run out of tree, against Boost.Asio in place of standalone asio
+#ifdef __linux__
+#include <netinet/in.h>
+#include <sys/socket.h>
+#if __has_include(<linux/io_uring.h>)
+#define FP_HAVE_IO_URING
+#endif
+#endif
+
+// Send/receive path for an already opened UDP socket.
+// Addresses are packed like fp_actor::NetworkSend: IPv4 in the low 32 bits, port in the next 16
+class DatagramIo {
+public:
+    enum class Backend {
+        ASIO,
+        // recvmmsg/sendmmsg batching with UDP GSO sends where supported, Linux only
+        MMSG,
+        // io_uring with multishot receive into a kernel buffer ring, Linux 6.0+
+        IO_URING,
+    };
+
+    // With buffer_handle set the datagram lies in that provided buffer, which the backend releases after
+    // the call. Handlers that keep the payload take a reference of their own
+    using ReceiveHandler = std::function<void(uint64_t address, const char* data, size_t size, std::optional<uint64_t> buffer_handle)>;
+    using ReleaseHandler = std::function<void(uint64_t payload_handle)>;
+    // A buffer at least size bytes long for received datagrams to land in, with one reference held by the backend
+    using BufferProvider = std::function<char*(size_t size, uint64_t& buffer_handle)>;
+
+    // Totals since the backend was created
+    struct Stats {
+        uint64_t packets_sent = 0;
+        uint64_t bytes_sent = 0;
+        uint64_t packets_received = 0;
+        uint64_t bytes_received = 0;
+        // EAGAIN/EWOULDBLOCK, the socket send buffer was full
+        uint64_t send_would_block = 0;
+        // ENOBUFS, the device queue or socket memory was exhausted
+        uint64_t send_no_buffers = 0;
+        uint64_t send_other_errors = 0;
+        // Packets the kernel dropped on a full receive buffer, from SO_RXQ_OVFL so Linux mmsg/io_uring only
+        uint64_t receive_overflows = 0;
+    };
+
+    static std::unique_ptr<DatagramIo> Create(Backend backend, asio::ip::udp::socket& socket);
+    // Fastest backend available on this platform
+    static Backend DefaultBackend();
+    static std::vector<Backend> AvailableBackends();
+    static const char* BackendName(Backend backend);
+    // Inverse of BackendName, false for unknown names
+    static bool ParseBackend(const std::string& name, Backend& backend);
+
+    static uint64_t ToAddress(const asio::ip::udp::endpoint& endpoint);
+    static asio::ip::udp::endpoint ToEndpoint(uint64_t address);
+
+    virtual ~DatagramIo() {}
+
+    // Called with the handle passed to SendGather once the backend is done reading its payload,
+    // and with provided receive buffers once their datagrams have been handled
+    void SetReleaseHandler(ReleaseHandler handler) { release_handler = std::move(handler); }
+    // Backends receive straight into provided buffers instead of their own storage, so
+    // payloads can be handed on without a copy
+    void SetBufferProvider(BufferProvider provider) { buffer_provider = std::move(provider); }
+    // Safe to call from any thread, send and receive sides are each counted by the thread driving them
+    Stats GetStats() const;
+
+    // May hold on to a copy of the datagram until Flush
+    virtual void Send(uint64_t address, std::string_view data) = 0;
+    // header and payload go out as one datagram, only header is copied.
+    // payload must stay valid until the release handler is called with payload_handle
+    virtual void SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) = 0;
+    virtual void Flush() {}
+    // Blocks for the next datagrams and calls handler on each, returns how many were handled.
+    // Returns 0 on error or when nothing arrived before the backend's wait timed out
+    virtual size_t Receive(const ReceiveHandler& handler) = 0;
+
+protected:
+    void ReleasePayload(uint64_t payload_handle) {
+        if (release_handler) {
+            release_handler(payload_handle);
+        }
+    }
+    bool HasBufferProvider() const { return static_cast<bool>(buffer_provider); }
+    char* ProvideBuffer(size_t size, uint64_t& buffer_handle) { return buffer_provider(size, buffer_handle); }
+
+    void CountSent(size_t packets, size_t bytes) {
+        packets_sent.fetch_add(packets, std::memory_order_relaxed);
+        bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void CountReceived(size_t packets, size_t bytes) {
+        packets_received.fetch_add(packets, std::memory_order_relaxed);
+        bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void CountSendError(const asio::error_code& ec);
+#ifdef __linux__
+    // Asks for SO_RXQ_OVFL control messages on received datagrams
+    static bool EnableOverflowCount(int fd);
+    // Control message space needed alongside any others a backend asks for
+    static constexpr size_t OVERFLOW_CONTROL_SIZE = CMSG_SPACE(sizeof(uint32_t));
+    // Picks up the socket's running drop count if cmsg carries it
+    void CheckOverflowCount(const cmsghdr* cmsg);
+#endif
+
+private:
+    ReleaseHandler release_handler;
+    BufferProvider buffer_provider;
+
+    std::atomic<uint64_t> packets_sent = 0;
+    std::atomic<uint64_t> bytes_sent = 0;
+    std::atomic<uint64_t> packets_received = 0;
+    std::atomic<uint64_t> bytes_received = 0;
+    std::atomic<uint64_t> send_would_block = 0;
+    std::atomic<uint64_t> send_no_buffers = 0;
+    std::atomic<uint64_t> send_other_errors = 0;
+    std::atomic<uint64_t> receive_overflows = 0;
+};
+
+class AsioDatagramIo : public DatagramIo {
+public:
+    AsioDatagramIo(asio::ip::udp::socket& socket);
+    ~AsioDatagramIo() override;
+
+    void Send(uint64_t address, std::string_view data) override;
+    void SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) override;
+    size_t Receive(const ReceiveHandler& handler) override;
+
+private:
+    asio::ip::udp::socket& socket;
+    // Only without a buffer provider
+    std::vector<char> recv_buffer;
+    // Provided buffer waiting for the next datagram, kept across receives that fail
+    char* provided_buffer;
+    std::optional<uint64_t> provided_buffer_handle;
+};
+
+#ifdef __linux__
+class MmsgDatagramIo : public DatagramIo {
+public:
+    static constexpr size_t BATCH_SIZE = 32;
+    // Lets the network thread notice shutdown
+    static constexpr std::chrono::milliseconds RECEIVE_TIMEOUT{100};
+    // Kernel limit on segments in one GSO send
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+    MmsgDatagramIo(asio::ip::udp::socket& socket);
+    ~MmsgDatagramIo() override;
+
+    void Send(uint64_t address, std::string_view data) override;
+    void SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) override;
+    void Flush() override;
+    size_t Receive(const ReceiveHandler& handler) override;
+
+private:
+    struct ControlBuffer {
+        alignas(cmsghdr) char data[CMSG_SPACE(sizeof(int)) + OVERFLOW_CONTROL_SIZE];
+    };
+
+    int fd;
+    // Runs of equal sized sends to one address go out as a single UDP_SEGMENT send
+    bool gso_enabled;
+
+    // Preallocated slots, each MAX_DATAGRAM_SIZE long. Slot i owns iovecs 2i and 2i+1:
+    // bytes copied into its storage, then an optional payload that stays where the caller has it
+    std::vector<char> send_storage;
+    std::vector<mmsghdr> send_msgs;
+    std::vector<iovec> send_iovs;
+    std::vector<sockaddr_in> send_addrs;
+    std::vector<std::optional<uint64_t>> send_payload_handles;
+    size_t send_count;
+    // One entry per run of queued sends, built at flush time
+    std::vector<mmsghdr> flush_msgs;
+    std::vector<ControlBuffer> flush_control;
+
+    // Receive slots are MAX_DATAGRAM_SIZE long too, the socket never coalesces datagrams.
+    // Only without a buffer provider, otherwise each slot holds a provided buffer until it's received into
+    std::vector<char> recv_storage;
+    std::vector<std::optional<uint64_t>> recv_buffer_handles;
+    std::vector<mmsghdr> recv_msgs;
+    std::vector<iovec> recv_iovs;
+    std::vector<sockaddr_in> recv_addrs;
+    std::vector<ControlBuffer> recv_control;
+
+    size_t DatagramSize(size_t slot) const { return send_iovs[2 * slot].iov_len + send_iovs[2 * slot + 1].iov_len; }
+    // Points the slot's iovec at a fresh provided buffer, or at its part of recv_storage
+    void AttachRecvBuffer(size_t slot);
+    // Claims the next slot, flushing first if they're all queued
+    size_t NextSlot(uint64_t address);
+    void SendUnsegmented(const mmsghdr& msg);
+};
+#endif
+
+#ifdef FP_HAVE_IO_URING
+class IoUring;
+
+// Sends and receives go through separate rings so the actor thread and the network thread
+// each stay the only submitter on theirs.
+// Received datagrams land in a buffer ring registered with the kernel and are handed to the
+// handler in place, a single multishot recvmsg keeps the ring fed without resubmitting per packet.
+// With a buffer provider the ring's buffers are provided ones, replaced as each is handed up
+class IoUringDatagramIo : public DatagramIo {
+public:
+    // Power of two, kernel requirement for buffer rings
+    static constexpr unsigned RECV_BUFFERS = 512;
+    // Room for the recvmsg header, a sockaddr_in, the drop count control message and the largest datagram
+    static constexpr size_t RECV_BUFFER_SIZE = 2048;
+    static constexpr uint16_t RECV_BUFFER_GROUP = 0;
+    // In flight sends, Send blocks on a completion when all are taken
+    static constexpr unsigned SEND_SLOTS = 256;
+    static constexpr std::chrono::milliseconds RECEIVE_TIMEOUT{100};
+
+    IoUringDatagramIo(asio::ip::udp::socket& socket);
+    ~IoUringDatagramIo() override;
+
+    // False if the kernel doesn't support io_uring buffer rings, the object is unusable then
+    bool Initialize();
+
+    void Send(uint64_t address, std::string_view data) override;
+    void SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) override;
+    void Flush() override;
+    size_t Receive(const ReceiveHandler& handler) override;
+
+private:
+    struct SendSlot {
+        msghdr msg;
+        // Copied bytes in send_storage, then the caller's payload if any
+        iovec iov[2];
+        sockaddr_in addr;
+        std::optional<uint64_t> payload_handle;
+    };
+
+    int fd;
+
+    std::unique_ptr<IoUring> send_ring;
+    std::vector<char> send_storage;
+    std::vector<SendSlot> send_slots;
+    std::vector<unsigned> free_send_slots;
+
+    std::unique_ptr<IoUring> recv_ring;
+    // Page aligned io_uring_buf_ring shared with the kernel
+    void* recv_buf_ring;
+    // Ring buffers by id, the provided buffer's handle alongside when there's a provider
+    std::vector<char> recv_storage;
+    std::vector<char*> recv_buffers;
+    std::vector<std::optional<uint64_t>> recv_buffer_handles;
+    msghdr recv_msg;
+    bool recv_armed;
+
+    // Fills in a free slot and queues its SENDMSG, data is copied and payload is referenced
+    void QueueSend(uint64_t address, std::string_view data, std::string_view payload, std::optional<uint64_t> payload_handle);
+    void ReapSendCompletions(unsigned wait_for);
+    void ArmReceive();
+    // Queues a buffer at tail + offset, the kernel sees it after PublishRecvBuffers.
+    // A provided buffer is swapped for a fresh one first, the old one went up with its datagram
+    void RecycleRecvBuffer(uint16_t buffer_id, uint16_t offset);
+    void PublishRecvBuffers(uint16_t count);
+};
+#endif
@@ -2,6 +2,9 @@
 
 #include "common/Log.h"
 
+#include <algorithm>
+#include <optional>
+
 FrameRingBuffer::FrameRingBuffer(std::string name, size_t num_frames, size_t frame_capacity) 
         : buffer_name(name), frame_count(static_cast<uint32_t>(num_frames)), frame_number(0), corrupt_frame_timeout(-1) {
     buffer.resize(num_frames);
@@ -12,15 +15,14 @@ FrameRingBuffer::FrameRingBuffer(std::string name, size_t num_frames, size_t fra
     last_fps_check = std::chrono::system_clock::now();
 }
 
-bool FrameRingBuffer::AddFrameChunk(const fp_network::HostDataFrame& frame) {
-    std::string data;
-    uint32_t chunk_offset;
+bool FrameRingBuffer::AddFrameChunk(const fp_network::HostDataFrame& frame, std::string_view data) {
+    uint32_t chunk_offset = 0;
+    uint32_t fec_group_size = 0;
 
     if (frame.has_video()) {
-        data = frame.video().data();
         chunk_offset = frame.video().chunk_offset();
+        fec_group_size = frame.video().fec_group_size();
     } else if (frame.has_audio()) {
-        data = frame.audio().data();
         chunk_offset = frame.audio().chunk_offset();
     }
 
@@ -31,9 +33,7 @@ bool FrameRingBuffer::AddFrameChunk(const fp_network::HostDataFrame& frame) {
     } else if (frame.frame_num() >= frame_number + frame_count) {
         // Frame is beyond current buffer (probably decoder isn't taking them out fast enough)
         for (uint32_t i = frame.frame_num(); i < frame.frame_num() + frame_count; ++i) {
-            buffer[i % frame_count].num = i;
-            buffer[i % frame_count].size = 0;
-            buffer[i % frame_count].current_read_size = 0;
+            buffer[i % frame_count].Reset(i);
         }
         LOG_WARNING("{}: Decoder has dropped {} frames. Jumping from frame {} to {} ", buffer_name, frame_count, frame_number, frame.frame_num());
         frame_number = frame.frame_num();
@@ -47,25 +47,114 @@ bool FrameRingBuffer::AddFrameChunk(const fp_network::HostDataFrame& frame) {
     }
     buffer_frame.size = frame.frame_size();
     buffer_frame.num = frame.frame_num();
-    buffer_frame.current_read_size += static_cast<uint32_t>(data.size());
-    std::copy(data.begin(), data.end(), buffer_frame.data.begin() + chunk_offset);
+
+    if (fec_group_size > 0) {
+        buffer_frame.parity_chunks.push_back(ParityChunk{chunk_offset, fec_group_size, std::string(data)});
+        TryRecoverChunk(buffer_frame, buffer_frame.parity_chunks.back());
+    } else if (buffer_frame.received_chunks.insert(chunk_offset).second) {
+        buffer_frame.current_read_size += static_cast<uint32_t>(data.size());
+        std::copy(data.begin(), data.end(), buffer_frame.data.begin() + chunk_offset);
+        OpenChunk(buffer_frame, chunk_offset, static_cast<uint32_t>(data.size()));
+        for (const ParityChunk& parity : buffer_frame.parity_chunks) {
+            if (chunk_offset >= parity.offset && chunk_offset < parity.offset + parity.group_size * parity.data.size()) {
+                TryRecoverChunk(buffer_frame, parity);
+            }
+        }
+    }
 
     return buffer[frame_index()].current_read_size == buffer[frame_index()].size && buffer[frame_index()].size > 0;
 }
 
+void FrameRingBuffer::TryRecoverChunk(Frame& buffer_frame, const ParityChunk& parity) {
+    const uint32_t chunk_size = static_cast<uint32_t>(parity.data.size());
+    if (chunk_size == 0) {
+        return;
+    }
+
+    std::optional<uint32_t> missing_offset;
+    for (uint32_t i = 0; i < parity.group_size; i++) {
+        const uint32_t offset = parity.offset + i * chunk_size;
+        if (offset >= buffer_frame.size) {
+            break;
+        }
+        if (buffer_frame.received_chunks.count(offset) == 0) {
+            if (missing_offset) {
+                // XOR parity can only recover a single loss per group
+                return;
+            }
+            missing_offset = offset;
+        }
+    }
+    if (!missing_offset) {
+        return;
+    }
+
+    std::string recovered = parity.data;
+    for (uint32_t i = 0; i < parity.group_size; i++) {
+        const uint32_t offset = parity.offset + i * chunk_size;
+        if (offset >= buffer_frame.size) {
+            break;
+        }
+        if (offset == *missing_offset) {
+            continue;
+        }
+        const uint32_t length = std::min(chunk_size, buffer_frame.size - offset);
+        for (uint32_t j = 0; j < length; j++) {
+            recovered[j] ^= buffer_frame.data[offset + j];
+        }
+    }
+
+    const uint32_t missing_length = std::min(chunk_size, buffer_frame.size - *missing_offset);
+    std::copy(recovered.begin(), recovered.begin() + missing_length, buffer_frame.data.begin() + *missing_offset);
+    buffer_frame.received_chunks.insert(*missing_offset);
+    buffer_frame.current_read_size += missing_length;
+    LOG_TRACE("{}: Recovered chunk at offset {} of frame {} from parity", buffer_name, *missing_offset, buffer_frame.num);
+    OpenChunk(buffer_frame, *missing_offset, missing_length);
+}
+
+void FrameRingBuffer::OpenChunk(Frame& buffer_frame, uint32_t chunk_offset, uint32_t length) {
+    if (!chunk_opener) {
+        return;
+    }
+    if (buffer_frame.plaintext.size() < buffer_frame.data.size()) {
+        buffer_frame.plaintext.resize(buffer_frame.data.size());
+    }
+
+    // The sealed copy stays in data for parity, the chunk is opened in the plaintext buffer at the same offset
+    uint8_t* chunk = buffer_frame.plaintext.data() + chunk_offset;
+    std::copy_n(buffer_frame.data.begin() + chunk_offset, length, chunk);
+    std::optional<uint32_t> plaintext_length = chunk_opener(buffer_frame.num, chunk_offset, reinterpret_cast<char*>(chunk), length);
+    if (!plaintext_length) {
+        LOG_WARNING("{}: Chunk at offset {} of frame {} failed authentication", buffer_name, chunk_offset, buffer_frame.num);
+        return;
+    }
+    buffer_frame.opened_chunks[chunk_offset] = *plaintext_length;
+}
+
 bool FrameRingBuffer::GetFront(std::string& buffer_out) {
     bool frame_was_corrupt = false;
 
-    const auto& data = buffer[frame_index()].data;
-    if (data.size() < buffer[frame_index()].size) {
-        LOG_WARNING("Invalid frame size reported by FrameRingBuffer {}: {} < {}", buffer_name, data.size(), buffer[frame_index()].size);
+    const Frame& front = buffer[frame_index()];
+    const auto& data = front.data;
+    if (data.size() < front.size) {
+        LOG_WARNING("Invalid frame size reported by FrameRingBuffer {}: {} < {}", buffer_name, data.size(), front.size);
         frame_was_corrupt = true;
     } else {
-        buffer_out.resize(buffer[frame_index()].size);
-        std::copy(data.begin(), data.begin() + buffer_out.size(), reinterpret_cast<uint8_t*>(buffer_out.data()));
+        bool all_chunks_opened = true;
+        if (chunk_opener) {
+            // Joined in offset order, chunks that never arrived or failed to open are left out
+            buffer_out.clear();
+            for (const auto& [chunk_offset, length] : front.opened_chunks) {
+                const uint8_t* chunk = front.plaintext.data() + chunk_offset;
+                buffer_out.append(reinterpret_cast<const char*>(chunk), length);
+            }
+            all_chunks_opened = front.opened_chunks.size() == front.received_chunks.size();
+        } else {
+            buffer_out.resize(front.size);
+            std::copy(data.begin(), data.begin() + buffer_out.size(), reinterpret_cast<uint8_t*>(buffer_out.data()));
+        }
         
-        if (buffer[frame_index()].current_read_size != buffer[frame_index()].size
-            || buffer[frame_index()].size == 0) {
+        if (front.current_read_size != front.size || front.size == 0 || !all_chunks_opened) {
             corrupt_frame_timeout = CORRUPT_FRAME_TIMEOUT;
         } else if (corrupt_frame_timeout >= 0) {
             if (corrupt_frame_timeout == 0) {
@@ -75,14 +164,36 @@ bool FrameRingBuffer::GetFront(std::string& buffer_out) {
         }
     }
 
-    buffer[frame_index()].num = frame_number + frame_count;
-    buffer[frame_index()].size = 0;
-    buffer[frame_index()].current_read_size = 0;
+    buffer[frame_index()].Reset(frame_number + frame_count);
     frame_number++;
 
     return frame_was_corrupt;
 }
 
+std::optional<uint32_t> FrameRingBuffer::NextCompleteFrame() const {
+    for (uint32_t num = frame_number; num < frame_number + frame_count; num++) {
+        const Frame& buffer_frame = buffer[num % frame_count];
+        if (buffer_frame.num == num && buffer_frame.size > 0 && buffer_frame.current_read_size == buffer_frame.size) {
+            return num;
+        }
+    }
+    return std::nullopt;
+}
+
+void FrameRingBuffer::DropFront() {
+    buffer[frame_index()].Reset(frame_number + frame_count);
+    frame_number++;
+}
+
+void FrameRingBuffer::Reset() {
+    for (uint32_t i = 0; i < frame_count; i++) {
+        buffer[i].Reset(i);
+    }
+    frame_number = 0;
+    last_frame_number = 0;
+    corrupt_frame_timeout = -1;
+}
+
 double FrameRingBuffer::GetFPS() {
     auto now = std::chrono::system_clock::now();
     double fps = static_cast<double>(frame_number - last_frame_number) / std::chrono::duration_cast<std::chrono::milliseconds>(now - last_fps_check).count();
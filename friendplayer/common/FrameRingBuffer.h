@@ -1,17 +1,43 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
 #include <stdint.h>
+#include <string>
 #include <string_view>
 #include <vector>
 
 #include "protobuf/host_messages.pb.h"
 
+struct ParityChunk {
+    uint32_t offset;
+    uint32_t group_size;
+    std::string data;
+};
+
 struct Frame {
     uint32_t num = 0;
     uint32_t size = 0;
     uint32_t current_read_size = 0;
     std::vector<uint8_t> data;
+    // Offsets of chunks already copied in, so duplicates aren't counted twice
+    std::set<uint32_t> received_chunks;
+    std::vector<ParityChunk> parity_chunks;
+    // Chunk encryption only, each opened chunk's plaintext sits at its offset in data, keyed by offset to its length
+    std::vector<uint8_t> plaintext;
+    std::map<uint32_t, uint32_t> opened_chunks;
+
+    void Reset(uint32_t new_num) {
+        num = new_num;
+        size = 0;
+        current_read_size = 0;
+        received_chunks.clear();
+        parity_chunks.clear();
+        opened_chunks.clear();
+    }
 };
 
 struct RetrievedBuffer {
@@ -27,15 +53,37 @@ private:
     static constexpr uint32_t CORRUPT_FRAME_TIMEOUT = 20;
 
 public:
+    // Opens a sealed chunk in place and returns its plaintext length, nullopt if it fails authentication
+    using ChunkOpener = std::function<std::optional<uint32_t>(uint32_t frame_num, uint32_t chunk_offset, char* chunk, uint32_t size)>;
+
     FrameRingBuffer(std::string name, size_t num_frames, size_t frame_capacity);
 
-    bool AddFrameChunk(const fp_network::HostDataFrame& frame);
+    // Chunks are sealed separately, each is opened as it's received or recovered and GetFront joins the plaintext.
+    // Sealed chunks are kept too, parity is computed over them
+    void SetChunkOpener(ChunkOpener opener) { chunk_opener = std::move(opener); }
+
+    // Header fields come from frame, its data field is ignored in favor of data
+    bool AddFrameChunk(const fp_network::HostDataFrame& frame, std::string_view data);
     bool GetFront(std::string& buffer_out);
+    // Back to frame 0 with nothing buffered, for a resumed session whose frame numbers start over
+    void Reset();
+    // Number of the frame GetFront will return next
+    uint32_t FrontFrameNumber() const { return frame_number; }
+    // Lowest numbered frame in the window with every chunk in, which may be behind incomplete ones
+    std::optional<uint32_t> NextCompleteFrame() const;
+    // Gives up on the front frame without returning it
+    void DropFront();
     double GetFPS();
     
 private:
     std::vector<Frame> buffer;
 
+    // Rebuilds the group's missing chunk if parity and every other chunk are present
+    void TryRecoverChunk(Frame& buffer_frame, const ParityChunk& parity);
+    void OpenChunk(Frame& buffer_frame, uint32_t chunk_offset, uint32_t length);
+
+    ChunkOpener chunk_opener;
+
     uint32_t frame_count;
     uint32_t frame_number;
     constexpr uint32_t frame_index() const { return frame_number % frame_count; }
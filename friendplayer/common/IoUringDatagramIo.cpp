@@ -0,0 +1,454 @@
+#include "common/DatagramIo.h"
+
+#ifdef FP_HAVE_IO_URING
+
+#include "common/Log.h"
+#include "common/WireFormat.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace {
+constexpr uint64_t RECV_USER_DATA = 1;
+constexpr uint64_t CANCEL_USER_DATA = 2;
+
+// io_uring_buf_ring's flexible array member lands at offset 8 when compiled as C++,
+// so address the ring as plain entries. The tail overlays the first entry's resv field
+io_uring_buf* RingEntries(void* ring) {
+    return static_cast<io_uring_buf*>(ring);
+}
+
+uint16_t* RingTail(void* ring) {
+    return &RingEntries(ring)[0].resv;
+}
+}
+
+// Raw syscall wrapper around one ring, the queues are mapped straight from the kernel.
+// Not thread safe, only one thread may submit or reap
+class IoUring {
+public:
+    ~IoUring() {
+        if (sqes_ptr != MAP_FAILED) {
+            munmap(sqes_ptr, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+    bool Setup(unsigned entries, unsigned cq_entries) {
+        io_uring_params params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd < 0) {
+            return false;
+        }
+        features = params.features;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) {
+            return false;
+        }
+        if (features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) {
+                return false;
+            }
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes_ptr == MAP_FAILED) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr);
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries = params.sq_entries;
+        local_sq_tail = *sq_tail;
+        sqes = static_cast<io_uring_sqe*>(sqes_ptr);
+
+        char* cq = static_cast<char*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    uint32_t Features() const { return features; }
+
+    // Zeroed entry to fill in, nullptr if the submission queue is full
+    io_uring_sqe* GetSqe() {
+        if (local_sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return nullptr;
+        }
+        const unsigned index = local_sq_tail & sq_mask;
+        sq_array[index] = index;
+        local_sq_tail++;
+        memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+
+    // Hands queued entries to the kernel, then waits until wait_for completions are ready
+    // or timeout passes. Returns a negative errno on failure
+    int Submit(unsigned wait_for, const __kernel_timespec* timeout = nullptr) {
+        __atomic_store_n(sq_tail, local_sq_tail, __ATOMIC_RELEASE);
+        const unsigned to_submit = local_sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && wait_for == 0) {
+            return 0;
+        }
+        unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+        io_uring_getevents_arg arg = {};
+        void* arg_ptr = nullptr;
+        size_t arg_size = 0;
+        if (timeout != nullptr) {
+            flags |= IORING_ENTER_EXT_ARG;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<uint64_t>(timeout);
+            arg_ptr = &arg;
+            arg_size = sizeof(arg);
+        }
+        int rc = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for, flags, arg_ptr, arg_size));
+        return rc < 0 ? -errno : rc;
+    }
+
+    int Register(unsigned opcode, void* arg, unsigned nr_args) {
+        int rc = static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+        return rc < 0 ? -errno : rc;
+    }
+
+    // Oldest unconsumed completion without consuming it
+    const io_uring_cqe* PeekCompletion() const {
+        const unsigned head = *cq_head;
+        return head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) ? nullptr : &cqes[head & cq_mask];
+    }
+
+    // Calls fn on every ready completion and returns them to the kernel
+    template <typename Fn>
+    unsigned ForEachCompletion(Fn&& fn) {
+        unsigned head = *cq_head;
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        const unsigned count = tail - head;
+        for (; head != tail; head++) {
+            fn(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+private:
+    int ring_fd = -1;
+    uint32_t features = 0;
+
+    void* sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void* cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    void* sqes_ptr = MAP_FAILED;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned local_sq_tail = 0;
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+IoUringDatagramIo::IoUringDatagramIo(asio::ip::udp::socket& socket)
+    : fd(socket.native_handle()),
+      recv_buf_ring(nullptr),
+      recv_msg{},
+      recv_armed(false) {}
+
+IoUringDatagramIo::~IoUringDatagramIo() {
+    // The kernel writes into our buffers until every in flight operation completes
+    while (send_ring && free_send_slots.size() < send_slots.size()) {
+        ReapSendCompletions(1);
+    }
+    if (recv_ring && recv_armed) {
+        io_uring_sqe* sqe = recv_ring->GetSqe();
+        if (sqe != nullptr) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = RECV_USER_DATA;
+            sqe->user_data = CANCEL_USER_DATA;
+            const __kernel_timespec timeout = { 0, std::chrono::nanoseconds(RECEIVE_TIMEOUT).count() };
+            for (int attempt = 0; recv_armed && attempt < 10; attempt++) {
+                recv_ring->Submit(1, &timeout);
+                recv_ring->ForEachCompletion([this](const io_uring_cqe& cqe) {
+                    if (cqe.user_data == RECV_USER_DATA && !(cqe.flags & IORING_CQE_F_MORE)) {
+                        recv_armed = false;
+                    }
+                });
+            }
+        }
+    }
+    send_ring.reset();
+    recv_ring.reset();
+    free(recv_buf_ring);
+    for (const std::optional<uint64_t>& buffer_handle : recv_buffer_handles) {
+        if (buffer_handle) {
+            ReleasePayload(*buffer_handle);
+        }
+    }
+}
+
+bool IoUringDatagramIo::Initialize() {
+    send_ring = std::make_unique<IoUring>();
+    recv_ring = std::make_unique<IoUring>();
+    if (!send_ring->Setup(SEND_SLOTS, SEND_SLOTS * 2) || !recv_ring->Setup(8, RECV_BUFFERS * 2)) {
+        LOG_WARNING("io_uring setup failed: {}", strerror(errno));
+        return false;
+    }
+    // Timed waits need IORING_ENTER_EXT_ARG, 5.11+
+    if (!(recv_ring->Features() & IORING_FEAT_EXT_ARG)) {
+        return false;
+    }
+
+    send_storage.resize(SEND_SLOTS * WireFormat::MAX_DATAGRAM_SIZE);
+    send_slots.resize(SEND_SLOTS);
+    for (unsigned i = 0; i < SEND_SLOTS; i++) {
+        SendSlot& slot = send_slots[i];
+        slot.msg = {};
+        slot.iov[0].iov_base = send_storage.data() + i * WireFormat::MAX_DATAGRAM_SIZE;
+        slot.msg.msg_name = &slot.addr;
+        slot.msg.msg_namelen = sizeof(sockaddr_in);
+        slot.msg.msg_iov = slot.iov;
+        slot.msg.msg_iovlen = 2;
+        free_send_slots.push_back(SEND_SLOTS - 1 - i);
+    }
+
+    const size_t ring_size = RECV_BUFFERS * sizeof(io_uring_buf);
+    if (posix_memalign(&recv_buf_ring, static_cast<size_t>(sysconf(_SC_PAGESIZE)), ring_size) != 0) {
+        recv_buf_ring = nullptr;
+        return false;
+    }
+    memset(recv_buf_ring, 0, ring_size);
+    io_uring_buf_reg buf_reg = {};
+    buf_reg.ring_addr = reinterpret_cast<uint64_t>(recv_buf_ring);
+    buf_reg.ring_entries = RECV_BUFFERS;
+    buf_reg.bgid = RECV_BUFFER_GROUP;
+    // Buffer rings are 5.19+
+    if (recv_ring->Register(IORING_REGISTER_PBUF_RING, &buf_reg, 1) < 0) {
+        return false;
+    }
+    // The provider is set after Initialize, so the ring starts out on our own storage and
+    // switches to provided buffers as each one is recycled
+    recv_storage.resize(RECV_BUFFERS * RECV_BUFFER_SIZE);
+    recv_buffers.resize(RECV_BUFFERS);
+    recv_buffer_handles.resize(RECV_BUFFERS);
+    for (unsigned i = 0; i < RECV_BUFFERS; i++) {
+        recv_buffers[i] = recv_storage.data() + i * RECV_BUFFER_SIZE;
+    }
+    if (!EnableOverflowCount(fd)) {
+        LOG_WARNING("SO_RXQ_OVFL unavailable, kernel receive drops won't be counted: {}", strerror(errno));
+    }
+    for (uint16_t i = 0; i < RECV_BUFFERS; i++) {
+        RecycleRecvBuffer(i, i);
+    }
+    PublishRecvBuffers(RECV_BUFFERS);
+
+    // Multishot recvmsg is 6.0+, older kernels reject it as soon as it's submitted
+    ArmReceive();
+    recv_ring->Submit(0);
+    const io_uring_cqe* first = recv_ring->PeekCompletion();
+    if (first != nullptr && first->res == -EINVAL) {
+        recv_armed = false;
+        return false;
+    }
+    return true;
+}
+
+void IoUringDatagramIo::Send(uint64_t address, std::string_view data) {
+    if (data.size() > WireFormat::MAX_DATAGRAM_SIZE) {
+        LOG_WARNING("Dropping {} byte datagram, larger than a send slot", data.size());
+        return;
+    }
+    QueueSend(address, data, std::string_view(), std::nullopt);
+}
+
+void IoUringDatagramIo::SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) {
+    if (header.size() + payload.size() > WireFormat::MAX_DATAGRAM_SIZE) {
+        LOG_WARNING("Dropping {} byte datagram, larger than a send slot", header.size() + payload.size());
+        ReleasePayload(payload_handle);
+        return;
+    }
+    QueueSend(address, header, payload, payload_handle);
+}
+
+void IoUringDatagramIo::QueueSend(uint64_t address, std::string_view data, std::string_view payload, std::optional<uint64_t> payload_handle) {
+    while (free_send_slots.empty()) {
+        ReapSendCompletions(1);
+    }
+    const unsigned slot_index = free_send_slots.back();
+    free_send_slots.pop_back();
+
+    SendSlot& slot = send_slots[slot_index];
+    slot.addr.sin_family = AF_INET;
+    slot.addr.sin_addr.s_addr = htonl(static_cast<uint32_t>(address & 0xFFFFFFFF));
+    slot.addr.sin_port = htons(static_cast<uint16_t>((address >> 32) & 0xFFFF));
+    memcpy(slot.iov[0].iov_base, data.data(), data.size());
+    slot.iov[0].iov_len = data.size();
+    // Payload is read by the kernel when the entry executes, it's released on completion
+    slot.iov[1].iov_base = const_cast<char*>(payload.data());
+    slot.iov[1].iov_len = payload.size();
+    slot.payload_handle = payload_handle;
+
+    // Submission queue is as deep as the slot count, a free slot means a free entry
+    io_uring_sqe* sqe = send_ring->GetSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+    sqe->len = 1;
+    sqe->user_data = slot_index;
+}
+
+void IoUringDatagramIo::Flush() {
+    ReapSendCompletions(0);
+}
+
+void IoUringDatagramIo::ReapSendCompletions(unsigned wait_for) {
+    send_ring->Submit(wait_for);
+    send_ring->ForEachCompletion([this](const io_uring_cqe& cqe) {
+        if (cqe.res < 0) {
+            LOG_TRACE("io_uring send failed: {}", strerror(-cqe.res));
+            CountSendError(asio::error_code(-cqe.res, asio::error::get_system_category()));
+        } else {
+            CountSent(1, static_cast<size_t>(cqe.res));
+        }
+        SendSlot& slot = send_slots[cqe.user_data];
+        if (slot.payload_handle) {
+            ReleasePayload(*slot.payload_handle);
+            slot.payload_handle.reset();
+        }
+        free_send_slots.push_back(static_cast<unsigned>(cqe.user_data));
+    });
+}
+
+void IoUringDatagramIo::ArmReceive() {
+    recv_msg = {};
+    recv_msg.msg_namelen = sizeof(sockaddr_in);
+    recv_msg.msg_controllen = OVERFLOW_CONTROL_SIZE;
+
+    io_uring_sqe* sqe = recv_ring->GetSqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&recv_msg);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUFFER_GROUP;
+    sqe->user_data = RECV_USER_DATA;
+    recv_armed = true;
+}
+
+void IoUringDatagramIo::RecycleRecvBuffer(uint16_t buffer_id, uint16_t offset) {
+    if (HasBufferProvider()) {
+        if (recv_buffer_handles[buffer_id]) {
+            ReleasePayload(*recv_buffer_handles[buffer_id]);
+        }
+        uint64_t buffer_handle;
+        recv_buffers[buffer_id] = ProvideBuffer(RECV_BUFFER_SIZE, buffer_handle);
+        recv_buffer_handles[buffer_id] = buffer_handle;
+    }
+    io_uring_buf& buf = RingEntries(recv_buf_ring)[(*RingTail(recv_buf_ring) + offset) & (RECV_BUFFERS - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(recv_buffers[buffer_id]);
+    buf.len = RECV_BUFFER_SIZE;
+    buf.bid = buffer_id;
+}
+
+void IoUringDatagramIo::PublishRecvBuffers(uint16_t count) {
+    uint16_t* tail = RingTail(recv_buf_ring);
+    __atomic_store_n(tail, static_cast<uint16_t>(*tail + count), __ATOMIC_RELEASE);
+}
+
+size_t IoUringDatagramIo::Receive(const ReceiveHandler& handler) {
+    // Multishot ends when the buffer ring runs dry or the completion queue overflows
+    if (!recv_armed) {
+        ArmReceive();
+    }
+    const __kernel_timespec timeout = { 0, std::chrono::nanoseconds(RECEIVE_TIMEOUT).count() };
+    recv_ring->Submit(1, &timeout);
+
+    size_t handled = 0;
+    size_t received_bytes = 0;
+    uint16_t recycled = 0;
+    recv_ring->ForEachCompletion([&](const io_uring_cqe& cqe) {
+        if (cqe.user_data != RECV_USER_DATA) {
+            return;
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            recv_armed = false;
+        }
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+            if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+                LOG_TRACE("io_uring receive failed: {}", strerror(-cqe.res));
+            }
+            return;
+        }
+
+        const uint16_t buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        const char* buffer = recv_buffers[buffer_id];
+        // Buffer layout: io_uring_recvmsg_out, then the name and control areas as sized in recv_msg, then payload
+        if (cqe.res >= static_cast<int>(sizeof(io_uring_recvmsg_out))) {
+            io_uring_recvmsg_out out;
+            memcpy(&out, buffer, sizeof(out));
+            const char* name = buffer + sizeof(out);
+            const char* control = name + recv_msg.msg_namelen;
+            const char* payload = control + recv_msg.msg_controllen;
+            msghdr control_view = {};
+            control_view.msg_control = const_cast<char*>(control);
+            control_view.msg_controllen = out.controllen;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&control_view); cmsg != nullptr; cmsg = CMSG_NXTHDR(&control_view, cmsg)) {
+                CheckOverflowCount(cmsg);
+            }
+            sockaddr_in addr;
+            memcpy(&addr, name, sizeof(addr));
+            if (!(out.flags & MSG_TRUNC) && out.namelen >= sizeof(sockaddr_in) && out.payloadlen > 0
+                && addr.sin_family == AF_INET) {
+                uint64_t address = ntohl(addr.sin_addr.s_addr);
+                address |= static_cast<uint64_t>(ntohs(addr.sin_port)) << 32;
+                handler(address, payload, out.payloadlen, recv_buffer_handles[buffer_id]);
+                handled++;
+                received_bytes += out.payloadlen;
+            }
+        }
+        RecycleRecvBuffer(buffer_id, recycled++);
+    });
+    PublishRecvBuffers(recycled);
+    CountReceived(handled, received_bytes);
+    return handled;
+}
+
+#endif
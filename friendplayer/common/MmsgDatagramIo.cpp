@@ -0,0 +1,256 @@
+#include "common/DatagramIo.h"
+
+#ifdef __linux__
+
+#include "common/Log.h"
+#include "common/WireFormat.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <string.h>
+
+// Older libc headers predate this
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace {
+bool SameAddress(const sockaddr_in& lhs, const sockaddr_in& rhs) {
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+}
+
+MmsgDatagramIo::MmsgDatagramIo(asio::ip::udp::socket& socket)
+    : fd(socket.native_handle()),
+      gso_enabled(false),
+      send_storage(BATCH_SIZE * WireFormat::MAX_DATAGRAM_SIZE),
+      send_msgs(BATCH_SIZE),
+      send_iovs(2 * BATCH_SIZE),
+      send_addrs(BATCH_SIZE),
+      send_payload_handles(BATCH_SIZE),
+      send_count(0),
+      flush_msgs(BATCH_SIZE),
+      flush_control(BATCH_SIZE),
+      recv_buffer_handles(BATCH_SIZE),
+      recv_msgs(BATCH_SIZE),
+      recv_iovs(BATCH_SIZE),
+      recv_addrs(BATCH_SIZE),
+      recv_control(BATCH_SIZE) {
+    // Kernels without GSO reject the option outright
+    int gso_size = 0;
+    socklen_t gso_size_len = sizeof(gso_size);
+    gso_enabled = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso_size, &gso_size_len) == 0;
+    if (!EnableOverflowCount(fd)) {
+        LOG_WARNING("SO_RXQ_OVFL unavailable, kernel receive drops won't be counted: {}", strerror(errno));
+    }
+    LOG_INFO("UDP segmentation offload: GSO {}", gso_enabled ? "on" : "off");
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        send_iovs[2 * i].iov_base = send_storage.data() + i * WireFormat::MAX_DATAGRAM_SIZE;
+        send_msgs[i] = {};
+        send_msgs[i].msg_hdr.msg_iov = &send_iovs[2 * i];
+        send_msgs[i].msg_hdr.msg_iovlen = 2;
+        send_msgs[i].msg_hdr.msg_name = &send_addrs[i];
+        send_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+
+        // Buffers are attached on the first receive, once the provider is known
+        recv_iovs[i].iov_base = nullptr;
+        recv_iovs[i].iov_len = WireFormat::MAX_DATAGRAM_SIZE;
+        recv_msgs[i] = {};
+        recv_msgs[i].msg_hdr.msg_iov = &recv_iovs[i];
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+    }
+}
+
+MmsgDatagramIo::~MmsgDatagramIo() {
+    for (const std::optional<uint64_t>& buffer_handle : recv_buffer_handles) {
+        if (buffer_handle) {
+            ReleasePayload(*buffer_handle);
+        }
+    }
+}
+
+size_t MmsgDatagramIo::NextSlot(uint64_t address) {
+    if (send_count == BATCH_SIZE) {
+        Flush();
+    }
+    const size_t slot = send_count++;
+    sockaddr_in& addr = send_addrs[slot];
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(static_cast<uint32_t>(address & 0xFFFFFFFF));
+    addr.sin_port = htons(static_cast<uint16_t>((address >> 32) & 0xFFFF));
+    return slot;
+}
+
+void MmsgDatagramIo::Send(uint64_t address, std::string_view data) {
+    if (data.size() > WireFormat::MAX_DATAGRAM_SIZE) {
+        LOG_WARNING("Dropping {} byte datagram, larger than a send slot", data.size());
+        return;
+    }
+    const size_t slot = NextSlot(address);
+    memcpy(send_iovs[2 * slot].iov_base, data.data(), data.size());
+    send_iovs[2 * slot].iov_len = data.size();
+    send_iovs[2 * slot + 1] = {};
+    send_payload_handles[slot].reset();
+}
+
+void MmsgDatagramIo::SendGather(uint64_t address, std::string_view header, std::string_view payload, uint64_t payload_handle) {
+    if (header.size() + payload.size() > WireFormat::MAX_DATAGRAM_SIZE) {
+        LOG_WARNING("Dropping {} byte datagram, larger than a send slot", header.size() + payload.size());
+        ReleasePayload(payload_handle);
+        return;
+    }
+    const size_t slot = NextSlot(address);
+    memcpy(send_iovs[2 * slot].iov_base, header.data(), header.size());
+    send_iovs[2 * slot].iov_len = header.size();
+    send_iovs[2 * slot + 1].iov_base = const_cast<char*>(payload.data());
+    send_iovs[2 * slot + 1].iov_len = payload.size();
+    send_payload_handles[slot] = payload_handle;
+}
+
+void MmsgDatagramIo::Flush() {
+    // Group the queue into runs: same destination, every segment but the last exactly the first's size
+    size_t msg_count = 0;
+    for (size_t i = 0; i < send_count;) {
+        size_t run = 1;
+        const size_t segment_size = DatagramSize(i);
+        while (gso_enabled && i + run < send_count && run < MAX_GSO_SEGMENTS
+            && SameAddress(send_addrs[i], send_addrs[i + run])
+            && DatagramSize(i + run - 1) == segment_size
+            && DatagramSize(i + run) <= segment_size) {
+            run++;
+        }
+
+        // Slots' iovecs are contiguous, the kernel cuts the concatenation into segment_size datagrams
+        mmsghdr& msg = flush_msgs[msg_count];
+        msg = send_msgs[i];
+        msg.msg_hdr.msg_iovlen = 2 * run;
+        if (run > 1) {
+            msg.msg_hdr.msg_control = flush_control[msg_count].data;
+            msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t gso_size = static_cast<uint16_t>(segment_size);
+            memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        }
+        msg_count++;
+        i += run;
+    }
+
+    size_t sent = 0;
+    while (sent < msg_count) {
+        int rc = sendmmsg(fd, flush_msgs.data() + sent, static_cast<unsigned int>(msg_count - sent), 0);
+        if (rc >= 0) {
+            for (int i = 0; i < rc; i++, sent++) {
+                CountSent(flush_msgs[sent].msg_hdr.msg_iovlen / 2, flush_msgs[sent].msg_len);
+            }
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (flush_msgs[sent].msg_hdr.msg_iovlen > 2 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+            // Device can't checksum offload or the path rejects segmentation, stop trying
+            LOG_WARNING("UDP GSO send failed ({}), falling back to one datagram per send", strerror(errno));
+            gso_enabled = false;
+            SendUnsegmented(flush_msgs[sent]);
+        } else {
+            // Only the first message of the remaining batch failed, skip it like a lost send_to
+            LOG_TRACE("sendmmsg failed: {}", strerror(errno));
+            CountSendError(asio::error_code(errno, asio::error::get_system_category()));
+        }
+        sent++;
+    }
+    // sendmmsg copied everything into the kernel, payloads can go
+    for (size_t i = 0; i < send_count; i++) {
+        if (send_payload_handles[i]) {
+            ReleasePayload(*send_payload_handles[i]);
+            send_payload_handles[i].reset();
+        }
+    }
+    send_count = 0;
+}
+
+void MmsgDatagramIo::SendUnsegmented(const mmsghdr& msg) {
+    msghdr datagram = msg.msg_hdr;
+    datagram.msg_control = nullptr;
+    datagram.msg_controllen = 0;
+    datagram.msg_iovlen = 2;
+    for (size_t i = 0; i < msg.msg_hdr.msg_iovlen; i += 2) {
+        datagram.msg_iov = msg.msg_hdr.msg_iov + i;
+        const ssize_t rc = sendmsg(fd, &datagram, 0);
+        if (rc >= 0) {
+            CountSent(1, static_cast<size_t>(rc));
+        } else {
+            CountSendError(asio::error_code(errno, asio::error::get_system_category()));
+        }
+    }
+}
+
+size_t MmsgDatagramIo::Receive(const ReceiveHandler& handler) {
+    pollfd poll_fd = { fd, POLLIN, 0 };
+    if (poll(&poll_fd, 1, static_cast<int>(RECEIVE_TIMEOUT.count())) <= 0 || !(poll_fd.revents & POLLIN)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        if (recv_iovs[i].iov_base == nullptr) {
+            AttachRecvBuffer(i);
+        }
+        recv_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        recv_msgs[i].msg_hdr.msg_control = recv_control[i].data;
+        recv_msgs[i].msg_hdr.msg_controllen = sizeof(recv_control[i].data);
+    }
+    int rc = recvmmsg(fd, recv_msgs.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if (rc <= 0) {
+        return 0;
+    }
+
+    size_t handled = 0;
+    size_t received_bytes = 0;
+    for (int i = 0; i < rc; i++) {
+        mmsghdr& msg = recv_msgs[i];
+        if ((msg.msg_hdr.msg_flags & MSG_TRUNC) || msg.msg_len == 0 || recv_addrs[i].sin_family != AF_INET) {
+            continue;
+        }
+        uint64_t address = ntohl(recv_addrs[i].sin_addr.s_addr);
+        address |= static_cast<uint64_t>(ntohs(recv_addrs[i].sin_port)) << 32;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg.msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg.msg_hdr, cmsg)) {
+            CheckOverflowCount(cmsg);
+        }
+
+        handler(address, static_cast<const char*>(recv_iovs[i].iov_base), msg.msg_len, recv_buffer_handles[i]);
+        handled++;
+        received_bytes += msg.msg_len;
+    }
+    // Handlers took their own references, the slots get fresh buffers next time
+    for (int i = 0; i < rc; i++) {
+        if (recv_buffer_handles[i]) {
+            ReleasePayload(*recv_buffer_handles[i]);
+            recv_buffer_handles[i].reset();
+            recv_iovs[i].iov_base = nullptr;
+        }
+    }
+    CountReceived(handled, received_bytes);
+    return handled;
+}
+
+void MmsgDatagramIo::AttachRecvBuffer(size_t slot) {
+    if (HasBufferProvider()) {
+        uint64_t buffer_handle;
+        recv_iovs[slot].iov_base = ProvideBuffer(WireFormat::MAX_DATAGRAM_SIZE, buffer_handle);
+        recv_buffer_handles[slot] = buffer_handle;
+        return;
+    }
+    if (recv_storage.empty()) {
+        recv_storage.resize(BATCH_SIZE * WireFormat::MAX_DATAGRAM_SIZE);
+    }
+    recv_iovs[slot].iov_base = recv_storage.data() + slot * WireFormat::MAX_DATAGRAM_SIZE;
+}
+
+#endif
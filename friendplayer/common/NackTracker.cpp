@@ -0,0 +1,142 @@
+#include "common/NackTracker.h"
+
+#include <algorithm>
+
+NackTracker::NackTracker()
+    : next_receive_seqnum(0),
+      next_nack(clock::time_point::max()) {}
+
+void NackTracker::OnSequenced(const fp_network::Data& msg, clock::time_point now, clock::duration retransmit_interval) {
+    const uint64_t msg_seqnum = msg.sequence_number();
+    if (msg_seqnum < next_receive_seqnum) {
+        // Retransmit or reordered, fills its own gap and reveals nothing
+        missing_messages.erase(msg_seqnum);
+        return;
+    }
+
+    const bool is_video = msg.has_host_frame() && msg.host_frame().has_video();
+    if (!is_video || !fec_frame || fec_frame->stream_num != msg.host_frame().stream_num()
+        || fec_frame->frame_num != msg.host_frame().frame_num()) {
+        // Sender is past the frame, whatever parity it had for it was sent before this
+        ReleaseHolds(missing_messages.begin(), missing_messages.end());
+        fec_frame.reset();
+        if (is_video) {
+            fec_frame = FecFrame{msg.host_frame().stream_num(), msg.host_frame().frame_num()};
+        }
+    }
+
+    // A frame's first chunk can't follow a gap in that same frame
+    clock::time_point fec_hold_until;
+    if (is_video && now - last_parity_received <= FEC_ACTIVE_WINDOW && msg.host_frame().video().chunk_offset() > 0) {
+        fec_hold_until = now + retransmit_interval;
+    }
+    AddMissing(msg_seqnum, fec_hold_until);
+    next_receive_seqnum = msg_seqnum + 1;
+}
+
+std::optional<uint64_t> NackTracker::OnParity(const fp_network::Data& msg, size_t chunk_size, clock::time_point now) {
+    const fp_network::VideoFrame& video = msg.host_frame().video();
+    if (video.fec_group_size() == 0 || chunk_size == 0) {
+        return std::nullopt;
+    }
+    last_parity_received = now;
+
+    // Parity is one chunk long, the size every data chunk but the frame's last one has
+    const uint64_t group_size = video.fec_group_size();
+    const uint64_t frame_chunks = (msg.host_frame().frame_size() + chunk_size - 1) / chunk_size;
+    const uint64_t group_index = video.chunk_offset() / (group_size * chunk_size);
+    const uint64_t group_begin_seqnum = video.first_sequence_number() + group_index * group_size;
+    const uint64_t group_end_seqnum = video.first_sequence_number() + std::min((group_index + 1) * group_size, frame_chunks);
+    if (group_begin_seqnum >= group_end_seqnum) {
+        return std::nullopt;
+    }
+    if (group_end_seqnum > next_receive_seqnum && group_end_seqnum - next_receive_seqnum <= MAX_TRACKED_MISSING) {
+        // Parity goes out after all of the frame's data, so whatever of the group hasn't shown up was lost
+        AddMissing(group_end_seqnum, clock::time_point());
+        next_receive_seqnum = std::max(next_receive_seqnum, group_end_seqnum);
+    }
+
+    auto group_begin = missing_messages.lower_bound(group_begin_seqnum);
+    auto group_end = missing_messages.lower_bound(group_end_seqnum);
+    if (group_begin == group_end) {
+        return std::nullopt;
+    }
+    if (std::next(group_begin) == group_end) {
+        const uint64_t recovered_seqnum = group_begin->first;
+        missing_messages.erase(group_begin);
+        return recovered_seqnum;
+    }
+    ReleaseHolds(group_begin, group_end);
+    return std::nullopt;
+}
+
+void NackTracker::OnForward(const fp_network::Forward& msg) {
+    const uint64_t forward_seqnum = msg.sequence_number();
+    for (auto it = missing_messages.begin(); it != missing_messages.end() && it->first < forward_seqnum;) {
+        if (std::find(msg.outstanding().begin(), msg.outstanding().end(), it->first) == msg.outstanding().end()) {
+            it = missing_messages.erase(it);
+        } else {
+            it++;
+        }
+    }
+    // Outstanding messages this side never saw anything past are missing all the same
+    for (uint64_t seqnum : msg.outstanding()) {
+        if (seqnum >= next_receive_seqnum && seqnum < forward_seqnum && missing_messages.size() < MAX_TRACKED_MISSING) {
+            missing_messages.emplace(seqnum, MissingMessage{});
+        }
+    }
+    next_receive_seqnum = std::max(next_receive_seqnum, forward_seqnum);
+}
+
+std::vector<uint64_t> NackTracker::TakeNacks(clock::time_point now, uint64_t window_start, clock::duration retransmit_interval) {
+    // Waits retransmit_interval after the first NACK and doubles with each one after
+    const auto renack_interval = [&](uint32_t nack_count) {
+        return retransmit_interval * (1u << (std::max(nack_count, 1u) - 1));
+    };
+
+    std::vector<uint64_t> nacks;
+    next_nack = clock::time_point::max();
+    for (auto it = missing_messages.begin(); it != missing_messages.end();) {
+        MissingMessage& missing = it->second;
+        // Skipped by a forward or fast forward, or the sender isn't answering for it
+        if (it->first < window_start || missing.nack_count >= MAX_NACK_ATTEMPTS) {
+            it = missing_messages.erase(it);
+            continue;
+        }
+        clock::time_point due = missing.nack_count == 0 ? missing.fec_hold_until
+            : missing.last_nack + renack_interval(missing.nack_count);
+        if (due <= now && nacks.size() < static_cast<size_t>(MAX_NACKS_PER_MESSAGE)) {
+            nacks.push_back(it->first);
+            missing.last_nack = now;
+            missing.nack_count++;
+            // After the last attempt the entry is only kept until the next pass drops it
+            due = now + renack_interval(missing.nack_count);
+        }
+        next_nack = std::min(next_nack, std::max(due, now));
+        it++;
+    }
+    return nacks;
+}
+
+void NackTracker::Reset() {
+    missing_messages.clear();
+    next_receive_seqnum = 0;
+    next_nack = clock::time_point::max();
+    fec_frame.reset();
+}
+
+void NackTracker::AddMissing(uint64_t end_seqnum, clock::time_point fec_hold_until) {
+    uint64_t first_missing = next_receive_seqnum;
+    if (end_seqnum > MAX_TRACKED_MISSING) {
+        first_missing = std::max(first_missing, end_seqnum - MAX_TRACKED_MISSING);
+    }
+    for (uint64_t seqnum = first_missing; seqnum < end_seqnum; seqnum++) {
+        missing_messages.emplace(seqnum, MissingMessage{clock::time_point(), 0, fec_hold_until});
+    }
+}
+
+void NackTracker::ReleaseHolds(std::map<uint64_t, MissingMessage>::iterator begin, std::map<uint64_t, MissingMessage>::iterator end) {
+    for (auto it = begin; it != end; it++) {
+        it->second.fec_hold_until = clock::time_point();
+    }
+}
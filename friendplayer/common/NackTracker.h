@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include "protobuf/network_messages.pb.h"
+
+// Receive side loss tracking: which sequence numbers to NACK and when. Gaps in a video frame
+// the sender is protecting with parity wait until that parity could have repaired them
+class NackTracker {
+public:
+    using clock = std::chrono::system_clock;
+
+    // Gaps larger than this are left to the fast forward window
+    static constexpr uint64_t MAX_TRACKED_MISSING = 256;
+    static constexpr int MAX_NACKS_PER_MESSAGE = 64;
+    // Unanswered NACKs are repeated, each wait twice the one before
+    static constexpr uint32_t MAX_NACK_ATTEMPTS = 3;
+    // Sender counts as sending parity this long after the last parity chunk arrived
+    static constexpr std::chrono::seconds FEC_ACTIVE_WINDOW{1};
+
+    NackTracker();
+
+    // A sequenced data message arrived. Gaps it reveals in a parity protected frame are held for
+    // at most retransmit_interval
+    void OnSequenced(const fp_network::Data& msg, clock::time_point now, clock::duration retransmit_interval);
+    // A parity chunk chunk_size bytes long arrived. With only one chunk of its group missing the frame
+    // buffer rebuilds it, that sequence number is returned and counts as arrived. More than that are
+    // NACKed right away
+    std::optional<uint64_t> OnParity(const fp_network::Data& msg, size_t chunk_size, clock::time_point now);
+    // The sender abandoned everything below the forward point but its outstanding messages, only those
+    // are still worth a NACK
+    void OnForward(const fp_network::Forward& msg);
+    // Sequence numbers due a NACK at now, at most MAX_NACKS_PER_MESSAGE. Anything below window_start
+    // was skipped over and is dropped
+    std::vector<uint64_t> TakeNacks(clock::time_point now, uint64_t window_start, clock::duration retransmit_interval);
+    // When TakeNacks next has something to return, as of its last call
+    clock::time_point NextNack() const { return next_nack; }
+
+    void Reset();
+
+private:
+    struct MissingMessage {
+        clock::time_point last_nack;
+        uint32_t nack_count = 0;
+        // First NACK waits until then for the frame's parity
+        clock::time_point fec_hold_until;
+    };
+    // Sequence numbers skipped over by the sender that haven't arrived yet
+    std::map<uint64_t, MissingMessage> missing_messages;
+    // One past the highest sequence number received
+    uint64_t next_receive_seqnum;
+    clock::time_point next_nack;
+
+    // Video frame the highest sequence number received belongs to, its parity follows its data chunks
+    struct FecFrame {
+        uint32_t stream_num;
+        uint32_t frame_num;
+    };
+    std::optional<FecFrame> fec_frame;
+    clock::time_point last_parity_received;
+
+    void AddMissing(uint64_t end_seqnum, clock::time_point fec_hold_until);
+    void ReleaseHolds(std::map<uint64_t, MissingMessage>::iterator begin, std::map<uint64_t, MissingMessage>::iterator end);
+};
@@ -0,0 +1,95 @@
+#include "common/Pacer.h"
+
+#include <algorithm>
+#include <iterator>
+
+Pacer::Pacer(uint32_t bitrate)
+    : bytes_per_second(0),
+      burst_bytes(0),
+      tokens(0),
+      last_refill(clock::now()),
+      queued_bytes(0) {
+    SetRate(bitrate);
+    tokens = burst_bytes;
+}
+
+void Pacer::SetRate(uint32_t bitrate) {
+    Refill(clock::now());
+    bytes_per_second = bitrate / 8.0;
+    burst_bytes = std::max(bytes_per_second * std::chrono::duration<double>(BURST_DURATION).count(),
+        static_cast<double>(MIN_BURST_BYTES));
+    tokens = std::min(tokens, burst_bytes);
+}
+
+void Pacer::Enqueue(PacedMessage&& message) {
+    queued_bytes += message.size;
+    queues[Classify(message.msg)].push_back(std::move(message));
+}
+
+std::optional<Pacer::PacedMessage> Pacer::Dequeue(clock::time_point now) {
+    Refill(now);
+    if (tokens < 0) {
+        return std::nullopt;
+    }
+    for (auto& queue : queues) {
+        if (!queue.empty()) {
+            PacedMessage message = std::move(queue.front());
+            queue.pop_front();
+            queued_bytes -= message.size;
+            tokens -= message.size;
+            return message;
+        }
+    }
+    return std::nullopt;
+}
+
+Pacer::clock::duration Pacer::TimeUntilNext(clock::time_point now) const {
+    const double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    const double deficit = -(tokens + elapsed * bytes_per_second);
+    if (deficit <= 0) {
+        return clock::duration::zero();
+    }
+    return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(deficit / bytes_per_second));
+}
+
+std::vector<Pacer::PacedMessage> Pacer::TakeAll() {
+    std::vector<PacedMessage> messages;
+    for (auto& queue : queues) {
+        std::move(queue.begin(), queue.end(), std::back_inserter(messages));
+        queue.clear();
+    }
+    queued_bytes = 0;
+    return messages;
+}
+
+bool Pacer::Empty() const {
+    return std::all_of(queues.begin(), queues.end(), [](const auto& queue) { return queue.empty(); });
+}
+
+Pacer::Priority Pacer::Classify(const fp_network::Network& msg) {
+    if (msg.Payload_case() != fp_network::Network::kDataMsg) {
+        return CONTROL;
+    }
+    const fp_network::Data& data_msg = msg.data_msg();
+    if (data_msg.Payload_case() == fp_network::Data::kClientFrame) {
+        return INPUT;
+    }
+    if (data_msg.Payload_case() == fp_network::Data::kHostFrame
+        && data_msg.host_frame().DataFrame_case() == fp_network::HostDataFrame::kVideo) {
+        return VIDEO;
+    }
+    if (data_msg.Payload_case() == fp_network::Data::kHostFrame
+        && data_msg.host_frame().DataFrame_case() == fp_network::HostDataFrame::kAudio) {
+        return AUDIO;
+    }
+    return CONTROL;
+}
+
+void Pacer::Refill(clock::time_point now) {
+    if (now <= last_refill) {
+        return;
+    }
+    const double elapsed = std::chrono::duration<double>(now - last_refill).count();
+    tokens = std::min(tokens + elapsed * bytes_per_second, burst_bytes);
+    last_refill = now;
+}
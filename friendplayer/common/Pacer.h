@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include "protobuf/network_messages.pb.h"
+
+// Token bucket in front of the socket so frame bursts go out at a steady rate
+class Pacer {
+public:
+    using clock = std::chrono::system_clock;
+
+    // Queues are drained strictly in this order
+    enum Priority : size_t {
+        INPUT = 0,
+        AUDIO,
+        CONTROL,
+        VIDEO,
+        PRIORITY_COUNT
+    };
+
+    // Burst allowance, as time at the pacing rate
+    static constexpr std::chrono::milliseconds BURST_DURATION{5};
+    // Always let a few full datagrams through back to back
+    static constexpr size_t MIN_BURST_BYTES = 4 * 1500;
+
+    struct PacedMessage {
+        fp_network::Network msg;
+        size_t size;
+        // Messages still queued past this point are dropped without sending
+        clock::time_point deadline;
+    };
+
+    Pacer(uint32_t bitrate);
+
+    void SetRate(uint32_t bitrate);
+    void Enqueue(PacedMessage&& message);
+    // Next message allowed out at now, if any, in priority order
+    std::optional<PacedMessage> Dequeue(clock::time_point now);
+    // Time until Dequeue can return something again
+    clock::duration TimeUntilNext(clock::time_point now) const;
+
+    // Empties every queue regardless of budget
+    std::vector<PacedMessage> TakeAll();
+
+    bool Empty() const;
+    size_t QueuedBytes() const { return queued_bytes; }
+
+    static Priority Classify(const fp_network::Network& msg);
+
+private:
+    void Refill(clock::time_point now);
+
+    double bytes_per_second;
+    double burst_bytes;
+    // May go negative, a message is let through as long as there is any budget left
+    double tokens;
+    clock::time_point last_refill;
+
+    std::array<std::deque<PacedMessage>, PRIORITY_COUNT> queues;
+    size_t queued_bytes;
+};
@@ -0,0 +1,153 @@
+#include "common/WireFormat.h"
+
+namespace {
+template <typename T>
+void StoreLE(char* out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+template <typename T>
+T LoadLE(const char* in) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<T>(static_cast<uint8_t>(in[i])) << (8 * i);
+    }
+    return value;
+}
+}
+
+namespace WireFormat {
+
+bool IsMediaChunk(const fp_network::Network& msg) {
+    if (msg.Payload_case() != fp_network::Network::kDataMsg
+        || msg.data_msg().Payload_case() != fp_network::Data::kHostFrame) {
+        return false;
+    }
+    const auto& host_frame = msg.data_msg().host_frame();
+    // Header fields are single bytes
+    if (host_frame.stream_num() > UINT8_MAX) {
+        return false;
+    }
+    if (host_frame.has_video()) {
+        return host_frame.video().fec_group_size() <= UINT8_MAX;
+    }
+    return host_frame.has_audio();
+}
+
+bool IsMediaChunk(const char* data, size_t size) {
+    return size >= MEDIA_HEADER_SIZE && (static_cast<uint8_t>(data[0]) & MEDIA_CHUNK_MARKER) != 0;
+}
+
+void SerializeMediaHeader(const fp_network::Network& msg, char* out) {
+    const auto& data_msg = msg.data_msg();
+    const auto& host_frame = data_msg.host_frame();
+
+    uint8_t flags = 0;
+    uint8_t fec_group_size = 0;
+    uint32_t chunk_offset = 0;
+    uint64_t sequence_number = data_msg.sequence_number();
+    if (data_msg.needs_ack()) {
+        flags |= FLAG_NEEDS_ACK;
+    }
+    if (data_msg.unordered()) {
+        flags |= FLAG_UNORDERED;
+    }
+    if (host_frame.has_audio()) {
+        flags |= FLAG_AUDIO;
+        chunk_offset = host_frame.audio().chunk_offset();
+    } else {
+        flags |= (host_frame.video().frame_type() << FRAME_TYPE_SHIFT) & FRAME_TYPE_MASK;
+        fec_group_size = static_cast<uint8_t>(host_frame.video().fec_group_size());
+        chunk_offset = host_frame.video().chunk_offset();
+        if (fec_group_size > 0) {
+            sequence_number = host_frame.video().first_sequence_number();
+        }
+    }
+
+    char* header = out;
+    header[0] = static_cast<char>(MEDIA_CHUNK_MARKER | MEDIA_CHUNK_VERSION);
+    header[1] = static_cast<char>(flags);
+    header[2] = static_cast<char>(host_frame.stream_num());
+    header[3] = static_cast<char>(fec_group_size);
+    StoreLE<uint64_t>(header + 4, sequence_number);
+    StoreLE<uint32_t>(header + 12, host_frame.frame_num());
+    StoreLE<uint32_t>(header + 16, host_frame.frame_size());
+    StoreLE<uint32_t>(header + 20, chunk_offset);
+}
+
+std::string_view PayloadSlice(const fp_network::HostDataFrame& frame, const std::string& buffer) {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    if (frame.has_video()) {
+        offset = frame.video().chunk_offset();
+        size = frame.video().data_size();
+    } else if (frame.has_audio()) {
+        offset = frame.audio().chunk_offset();
+        size = frame.audio().data_size();
+    }
+    if (size == 0) {
+        return buffer;
+    }
+    if (offset > buffer.size()) {
+        return std::string_view();
+    }
+    return std::string_view(buffer).substr(offset, size);
+}
+
+std::string_view ReceivedPayload(const fp_network::HostDataFrame& frame, const std::string& buffer) {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    if (frame.has_video()) {
+        offset = frame.video().data_offset();
+        size = frame.video().data_size();
+    } else if (frame.has_audio()) {
+        offset = frame.audio().data_offset();
+        size = frame.audio().data_size();
+    }
+    if (size == 0) {
+        return buffer;
+    }
+    if (offset > buffer.size()) {
+        return std::string_view();
+    }
+    return std::string_view(buffer).substr(offset, size);
+}
+
+bool ParseMediaChunk(const char* data, size_t size, fp_network::Network& msg, std::string_view& payload) {
+    if (!IsMediaChunk(data, size)
+        || (static_cast<uint8_t>(data[0]) & ~MEDIA_CHUNK_MARKER) != MEDIA_CHUNK_VERSION) {
+        return false;
+    }
+    const uint8_t flags = static_cast<uint8_t>(data[1]);
+
+    auto& data_msg = *msg.mutable_data_msg();
+    data_msg.set_needs_ack((flags & FLAG_NEEDS_ACK) != 0);
+    data_msg.set_unordered((flags & FLAG_UNORDERED) != 0);
+
+    auto& host_frame = *data_msg.mutable_host_frame();
+    host_frame.set_stream_num(static_cast<uint8_t>(data[2]));
+    host_frame.set_frame_num(LoadLE<uint32_t>(data + 12));
+    host_frame.set_frame_size(LoadLE<uint32_t>(data + 16));
+    if (flags & FLAG_AUDIO) {
+        host_frame.mutable_audio()->set_chunk_offset(LoadLE<uint32_t>(data + 20));
+    } else {
+        const int frame_type = (flags & FRAME_TYPE_MASK) >> FRAME_TYPE_SHIFT;
+        if (!fp_network::VideoFrame::FrameType_IsValid(frame_type)) {
+            return false;
+        }
+        host_frame.mutable_video()->set_frame_type(static_cast<fp_network::VideoFrame::FrameType>(frame_type));
+        host_frame.mutable_video()->set_fec_group_size(static_cast<uint8_t>(data[3]));
+        host_frame.mutable_video()->set_chunk_offset(LoadLE<uint32_t>(data + 20));
+    }
+    if (host_frame.has_video() && host_frame.video().fec_group_size() > 0) {
+        host_frame.mutable_video()->set_first_sequence_number(LoadLE<uint64_t>(data + 4));
+    } else {
+        data_msg.set_sequence_number(LoadLE<uint64_t>(data + 4));
+    }
+    payload = std::string_view(data + MEDIA_HEADER_SIZE, size - MEDIA_HEADER_SIZE);
+    return true;
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+#include "protobuf/network_messages.pb.h"
+
+// Fixed binary framing for media chunks, everything else stays protobuf.
+// Layout, little endian:
+//   0  u8  marker | version
+//   1  u8  flags
+//   2  u8  stream_num
+//   3  u8  fec_group_size
+//   4  u64 sequence_number, or on parity chunks the frame's first_sequence_number
+//   12 u32 frame_num
+//   16 u32 frame_size
+//   20 u32 chunk_offset
+//   24 payload
+namespace WireFormat {
+    // Serialized fp_network::Network always starts with a field tag below 0x80,
+    // so the high bit alone tells the two formats apart
+    constexpr uint8_t MEDIA_CHUNK_MARKER = 0x80;
+    constexpr uint8_t MEDIA_CHUNK_VERSION = 1;
+    constexpr size_t MEDIA_HEADER_SIZE = 24;
+
+    // IPv4 + UDP headers
+    constexpr size_t UDP_IPV4_OVERHEAD = 28;
+    // Datagram size used before path MTU discovery finishes, or after it fails
+    constexpr size_t MIN_DATAGRAM_SIZE = 500;
+    // Largest datagram that fits a 1500 byte ethernet MTU
+    constexpr size_t MAX_DATAGRAM_SIZE = 1500 - UDP_IPV4_OVERHEAD;
+
+    enum MediaFlags : uint8_t {
+        FLAG_NEEDS_ACK = 1 << 0,
+        FLAG_UNORDERED = 1 << 1,
+        FLAG_AUDIO = 1 << 2,
+        // Bits 4-5 hold fp_network::VideoFrame::FrameType
+        FRAME_TYPE_SHIFT = 4,
+        FRAME_TYPE_MASK = 0x3 << FRAME_TYPE_SHIFT,
+    };
+
+    // Whether msg is a media chunk that can go out in the binary format
+    bool IsMediaChunk(const fp_network::Network& msg);
+    bool IsMediaChunk(const char* data, size_t size);
+
+    // Writes the MEDIA_HEADER_SIZE byte header for msg, the payload goes out right after it
+    void SerializeMediaHeader(const fp_network::Network& msg, char* out);
+    // Chunk's bytes within its data handle's buffer, which may hold the whole frame
+    std::string_view PayloadSlice(const fp_network::HostDataFrame& frame, const std::string& buffer);
+    // Received chunk's bytes within its data handle's buffer, which may hold the whole datagram
+    std::string_view ReceivedPayload(const fp_network::HostDataFrame& frame, const std::string& buffer);
+    // Fills in msg without its data, payload points into data
+    bool ParseMediaChunk(const char* data, size_t size, fp_network::Network& msg, std::string_view& payload);
+}
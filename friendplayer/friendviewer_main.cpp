@@ -1,7 +1,9 @@
 #include "actors/ActorEnvironment.h"
 #include "actors/CommonActorNames.h"
 
+#include "common/Benchmark.h"
 #include "common/Config.h"
+#include "common/Crypto.h"
 #include "common/Log.h"
 
 #include "protobuf/actor_messages.pb.h"
@@ -50,9 +52,14 @@ int main(int argc, char** argv) {
 
     Log::init_stdout_logging(LogOptions{Config::EnableTracing});
 
+    if (!Config::BenchmarkName.empty()) {
+        return Benchmark::Run(Config::BenchmarkName);
+    }
+
     ActorEnvironment env;
     google::protobuf::Any any_msg;
     std::string socket_type;
+    uint32_t socket_shards = 1;
 
     if (Config::HolepuncherIP.empty()) {
         fp_actor::SocketInitDirect socket_init;
@@ -65,6 +72,14 @@ int main(int argc, char** argv) {
         } else {
             LOG_INFO("Initializing hosting for direct connection");
             socket_type = "HostSocketActor";
+#ifdef __linux__
+            socket_shards = static_cast<uint32_t>(Config::SocketShards);
+            socket_init.set_reuse_port(socket_shards > 1);
+#else
+            if (Config::SocketShards > 1) {
+                LOG_WARNING("Socket shards need SO_REUSEPORT load balancing, using a single socket");
+            }
+#endif
         }
         any_msg.PackFrom(socket_init);
     } else {
@@ -82,6 +97,16 @@ int main(int argc, char** argv) {
         }
         any_msg.PackFrom(socket_init);
     }
+    if (Config::IsHost) {
+        // Generated before the sockets exist, so no client's handshake waits on it
+        LOG_INFO("Generating {} bit DH group", Crypto::DH_GROUP_BITS);
+        Crypto::CachedGroup(Crypto::DH_GROUP_BITS);
+    }
+
+    // Extra shards bind the same port, each with its own network thread and send queue
+    for (uint32_t i = 1; i < socket_shards; i++) {
+        env.AddActor(socket_type, fmt::format(SOCKET_SHARD_ACTOR_NAME_FORMAT, i), any_msg);
+    }
     env.AddActor(socket_type, SOCKET_ACTOR_NAME, std::make_optional(std::move(any_msg)));
 
     if (Config::IsHost) {
@@ -98,6 +123,7 @@ int main(int argc, char** argv) {
         }
         client_mgr_init.set_num_audio_streams(1);
         client_mgr_init.set_port(Config::Port);
+        client_mgr_init.set_socket_shards(socket_shards);
         any_msg.PackFrom(client_mgr_init);
     }
     env.AddActor("ClientManagerActor", CLIENT_MANAGER_ACTOR_NAME, std::make_optional(std::move(any_msg)));
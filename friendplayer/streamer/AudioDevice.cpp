@@ -0,0 +1,191 @@
+#include "streamer/AudioDevice.h"
+
+#include "common/Config.h"
+#include "common/Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+
+namespace {
+constexpr double PI = 3.14159265358979323846;
+
+uint32_t ReadLE(const char* data, int bytes) {
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return value;
+}
+}
+
+std::unique_ptr<AudioDevice> AudioDevice::Create(Backend backend) {
+    switch (backend) {
+#ifdef _WIN32
+    case Backend::WASAPI:
+        return std::make_unique<WasapiAudioDevice>();
+#endif
+    case Backend::SYNTHETIC:
+        return std::make_unique<SyntheticAudioDevice>();
+    case Backend::NULL_SINK:
+        return std::make_unique<NullAudioDevice>();
+    default:
+        LOG_WARNING("Audio backend {} isn't available on this platform, using {}", BackendName(backend), BackendName(Backend::NULL_SINK));
+        return std::make_unique<NullAudioDevice>();
+    }
+}
+
+AudioDevice::Backend AudioDevice::DefaultBackend() {
+#ifdef _WIN32
+    return Backend::WASAPI;
+#else
+    return Backend::NULL_SINK;
+#endif
+}
+
+const char* AudioDevice::BackendName(Backend backend) {
+    switch (backend) {
+    case Backend::WASAPI: return "wasapi";
+    case Backend::SYNTHETIC: return "synthetic";
+    case Backend::NULL_SINK: return "null";
+    }
+    return "unknown";
+}
+
+bool AudioDevice::ParseBackend(const std::string& name, Backend& backend) {
+    for (Backend candidate : { Backend::WASAPI, Backend::SYNTHETIC, Backend::NULL_SINK }) {
+        if (name == BackendName(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+AudioDevice::Backend AudioDevice::ConfiguredBackend() {
+    Backend backend = DefaultBackend();
+    if (!Config::AudioBackend.empty() && !ParseBackend(Config::AudioBackend, backend)) {
+        LOG_WARNING("Unknown audio backend {}, using {}", Config::AudioBackend, BackendName(backend));
+    }
+    return backend;
+}
+
+bool NullAudioDevice::OpenCapture() {
+    SetFormat();
+    return true;
+}
+
+bool NullAudioDevice::OpenRender() {
+    SetFormat();
+    return true;
+}
+
+void NullAudioDevice::SetFormat() {
+    format.sample_rate = SAMPLE_RATE;
+    format.channels = CHANNELS;
+    format.sample_format = AV_SAMPLE_FMT_S16;
+    format.block_align = CHANNELS * 2;
+}
+
+bool NullAudioDevice::Capture(std::string& out, int frames) {
+    out.assign(static_cast<size_t>(frames) * format.block_align, '\0');
+    return true;
+}
+
+bool SyntheticAudioDevice::OpenCapture() {
+    if (!Config::AudioWavFile.empty()) {
+        return LoadWav(Config::AudioWavFile);
+    }
+    if (Config::AudioSampleRate <= 0 || Config::AudioChannels <= 0) {
+        LOG_ERROR("Synthetic audio needs a positive rate and channel count, got {} Hz x {}", Config::AudioSampleRate, Config::AudioChannels);
+        return false;
+    }
+    format.sample_rate = Config::AudioSampleRate;
+    format.channels = Config::AudioChannels;
+    format.sample_format = AV_SAMPLE_FMT_S16;
+    format.block_align = format.channels * 2;
+    LOG_INFO("Synthetic audio: {} Hz tone at {} Hz x {}", TONE_FREQUENCY, format.sample_rate, format.channels);
+    return true;
+}
+
+bool SyntheticAudioDevice::OpenRender() {
+    format.sample_rate = Config::AudioSampleRate;
+    format.channels = Config::AudioChannels;
+    format.sample_format = AV_SAMPLE_FMT_S16;
+    format.block_align = format.channels * 2;
+    return format.sample_rate > 0 && format.channels > 0;
+}
+
+bool SyntheticAudioDevice::Capture(std::string& out, int frames) {
+    out.resize(static_cast<size_t>(frames) * format.block_align);
+    if (!wav_data.empty()) {
+        // Looped, the file's last frame runs straight into its first
+        for (size_t written = 0; written < out.size();) {
+            const size_t count = std::min(out.size() - written, wav_data.size() - wav_position);
+            memcpy(out.data() + written, wav_data.data() + wav_position, count);
+            written += count;
+            wav_position = (wav_position + count) % wav_data.size();
+        }
+        return true;
+    }
+
+    int16_t* samples = reinterpret_cast<int16_t*>(out.data());
+    for (int frame = 0; frame < frames; frame++, tone_frame++) {
+        const double phase = 2 * PI * TONE_FREQUENCY * static_cast<double>(tone_frame) / format.sample_rate;
+        const int16_t sample = static_cast<int16_t>(std::sin(phase) * TONE_AMPLITUDE * INT16_MAX);
+        for (int channel = 0; channel < format.channels; channel++) {
+            samples[frame * format.channels + channel] = sample;
+        }
+    }
+    return true;
+}
+
+bool SyntheticAudioDevice::LoadWav(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file || contents.size() < 12 || contents.compare(0, 4, "RIFF") != 0 || contents.compare(8, 4, "WAVE") != 0) {
+        LOG_ERROR("{} isn't a WAV file", path);
+        return false;
+    }
+
+    bool have_format = false;
+    for (size_t offset = 12; offset + 8 <= contents.size();) {
+        const std::string chunk_id = contents.substr(offset, 4);
+        const size_t chunk_size = std::min<size_t>(ReadLE(contents.data() + offset + 4, 4), contents.size() - offset - 8);
+        const char* chunk = contents.data() + offset + 8;
+        if (chunk_id == "fmt " && chunk_size >= 16) {
+            uint32_t format_tag = ReadLE(chunk, 2);
+            const uint32_t bits_per_sample = ReadLE(chunk + 14, 2);
+            // WAVE_FORMAT_EXTENSIBLE keeps the real tag at the front of its sub format GUID
+            if (format_tag == 0xFFFE && chunk_size >= 26) {
+                format_tag = ReadLE(chunk + 24, 2);
+            }
+            if (format_tag == 1 && bits_per_sample == 16) {
+                format.sample_format = AV_SAMPLE_FMT_S16;
+            } else if (format_tag == 3 && bits_per_sample == 32) {
+                format.sample_format = AV_SAMPLE_FMT_FLT;
+            } else {
+                LOG_ERROR("{} holds {} bit samples of format {}, only 16 bit PCM and 32 bit float are supported",
+                    path, bits_per_sample, format_tag);
+                return false;
+            }
+            format.channels = static_cast<int>(ReadLE(chunk + 2, 2));
+            format.sample_rate = static_cast<int>(ReadLE(chunk + 4, 4));
+            format.block_align = static_cast<int>(ReadLE(chunk + 12, 2));
+            have_format = format.channels > 0 && format.sample_rate > 0 && format.block_align > 0;
+        } else if (chunk_id == "data" && have_format) {
+            wav_data.assign(chunk, chunk_size - chunk_size % format.block_align);
+            break;
+        }
+        // Chunks are padded to an even size
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+    if (wav_data.empty()) {
+        LOG_ERROR("{} has no usable fmt and data chunks", path);
+        return false;
+    }
+    LOG_INFO("Synthetic audio: {} looped, {} Hz x {}", path, format.sample_rate, format.channels);
+    return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Audioclient.h>
+#include <mmdeviceapi.h>
+#endif
+
+// Where the host's raw audio comes from and where the viewer's decoded audio goes.
+// Samples are interleaved in the device's own format, AudioStreamer resamples to and from Opus
+class AudioDevice {
+public:
+    enum class Backend {
+        // Loopback capture of the default output, and playback on it
+        WASAPI,
+        // Captures a sine tone or a looped WAV file, playback is discarded
+        SYNTHETIC,
+        // Captures silence, playback is discarded
+        NULL_SINK,
+    };
+
+    struct Format {
+        int sample_rate = 0;
+        int channels = 0;
+        AVSampleFormat sample_format = AV_SAMPLE_FMT_NONE;
+        // Bytes in one sample of every channel
+        int block_align = 0;
+    };
+
+    static std::unique_ptr<AudioDevice> Create(Backend backend);
+    // WASAPI where it exists, otherwise the null sink
+    static Backend DefaultBackend();
+    static const char* BackendName(Backend backend);
+    // Inverse of BackendName, false for unknown names
+    static bool ParseBackend(const std::string& name, Backend& backend);
+    // Backend picked with --audio-backend, warns and falls back to the default on unknown names
+    static Backend ConfiguredBackend();
+
+    virtual ~AudioDevice() {}
+
+    // Either opens the device for the host or for the viewer, GetFormat is valid after
+    virtual bool OpenCapture() = 0;
+    virtual bool OpenRender() = 0;
+    const Format& GetFormat() const { return format; }
+
+    // Replaces out with exactly frames frames, blocking until the device has produced them
+    virtual bool Capture(std::string& out, int frames) = 0;
+    // Queues interleaved frames for playback, blocking while the device's buffer is full
+    virtual void Render(const std::string& in) = 0;
+
+protected:
+    Format format;
+};
+
+class NullAudioDevice : public AudioDevice {
+public:
+    // Opus' native format, so the resampler has nothing to convert
+    static constexpr int SAMPLE_RATE = 48000;
+    static constexpr int CHANNELS = 2;
+
+    bool OpenCapture() override;
+    bool OpenRender() override;
+    bool Capture(std::string& out, int frames) override;
+    void Render(const std::string&) override {}
+
+private:
+    void SetFormat();
+};
+
+// Generates audio as fast as it's asked for, callers pace it. Rate and channel count come from
+// --audio-rate and --audio-channels for the tone, or from the file with --audio-wav
+class SyntheticAudioDevice : public AudioDevice {
+public:
+    static constexpr double TONE_FREQUENCY = 440.0;
+    // Quarter of full scale, loud enough that the encoder doesn't treat it as silence
+    static constexpr double TONE_AMPLITUDE = 0.25;
+
+    bool OpenCapture() override;
+    bool OpenRender() override;
+    bool Capture(std::string& out, int frames) override;
+    void Render(const std::string&) override {}
+
+private:
+    // Reads 16 bit PCM or 32 bit float WAV data into wav_data, false if the file is missing or unsupported
+    bool LoadWav(const std::string& path);
+
+    // Empty for the tone
+    std::string wav_data;
+    size_t wav_position = 0;
+    uint64_t tone_frame = 0;
+};
+
+#ifdef _WIN32
+class WasapiAudioDevice : public AudioDevice {
+public:
+    // Shared mode buffer lengths, in 100 ns units
+    static constexpr REFERENCE_TIME CAPTURE_BUFFER_DURATION = 20000;
+    static constexpr REFERENCE_TIME RENDER_BUFFER_DURATION = 1000000;
+
+    bool OpenCapture() override;
+    bool OpenRender() override;
+    bool Capture(std::string& out, int frames) override;
+    void Render(const std::string& in) override;
+
+private:
+    bool OpenDefaultDevice();
+    // Plays silence on the output being captured, loopback capture stops delivering packets without it
+    bool StartSilentRender();
+    bool WaitForCapture(HANDLE* signals);
+
+    IMMDevice* device_ = nullptr;
+    IAudioClient* client_ = nullptr;
+    IAudioCaptureClient* capture_ = nullptr;
+    IAudioRenderClient* render_ = nullptr;
+    HANDLE receive_signal_ = nullptr;
+    HANDLE stop_signal_ = nullptr;
+    WAVEFORMATEX* system_format = nullptr;
+
+    // Captured past the last requested frame, handed out first next time
+    std::string wrapover_buf;
+};
+#endif
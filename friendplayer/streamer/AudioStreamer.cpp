@@ -2,248 +2,107 @@
 
 #include "common/Log.h"
 
-namespace {
-inline AVSampleFormat GetSampleFormat(const WAVEFORMATEX* wave_format)
-{
-    switch (wave_format->wFormatTag) {
-    case WAVE_FORMAT_PCM:
-        if (16 == wave_format->wBitsPerSample) {
-            return AV_SAMPLE_FMT_S16;
-        }
-        if (32 == wave_format->wBitsPerSample) {
-            return AV_SAMPLE_FMT_S32;
-        }
-        break;
-    case WAVE_FORMAT_IEEE_FLOAT:
-        return AV_SAMPLE_FMT_FLT;
-    case WAVE_FORMAT_ALAW:
-    case WAVE_FORMAT_MULAW:
-        return AV_SAMPLE_FMT_U8;
-    case WAVE_FORMAT_EXTENSIBLE:
-    {
-        const WAVEFORMATEXTENSIBLE* wfe = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wave_format);
-        if (KSDATAFORMAT_SUBTYPE_IEEE_FLOAT == wfe->SubFormat) {
-            return AV_SAMPLE_FMT_FLT;
-        }
-        if (KSDATAFORMAT_SUBTYPE_PCM == wfe->SubFormat) {
-            if (16 == wave_format->wBitsPerSample) {
-                return AV_SAMPLE_FMT_S16;
-            }
-            if (32 == wave_format->wBitsPerSample) {
-                return AV_SAMPLE_FMT_S32;
-            }
-        }
-        break;
-    }
-    default:
-        break;
-    }
-    return AV_SAMPLE_FMT_NONE;
-}
-}
-
-AudioStreamer::AudioStreamer() {
+#include <algorithm>
+
+AudioStreamer::AudioStreamer()
+    : AudioStreamer(AudioDevice::ConfiguredBackend()) {}
+
+AudioStreamer::AudioStreamer(AudioDevice::Backend backend)
+    : device(AudioDevice::Create(backend)),
+      encoder(nullptr),
+      decoder(nullptr),
+      context(nullptr),
+      system_frame_size(0),
+      resample_buffer(nullptr) {
     
 }
 
-bool AudioStreamer::InitRender() {
-    LPBYTE buffer;
-    uint32_t frames;
-    IAudioClient* client_tmp;
-    WAVEFORMATEX* wfex;
-    if (FAILED(device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr,
-        reinterpret_cast<void**>(&client_tmp)))) {
-        return false;
+AudioStreamer::~AudioStreamer() {
+    if (encoder) {
+        opus_encoder_destroy(encoder);
     }
-
-    if (FAILED(client_tmp->GetMixFormat(&wfex))) {
-        return false;
-    }
-
-    if (FAILED(client_tmp->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, 20000, 0, wfex, nullptr))) {
-        return false;
-    }
-
-    if (FAILED(client_tmp->GetBufferSize(&frames))) {
-        return false;
-    }
-
-    if (FAILED(client_tmp->GetService(__uuidof(IAudioRenderClient),
-        reinterpret_cast<void**>(&render_)))) {
-        return false;
-    }
-
-    if (FAILED(render_->GetBuffer(frames, &buffer))) {
-        return false;
-    }
-
-    memset(buffer, 0, frames * wfex->nBlockAlign);
-    if (FAILED(render_->ReleaseBuffer(frames, 0))) {
-        return false;
+    if (decoder) {
+        opus_decoder_destroy(decoder);
     }
-
-    return SUCCEEDED(client_tmp->Start());
+    swr_free(&context);
+    av_freep(&resample_buffer);
 }
 
 bool AudioStreamer::InitEncoder(uint32_t bitrate) {
     int err;
 
-    if (FAILED(CoInitialize(nullptr))) {
-        return false;
-    }
-
-    IMMDeviceEnumerator* enumerator = nullptr;
-    if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
-        __uuidof(IMMDeviceEnumerator),
-        reinterpret_cast<void**>(&enumerator)))) {
-        return false;
-    }
-
-    if (FAILED(enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device_))) {
+    if (!device->OpenCapture()) {
+        LOG_ERROR("Failed to open audio capture device");
         return false;
     }
+    const AudioDevice::Format& system_format = device->GetFormat();
 
-    if (FAILED(device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr,
-        reinterpret_cast<void**>(&client_)))) {
-        return false;
-    }
-
-    if (FAILED(client_->GetMixFormat(&system_format))) {
-        return false;
-    }
-    
-    receive_signal_ = CreateEvent(nullptr, false, false, nullptr);
-    stop_signal_ = CreateEvent(nullptr, false, false, nullptr);
-
-    if (FAILED(client_->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_LOOPBACK, 20000, 0, system_format, nullptr))) {
-        return false;
-    }
-    uint32_t frames;
-
-    if (FAILED(client_->GetBufferSize(&frames))) {
-        return false;
-    }
-
-    if (!InitRender()) {
+    // RESTRICTED_LOWDELAY is CELT only, which has no in-band FEC
+	encoder = opus_encoder_create(ENCODED_SAMPLE_RATE, ENCODED_CHANNEL_COUNT, OPUS_APPLICATION_AUDIO, &err);
+    if (err < 0) {
+        LOG_ERROR("Failed to create opus encoder: {}", err);
         return false;
     }
 
-    if (FAILED(client_->GetService(__uuidof(IAudioCaptureClient),
-        reinterpret_cast<void**>(&capture_)))) {
-        return false;
-    }
-    if (FAILED(client_->SetEventHandle(receive_signal_))) {
+    err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+    if (err < 0) {
+        LOG_ERROR("Failed to set opus encoder bitrate: {}", err);
         return false;
     }
 
-    client_->Start();
-
-	encoder = opus_encoder_create(ENCODED_SAMPLE_RATE, ENCODED_CHANNEL_COUNT, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err);
+    err = opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
     if (err < 0) {
-        LOG_ERROR("Failed to create opus encoder: {}", err);
+        LOG_ERROR("Failed to enable opus in-band FEC: {}", err);
         return false;
     }
 
-    err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
-    if (err < 0) {
-        LOG_ERROR("Failed to set opus encoder bitrate: {}", err);
+    if (!SetPacketLoss(0)) {
         return false;
     }
 
     context = swr_alloc_set_opts(
         nullptr, av_get_default_channel_layout(ENCODED_CHANNEL_COUNT), AV_SAMPLE_FMT_S16, ENCODED_SAMPLE_RATE,
-        av_get_default_channel_layout(system_format->nChannels), GetSampleFormat(system_format), system_format->nSamplesPerSec,
+        av_get_default_channel_layout(system_format.channels), system_format.sample_format, system_format.sample_rate,
         0, nullptr);
     swr_init(context);
 
-    system_frame_size = static_cast<int>(av_rescale_rnd(swr_get_delay(context, system_format->nSamplesPerSec) + OPUS_FRAME_SIZE,
-        system_format->nSamplesPerSec, ENCODED_SAMPLE_RATE, AV_ROUND_UP));
+    system_frame_size = static_cast<int>(av_rescale_rnd(swr_get_delay(context, system_format.sample_rate) + OPUS_FRAME_SIZE,
+        system_format.sample_rate, ENCODED_SAMPLE_RATE, AV_ROUND_UP));
     av_samples_alloc(&resample_buffer, nullptr, ENCODED_CHANNEL_COUNT, OPUS_FRAME_SIZE, AV_SAMPLE_FMT_S16, 0);
 
     return true;
 }
 
-bool AudioStreamer::WaitForCapture(HANDLE* signals) {
-    auto ret = WaitForMultipleObjects(2, signals, false, 10);
-    if (!(ret == WAIT_OBJECT_0 || ret == WAIT_TIMEOUT)) {
-        LOG_WARNING("Unknown error HRESULT={}", ret);
+bool AudioStreamer::SetBitrate(uint32_t bitrate) {
+    int err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+    if (err < 0) {
+        LOG_ERROR("Failed to set opus encoder bitrate: {}", err);
+        return false;
     }
-    return ret == WAIT_OBJECT_0 || ret == WAIT_TIMEOUT;
+    return true;
 }
 
-bool AudioStreamer::CaptureAudio(std::string& raw_out) {
-    HANDLE signals[] = { receive_signal_, stop_signal_ };
-    static std::string wrapover_buf;
-
-    raw_out = std::move(wrapover_buf);
-    wrapover_buf.clear();
-
-    const int requested_bytes = system_frame_size * system_format->nBlockAlign;
-
-    while(raw_out.size() < requested_bytes) {
-        WaitForCapture(signals);
-
-        uint32_t capture_size = 0;
-        LPBYTE buffer;
-        uint32_t frames;
-        DWORD flags;
-        uint64_t pos, ts;
-
-        while (true) {
-            auto ret = capture_->GetNextPacketSize(&capture_size);
-            if (!capture_size) {
-                break;
-            }
-
-            capture_->GetBuffer(&buffer, &frames, &flags, &pos, &ts);
-            raw_out.insert(raw_out.end(), buffer, buffer + (frames * system_format->nBlockAlign));
-            capture_->ReleaseBuffer(frames);
-        }
-    }
-
-    if (raw_out.size() > requested_bytes) {
-        wrapover_buf.resize(raw_out.size() - requested_bytes);
-        std::copy(raw_out.begin() + requested_bytes, raw_out.end(), wrapover_buf.begin());
+bool AudioStreamer::SetPacketLoss(uint32_t loss_percent) {
+    int err = opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(static_cast<opus_int32>(loss_percent)));
+    if (err < 0) {
+        LOG_ERROR("Failed to set opus encoder packet loss: {}", err);
+        return false;
     }
     return true;
 }
 
+bool AudioStreamer::CaptureAudio(std::string& raw_out) {
+    return device->Capture(raw_out, system_frame_size);
+}
+
 bool AudioStreamer::InitDecoder() {
     int err;
 
-    if (FAILED(CoInitialize(nullptr))) {
-        return false;
-    }
-
-    IMMDeviceEnumerator* enumerator = nullptr;
-    if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
-        __uuidof(IMMDeviceEnumerator),
-        reinterpret_cast<void**>(&enumerator)))) {
+    if (!device->OpenRender()) {
+        LOG_ERROR("Failed to open audio render device");
         return false;
     }
-
-    if (FAILED(enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device_))) {
-        return false;
-    }
-
-    if (FAILED(device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr,
-        reinterpret_cast<void**>(&client_)))) {
-        return false;
-    }
-
-    if (FAILED(client_->GetMixFormat(&system_format))) {
-        return false;
-    }
-
-    if (FAILED(client_->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, 1000000, 0, system_format, nullptr))) {
-        return false;
-    }
-
-    if (FAILED(client_->GetService(__uuidof(IAudioRenderClient), reinterpret_cast<void**>(&render_)))) {
-        return false;
-    }
-    
-    client_->Start();
+    const AudioDevice::Format& system_format = device->GetFormat();
 
     decoder = opus_decoder_create(ENCODED_SAMPLE_RATE, ENCODED_CHANNEL_COUNT, &err);
     if (err < 0) {
@@ -252,13 +111,13 @@ bool AudioStreamer::InitDecoder() {
     }
 
     context = swr_alloc_set_opts(
-        nullptr, av_get_default_channel_layout(system_format->nChannels), GetSampleFormat(system_format), system_format->nSamplesPerSec,
+        nullptr, av_get_default_channel_layout(system_format.channels), system_format.sample_format, system_format.sample_rate,
         av_get_default_channel_layout(ENCODED_CHANNEL_COUNT), AV_SAMPLE_FMT_S16, ENCODED_SAMPLE_RATE,
         0, nullptr);
     swr_init(context);
 
     system_frame_size = static_cast<int>(av_rescale_rnd(swr_get_delay(context, ENCODED_SAMPLE_RATE) + OPUS_FRAME_SIZE,
-        system_format->nSamplesPerSec, ENCODED_SAMPLE_RATE, AV_ROUND_UP));
+        system_format.sample_rate, ENCODED_SAMPLE_RATE, AV_ROUND_UP));
 
     return true;
 }
@@ -285,48 +144,46 @@ bool AudioStreamer::EncodeAudio(const std::string& raw_in, std::string& enc_out)
     return true;
 }
 
-bool AudioStreamer::DecodeAudio(const std::string& enc_in, std::string& raw_out) {
+bool AudioStreamer::DecodeAudio(const std::string& enc_in, std::string& raw_out, uint32_t frames_lost) {
+    raw_out.clear();
+    for (uint32_t i = 0; i < frames_lost; i++) {
+        const bool from_fec = i + 1 == frames_lost;
+        if (!DecodeFrame(from_fec ? &enc_in : nullptr, from_fec, raw_out)) {
+            return false;
+        }
+    }
+    return DecodeFrame(&enc_in, false, raw_out);
+}
+
+bool AudioStreamer::DecodeFrame(const std::string* enc_in, bool decode_fec, std::string& raw_out) {
     if (decode_output_buffer.size() != SAMPLES_PER_OPUS_FRAME) {
         decode_output_buffer.resize(SAMPLES_PER_OPUS_FRAME);
     }
 
-    int num_samples = opus_decode(decoder, reinterpret_cast<const unsigned char*>(enc_in.data()), static_cast<opus_int32>(enc_in.size()),
-        decode_output_buffer.data(), static_cast<int>(decode_output_buffer.size()), 0);
+    // A null packet makes Opus conceal, with decode_fec it rebuilds the previous frame from this packet
+    const unsigned char* packet = enc_in ? reinterpret_cast<const unsigned char*>(enc_in->data()) : nullptr;
+    const opus_int32 packet_size = enc_in ? static_cast<opus_int32>(enc_in->size()) : 0;
+    int num_samples = opus_decode(decoder, packet, packet_size, decode_output_buffer.data(), OPUS_FRAME_SIZE, decode_fec ? 1 : 0);
 
     if (num_samples < 0) {
         LOG_ERROR("Audio decode failed: {}", opus_strerror(num_samples));
         return false;
     }
 
-    int sys_bytes = system_frame_size * system_format->nChannels * (system_format->wBitsPerSample / 8);
-    raw_out.resize(sys_bytes);
+    const int block_align = device->GetFormat().block_align;
+    const size_t offset = raw_out.size();
+    raw_out.resize(offset + static_cast<size_t>(system_frame_size) * block_align);
 
-    uint8_t* raw_out_in[] = { reinterpret_cast<uint8_t*>(raw_out.data()) };
+    uint8_t* raw_out_in[] = { reinterpret_cast<uint8_t*>(raw_out.data() + offset) };
     const uint8_t* opus_out_in[] = {reinterpret_cast<uint8_t*>(decode_output_buffer.data())};
-    swr_convert(context, raw_out_in, system_frame_size, opus_out_in, OPUS_FRAME_SIZE);
+    int converted = swr_convert(context, raw_out_in, system_frame_size, opus_out_in, num_samples);
+    raw_out.resize(offset + static_cast<size_t>(std::max(converted, 0)) * block_align);
 
     return true;
 }
 
 void AudioStreamer::PlayAudio(const std::string& raw_out) {
-    UINT pad_amt, buf_sz, avail_sz;
-    
-    client_->GetCurrentPadding(&pad_amt);
-    client_->GetBufferSize(&buf_sz);
-
-    avail_sz = buf_sz - pad_amt;
-    UINT write_sz = static_cast<UINT>(raw_out.size() / system_format->nBlockAlign);
-
-    BYTE* buf = nullptr;
-    while (buf == nullptr) {
-        auto result = render_->GetBuffer(write_sz, &buf);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-
-    std::copy(raw_out.begin(), raw_out.begin() +
-        (write_sz * system_format->nBlockAlign), buf);
-
-    render_->ReleaseBuffer(write_sz, 0);
+    device->Render(raw_out);
 }
 
 void AudioStreamer::SetVolume(double volume) {
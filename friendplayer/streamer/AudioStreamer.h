@@ -1,8 +1,8 @@
 #pragma once
 
-#include <Windows.h>
-#include <Audioclient.h>
-#include <mmdeviceapi.h>
+#include "streamer/AudioDevice.h"
+
+#include <memory>
 #include <stdint.h>
 #include <opus/opus.h>
 #include <string>
@@ -24,33 +24,35 @@ public:
 	inline static constexpr int BYTES_PER_OPUS_FRAME = OPUS_FRAME_SIZE * BYTES_PER_FRAME;
 	inline static constexpr int SAMPLES_PER_OPUS_FRAME = BYTES_PER_OPUS_FRAME / 2;
 
+	// Uses the backend picked with --audio-backend
 	AudioStreamer();
+	explicit AudioStreamer(AudioDevice::Backend backend);
+	~AudioStreamer();
 
-	bool InitRender();
 	bool InitEncoder(uint32_t bitrate);
+	bool SetBitrate(uint32_t bitrate);
+	// Expected loss on the way to the viewers, Opus spends bitrate on in-band FEC in proportion
+	bool SetPacketLoss(uint32_t loss_percent);
 	bool InitDecoder();
 
-	bool WaitForCapture(HANDLE* signals);
 	bool CaptureAudio(std::string& raw_out);
 
 	void PlayAudio(const std::string& raw_in);
 	void SetVolume(double volume);
 
 	bool EncodeAudio(const std::string& raw_in, std::string& enc_out);
-	bool DecodeAudio(const std::string& enc_in, std::string& raw_out);
+	// frames_lost frames went missing just before enc_in, the last is rebuilt from enc_in's FEC
+	// and any earlier ones are concealed, so raw_out holds frames_lost + 1 frames of audio
+	bool DecodeAudio(const std::string& enc_in, std::string& raw_out, uint32_t frames_lost = 0);
 	
 private:
-	IMMDevice* device_;
-	IAudioClient* client_;
-	IAudioCaptureClient* capture_;
-	// Feed in empty sound during no capture
-	IAudioRenderClient* render_;
-	HANDLE receive_signal_;
-    HANDLE stop_signal_;
+	// Decodes one frame of enc_in, or conceals one when enc_in is null, and appends it resampled to raw_out
+	bool DecodeFrame(const std::string* enc_in, bool decode_fec, std::string& raw_out);
+
+	std::unique_ptr<AudioDevice> device;
 
 	OpusEncoder* encoder;
 	OpusDecoder* decoder;
-	WAVEFORMATEX* system_format;
 
 	SwrContext* context;
 	
@@ -163,6 +163,24 @@ bool VideoStreamer::InitEncode(int monitor_idx, int& out_monitor_enum_index) {
     return true;
 }
 
+bool VideoStreamer::SetBitrate(int avg_bitrate) {
+    if (!nvenc || enc_cfg.rcParams.averageBitRate == static_cast<uint32_t>(avg_bitrate)) {
+        return false;
+    }
+    LOG_INFO("Reconfiguring NVENC bitrate {} -> {} bits/second", enc_cfg.rcParams.averageBitRate, avg_bitrate);
+    enc_cfg.rcParams.averageBitRate = avg_bitrate;
+    enc_cfg.rcParams.vbvBufferSize = (enc_cfg.rcParams.averageBitRate * init_params.frameRateDen / init_params.frameRateNum) * 5;
+    enc_cfg.rcParams.maxBitRate = enc_cfg.rcParams.averageBitRate;
+    enc_cfg.rcParams.vbvInitialDelay = enc_cfg.rcParams.vbvBufferSize;
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {};
+    reconfigure_params.version = NV_ENC_RECONFIGURE_PARAMS_VER;
+    reconfigure_params.reInitEncodeParams = init_params;
+    reconfigure_params.resetEncoder = 0;
+    reconfigure_params.forceIDR = 0;
+    return nvenc->Reconfigure(&reconfigure_params);
+}
+
 void VideoStreamer::Encode(bool send_idr, bool pps_sps_requested, std::string& data_out) {
     using namespace std::chrono_literals;
     auto begin_time = std::chrono::system_clock::now();
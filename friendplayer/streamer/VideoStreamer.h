@@ -24,6 +24,8 @@ public:
 
     bool InitEncode(int monitor_idx, int& out_monitor_enum_index);
     void Encode(bool send_idr, bool send_pps_sps, std::string& data_out);
+    // Changes the CBR target without restarting the stream
+    bool SetBitrate(int avg_bitrate);
 
     bool InitDecode();
     bool InitDisplay(int stream_num);
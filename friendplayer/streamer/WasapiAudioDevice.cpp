@@ -0,0 +1,232 @@
+#include "streamer/AudioDevice.h"
+
+#ifdef _WIN32
+
+#include "common/Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace {
+inline AVSampleFormat GetSampleFormat(const WAVEFORMATEX* wave_format)
+{
+    switch (wave_format->wFormatTag) {
+    case WAVE_FORMAT_PCM:
+        if (16 == wave_format->wBitsPerSample) {
+            return AV_SAMPLE_FMT_S16;
+        }
+        if (32 == wave_format->wBitsPerSample) {
+            return AV_SAMPLE_FMT_S32;
+        }
+        break;
+    case WAVE_FORMAT_IEEE_FLOAT:
+        return AV_SAMPLE_FMT_FLT;
+    case WAVE_FORMAT_ALAW:
+    case WAVE_FORMAT_MULAW:
+        return AV_SAMPLE_FMT_U8;
+    case WAVE_FORMAT_EXTENSIBLE:
+    {
+        const WAVEFORMATEXTENSIBLE* wfe = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wave_format);
+        if (KSDATAFORMAT_SUBTYPE_IEEE_FLOAT == wfe->SubFormat) {
+            return AV_SAMPLE_FMT_FLT;
+        }
+        if (KSDATAFORMAT_SUBTYPE_PCM == wfe->SubFormat) {
+            if (16 == wave_format->wBitsPerSample) {
+                return AV_SAMPLE_FMT_S16;
+            }
+            if (32 == wave_format->wBitsPerSample) {
+                return AV_SAMPLE_FMT_S32;
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return AV_SAMPLE_FMT_NONE;
+}
+}
+
+bool WasapiAudioDevice::OpenDefaultDevice() {
+    if (FAILED(CoInitialize(nullptr))) {
+        return false;
+    }
+
+    IMMDeviceEnumerator* enumerator = nullptr;
+    if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
+        __uuidof(IMMDeviceEnumerator),
+        reinterpret_cast<void**>(&enumerator)))) {
+        return false;
+    }
+
+    if (FAILED(enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device_))) {
+        return false;
+    }
+
+    if (FAILED(device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr,
+        reinterpret_cast<void**>(&client_)))) {
+        return false;
+    }
+
+    if (FAILED(client_->GetMixFormat(&system_format))) {
+        return false;
+    }
+
+    format.sample_rate = static_cast<int>(system_format->nSamplesPerSec);
+    format.channels = system_format->nChannels;
+    format.sample_format = GetSampleFormat(system_format);
+    format.block_align = system_format->nBlockAlign;
+    return true;
+}
+
+bool WasapiAudioDevice::StartSilentRender() {
+    LPBYTE buffer;
+    uint32_t frames;
+    IAudioClient* client_tmp;
+    WAVEFORMATEX* wfex;
+    if (FAILED(device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr,
+        reinterpret_cast<void**>(&client_tmp)))) {
+        return false;
+    }
+
+    if (FAILED(client_tmp->GetMixFormat(&wfex))) {
+        return false;
+    }
+
+    if (FAILED(client_tmp->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, CAPTURE_BUFFER_DURATION, 0, wfex, nullptr))) {
+        return false;
+    }
+
+    if (FAILED(client_tmp->GetBufferSize(&frames))) {
+        return false;
+    }
+
+    if (FAILED(client_tmp->GetService(__uuidof(IAudioRenderClient),
+        reinterpret_cast<void**>(&render_)))) {
+        return false;
+    }
+
+    if (FAILED(render_->GetBuffer(frames, &buffer))) {
+        return false;
+    }
+
+    memset(buffer, 0, frames * wfex->nBlockAlign);
+    if (FAILED(render_->ReleaseBuffer(frames, 0))) {
+        return false;
+    }
+
+    return SUCCEEDED(client_tmp->Start());
+}
+
+bool WasapiAudioDevice::OpenCapture() {
+    if (!OpenDefaultDevice()) {
+        return false;
+    }
+
+    receive_signal_ = CreateEvent(nullptr, false, false, nullptr);
+    stop_signal_ = CreateEvent(nullptr, false, false, nullptr);
+
+    if (FAILED(client_->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_EVENTCALLBACK | AUDCLNT_STREAMFLAGS_LOOPBACK,
+        CAPTURE_BUFFER_DURATION, 0, system_format, nullptr))) {
+        return false;
+    }
+    uint32_t frames;
+
+    if (FAILED(client_->GetBufferSize(&frames))) {
+        return false;
+    }
+
+    if (!StartSilentRender()) {
+        return false;
+    }
+
+    if (FAILED(client_->GetService(__uuidof(IAudioCaptureClient),
+        reinterpret_cast<void**>(&capture_)))) {
+        return false;
+    }
+    if (FAILED(client_->SetEventHandle(receive_signal_))) {
+        return false;
+    }
+
+    client_->Start();
+    return true;
+}
+
+bool WasapiAudioDevice::OpenRender() {
+    if (!OpenDefaultDevice()) {
+        return false;
+    }
+
+    if (FAILED(client_->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, RENDER_BUFFER_DURATION, 0, system_format, nullptr))) {
+        return false;
+    }
+
+    if (FAILED(client_->GetService(__uuidof(IAudioRenderClient), reinterpret_cast<void**>(&render_)))) {
+        return false;
+    }
+
+    client_->Start();
+    return true;
+}
+
+bool WasapiAudioDevice::WaitForCapture(HANDLE* signals) {
+    auto ret = WaitForMultipleObjects(2, signals, false, 10);
+    if (!(ret == WAIT_OBJECT_0 || ret == WAIT_TIMEOUT)) {
+        LOG_WARNING("Unknown error HRESULT={}", ret);
+    }
+    return ret == WAIT_OBJECT_0 || ret == WAIT_TIMEOUT;
+}
+
+bool WasapiAudioDevice::Capture(std::string& out, int frames) {
+    HANDLE signals[] = { receive_signal_, stop_signal_ };
+
+    out = std::move(wrapover_buf);
+    wrapover_buf.clear();
+
+    const size_t requested_bytes = static_cast<size_t>(frames) * system_format->nBlockAlign;
+
+    while (out.size() < requested_bytes) {
+        WaitForCapture(signals);
+
+        uint32_t capture_size = 0;
+        LPBYTE buffer;
+        uint32_t packet_frames;
+        DWORD flags;
+        uint64_t pos, ts;
+
+        while (true) {
+            capture_->GetNextPacketSize(&capture_size);
+            if (!capture_size) {
+                break;
+            }
+
+            capture_->GetBuffer(&buffer, &packet_frames, &flags, &pos, &ts);
+            out.insert(out.end(), buffer, buffer + (packet_frames * system_format->nBlockAlign));
+            capture_->ReleaseBuffer(packet_frames);
+        }
+    }
+
+    if (out.size() > requested_bytes) {
+        wrapover_buf.assign(out.begin() + requested_bytes, out.end());
+        out.resize(requested_bytes);
+    }
+    return true;
+}
+
+void WasapiAudioDevice::Render(const std::string& in) {
+    UINT write_sz = static_cast<UINT>(in.size() / system_format->nBlockAlign);
+
+    BYTE* buf = nullptr;
+    while (buf == nullptr) {
+        render_->GetBuffer(write_sz, &buf);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::copy(in.begin(), in.begin() +
+        (write_sz * system_format->nBlockAlign), buf);
+
+    render_->ReleaseBuffer(write_sz, 0);
+}
+
+#endif